@@ -0,0 +1,176 @@
+#include "rain.h"
+#include <stdio.h>
+
+// translates a module into a C translation unit that rain can load in place
+// of its bytecode:
+//
+//   aot module.rnc module.c
+//   clang -O2 -shared -fPIC -I. -o module.so module.c -L. -lrain
+//   rain module.so
+//
+// every instruction becomes a label in R_aot_run, static jumps become gotos,
+// and everything else calls straight into librain. calls, returns and imports
+// set instr_ptr and fall back to a switch over the labels, so control can
+// still move between native and interpreted modules. the output must be
+// compiled with the same GC flags as librain.
+
+static void emit_image(FILE *out, FILE *fp) {
+  int c;
+  uint32_t i = 0;
+
+  fprintf(out, "const unsigned char R_aot_image[] = {");
+  while((c = fgetc(fp)) != EOF) {
+    fprintf(out, i % 12 == 0 ? "\n  " : " ");
+    fprintf(out, "0x%02x,", c);
+    i += 1;
+  }
+  fprintf(out, "\n};\n\n");
+  fprintf(out, "const uint32_t R_aot_image_size = sizeof(R_aot_image);\n\n");
+}
+
+static void emit_label(FILE *out, uint32_t to, uint32_t count) {
+  if(to == count) {
+    fprintf(out, "goto L_end;");
+  }
+  else {
+    fprintf(out, "goto L_%u;", to);
+  }
+}
+
+static void emit_instr(FILE *out, R_op *instr, uint32_t i, uint32_t count) {
+  uint8_t op = R_OP(instr);
+  int64_t to = (int64_t)i + 1 + R_SI(instr);
+
+  fprintf(out, "L_%u: // ", i);
+  if(op < NUM_INSTRS) {
+    fprintf(out, "%s\n", R_INSTR_NAMES[op]);
+  }
+  else {
+    fprintf(out, "??? %02x\n", op);
+  }
+
+  switch(op) {
+    case PUSH_CONST:
+      fprintf(out, "  vm_push(vm, &vm->consts[R_UI(I(%u))]);\n", i);
+      break;
+
+    case POP:
+      fprintf(out, "  vm_pop(vm);\n");
+      break;
+
+    case NOP:
+      break;
+
+    case JUMP:
+    case JUMPIF:
+      if(to < 0 || to > count) {
+        // leaves the module, let the interpreter sort it out
+        fprintf(out, "  vm->instr_ptr = base + %u;\n  return;\n", i);
+        break;
+      }
+
+      if(op == JUMPIF) {
+        fprintf(out, "  top = vm_pop(vm);\n");
+        fprintf(out, "  if(R_aot_true(&top)) {\n    ");
+      }
+      else {
+        fprintf(out, "  {\n    ");
+      }
+
+      if(to <= i) {
+        fprintf(out, "R_heap_safepoint();\n    ");
+      }
+
+      emit_label(out, to, count);
+      fprintf(out, "\n  }\n");
+      break;
+
+    case CALLTO:
+    case RETURN:
+    case IMPORT:
+    case IMPORT_AT:
+    case CALL:
+    case CALL_METHOD:
+    case NEXT:
+      fprintf(out, "  vm->instr_ptr = base + %u;\n", i);
+      fprintf(out, "  R_%s(vm, I(%u));\n", R_INSTR_NAMES[op], i);
+      fprintf(out, "  vm->instr_ptr += 1;\n");
+      fprintf(out, "  goto dispatch;\n");
+      break;
+
+    default:
+      if(op < NUM_INSTRS) {
+        fprintf(out, "  R_%s(vm, I(%u));\n", R_INSTR_NAMES[op], i);
+      }
+      else {
+        fprintf(out, "  vm->instr_ptr = base + %u;\n  return;\n", i);
+      }
+  }
+}
+
+int main(int argv, char **argc) {
+  if(argv < 3) {
+    fprintf(stderr, "Usage: %s FILE OUT\n", argc[0]);
+    return 1;
+  }
+
+  R_vm *this = vm_new();
+  if(this == NULL) {
+    fprintf(stderr, "Unable to create VM\n");
+    return 1;
+  }
+
+  FILE *fp = fopen(argc[1], "rb");
+  if(fp == NULL) {
+    fprintf(stderr, "Unable to open file %s\n", argc[1]);
+    return 1;
+  }
+
+  if(!vm_load(this, fp)) {
+    fprintf(stderr, "Unable to load bytecode\n");
+    return 1;
+  }
+
+  FILE *out = fopen(argc[2], "w");
+  if(out == NULL) {
+    fprintf(stderr, "Unable to open file %s\n", argc[2]);
+    return 1;
+  }
+
+  uint32_t count = this->num_instrs;
+
+  fprintf(out, "// generated by aot from %s\n", argc[1]);
+  fprintf(out, "#include \"rain.h\"\n\n");
+  fprintf(out, "#define I(n) (vm->instrs + base + (n))\n\n");
+
+  rewind(fp);
+  emit_image(out, fp);
+  fclose(fp);
+
+  fprintf(out, "static inline bool R_aot_true(R_box *val) {\n");
+  fprintf(out, "  return val->type != R_TYPE_NULL &&\n");
+  fprintf(out, "         !(val->type == R_TYPE_BOOL && val->i64 == 0);\n");
+  fprintf(out, "}\n\n");
+
+  fprintf(out, "void R_aot_run(R_vm *vm, uint32_t base) {\n");
+  fprintf(out, "  R_box top;\n\n");
+  fprintf(out, "dispatch:\n");
+  fprintf(out, "  R_heap_safepoint();\n");
+  fprintf(out, "  switch(vm->instr_ptr - base) {\n");
+  for(uint32_t i=0; i<count; i++) {
+    fprintf(out, "    case %u: goto L_%u;\n", i, i);
+  }
+  fprintf(out, "    default: return;\n");
+  fprintf(out, "  }\n\n");
+
+  for(uint32_t i=0; i<count; i++) {
+    emit_instr(out, this->instrs + i, i, count);
+  }
+
+  fprintf(out, "L_end:\n");
+  fprintf(out, "  vm->instr_ptr = base + %u;\n", count);
+  fprintf(out, "}\n");
+
+  fclose(out);
+  return 0;
+}
@@ -0,0 +1,643 @@
+#include "rain.h"
+
+#include <string.h>
+
+// packed int64 and float64 arrays
+//
+// element-wise kernels take each operand as a pointer plus a flag saying
+// whether it is a vector or a single broadcast scalar. on x86-64 the AVX2
+// versions handle as much of the array as they can and the portable loops
+// finish the tail; elsewhere the portable loops do everything.
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define R_ARRAY_AVX2
+#define R_AVX2 __attribute__((target("avx2")))
+#endif
+
+static bool R_has_avx2() {
+#ifdef R_ARRAY_AVX2
+  static int have = -1;
+  if(have < 0) {
+    __builtin_cpu_init();
+    have = __builtin_cpu_supports("avx2");
+  }
+  return have;
+#else
+  return false;
+#endif
+}
+
+#define R_AT(p, vec, i) ((p)[(vec) ? (i) : 0])
+
+#define R_LOOP(out, expr) \
+  for(uint32_t i=0; i<n; i++) { \
+    x = R_AT(a, av, i); \
+    y = R_AT(b, bv, i); \
+    out[i] = (expr); \
+  }
+
+static void R_i64_bin(int op, int64_t *out, const int64_t *a, bool av,
+                      const int64_t *b, bool bv, uint32_t n) {
+  int64_t x, y;
+
+  switch(op) {
+    case BIN_ADD: R_LOOP(out, x + y); break;
+    case BIN_SUB: R_LOOP(out, x - y); break;
+    case BIN_MUL: R_LOOP(out, x * y); break;
+    case BIN_DIV: R_LOOP(out, x / y); break;
+  }
+}
+
+static void R_f64_bin(int op, double *out, const double *a, bool av,
+                      const double *b, bool bv, uint32_t n) {
+  double x, y;
+
+  switch(op) {
+    case BIN_ADD: R_LOOP(out, x + y); break;
+    case BIN_SUB: R_LOOP(out, x - y); break;
+    case BIN_MUL: R_LOOP(out, x * y); break;
+    case BIN_DIV: R_LOOP(out, x / y); break;
+  }
+}
+
+#define R_CMP_KERNEL(name, type) \
+static void name(int op, int64_t *out, const type *a, bool av, \
+                 const type *b, bool bv, uint32_t n) { \
+  type x, y; \
+  switch(op) { \
+    case CMP_LT: R_LOOP(out, x < y); break; \
+    case CMP_LE: R_LOOP(out, x <= y); break; \
+    case CMP_GT: R_LOOP(out, x > y); break; \
+    case CMP_GE: R_LOOP(out, x >= y); break; \
+    case CMP_EQ: R_LOOP(out, x == y); break; \
+    case CMP_NE: R_LOOP(out, x != y); break; \
+  } \
+}
+
+R_CMP_KERNEL(R_i64_cmp, int64_t)
+R_CMP_KERNEL(R_f64_cmp, double)
+
+#ifdef R_ARRAY_AVX2
+
+// each returns how many leading elements it handled
+
+#define R_VLOOP(load, store, sa, sb, expr) \
+  for(; i + 4 <= n; i += 4) { \
+    x = av ? load((void *)(a + i)) : sa; \
+    y = bv ? load((void *)(b + i)) : sb; \
+    store((void *)(out + i), expr); \
+  }
+
+R_AVX2 static uint32_t R_i64_bin_avx2(int op, int64_t *out, const int64_t *a, bool av,
+                                      const int64_t *b, bool bv, uint32_t n) {
+  __m256i sa = _mm256_set1_epi64x(a[0]);
+  __m256i sb = _mm256_set1_epi64x(b[0]);
+  __m256i x, y;
+  uint32_t i = 0;
+
+  // AVX2 has no 64-bit multiply or divide
+  switch(op) {
+    case BIN_ADD: R_VLOOP(_mm256_loadu_si256, _mm256_storeu_si256, sa, sb, _mm256_add_epi64(x, y)); break;
+    case BIN_SUB: R_VLOOP(_mm256_loadu_si256, _mm256_storeu_si256, sa, sb, _mm256_sub_epi64(x, y)); break;
+  }
+
+  return i;
+}
+
+R_AVX2 static uint32_t R_f64_bin_avx2(int op, double *out, const double *a, bool av,
+                                      const double *b, bool bv, uint32_t n) {
+  __m256d sa = _mm256_set1_pd(a[0]);
+  __m256d sb = _mm256_set1_pd(b[0]);
+  __m256d x, y;
+  uint32_t i = 0;
+
+  switch(op) {
+    case BIN_ADD: R_VLOOP(_mm256_loadu_pd, _mm256_storeu_pd, sa, sb, _mm256_add_pd(x, y)); break;
+    case BIN_SUB: R_VLOOP(_mm256_loadu_pd, _mm256_storeu_pd, sa, sb, _mm256_sub_pd(x, y)); break;
+    case BIN_MUL: R_VLOOP(_mm256_loadu_pd, _mm256_storeu_pd, sa, sb, _mm256_mul_pd(x, y)); break;
+    case BIN_DIV: R_VLOOP(_mm256_loadu_pd, _mm256_storeu_pd, sa, sb, _mm256_div_pd(x, y)); break;
+  }
+
+  return i;
+}
+
+// comparisons produce all-ones masks, narrowed to 0 / 1
+#define R_VCMP(load, sa, sb, mask) \
+  for(; i + 4 <= n; i += 4) { \
+    x = av ? load((void *)(a + i)) : sa; \
+    y = bv ? load((void *)(b + i)) : sb; \
+    _mm256_storeu_si256((void *)(out + i), mask); \
+  }
+
+R_AVX2 static uint32_t R_i64_cmp_avx2(int op, int64_t *out, const int64_t *a, bool av,
+                                      const int64_t *b, bool bv, uint32_t n) {
+  __m256i sa = _mm256_set1_epi64x(a[0]);
+  __m256i sb = _mm256_set1_epi64x(b[0]);
+  __m256i one = _mm256_set1_epi64x(1);
+  __m256i x, y;
+  uint32_t i = 0;
+
+  switch(op) {
+    case CMP_LT: R_VCMP(_mm256_loadu_si256, sa, sb, _mm256_and_si256(_mm256_cmpgt_epi64(y, x), one)); break;
+    case CMP_LE: R_VCMP(_mm256_loadu_si256, sa, sb, _mm256_andnot_si256(_mm256_cmpgt_epi64(x, y), one)); break;
+    case CMP_GT: R_VCMP(_mm256_loadu_si256, sa, sb, _mm256_and_si256(_mm256_cmpgt_epi64(x, y), one)); break;
+    case CMP_GE: R_VCMP(_mm256_loadu_si256, sa, sb, _mm256_andnot_si256(_mm256_cmpgt_epi64(y, x), one)); break;
+    case CMP_EQ: R_VCMP(_mm256_loadu_si256, sa, sb, _mm256_and_si256(_mm256_cmpeq_epi64(x, y), one)); break;
+    case CMP_NE: R_VCMP(_mm256_loadu_si256, sa, sb, _mm256_andnot_si256(_mm256_cmpeq_epi64(x, y), one)); break;
+  }
+
+  return i;
+}
+
+#define R_FMASK(x, y, pred) \
+  _mm256_and_si256(_mm256_castpd_si256(_mm256_cmp_pd(x, y, pred)), one)
+
+R_AVX2 static uint32_t R_f64_cmp_avx2(int op, int64_t *out, const double *a, bool av,
+                                      const double *b, bool bv, uint32_t n) {
+  __m256d sa = _mm256_set1_pd(a[0]);
+  __m256d sb = _mm256_set1_pd(b[0]);
+  __m256i one = _mm256_set1_epi64x(1);
+  __m256d x, y;
+  uint32_t i = 0;
+
+  switch(op) {
+    case CMP_LT: R_VCMP(_mm256_loadu_pd, sa, sb, R_FMASK(x, y, _CMP_LT_OQ)); break;
+    case CMP_LE: R_VCMP(_mm256_loadu_pd, sa, sb, R_FMASK(x, y, _CMP_LE_OQ)); break;
+    case CMP_GT: R_VCMP(_mm256_loadu_pd, sa, sb, R_FMASK(x, y, _CMP_GT_OQ)); break;
+    case CMP_GE: R_VCMP(_mm256_loadu_pd, sa, sb, R_FMASK(x, y, _CMP_GE_OQ)); break;
+    case CMP_EQ: R_VCMP(_mm256_loadu_pd, sa, sb, R_FMASK(x, y, _CMP_EQ_OQ)); break;
+    case CMP_NE: R_VCMP(_mm256_loadu_pd, sa, sb, R_FMASK(x, y, _CMP_NEQ_UQ)); break;
+  }
+
+  return i;
+}
+
+#define R_REDUCE_SUM  0
+#define R_REDUCE_MIN  1
+#define R_REDUCE_MAX  2
+
+// n must be at least 4; the partial result covers the first i elements
+R_AVX2 static uint32_t R_i64_reduce_avx2(int op, const int64_t *a, uint32_t n, int64_t *res) {
+  __m256i acc = op == R_REDUCE_SUM ? _mm256_setzero_si256() : _mm256_loadu_si256((void *)a);
+  int64_t lanes[4];
+  uint32_t i = op == R_REDUCE_SUM ? 0 : 4;
+
+  for(; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((void *)(a + i));
+    __m256i gt = _mm256_cmpgt_epi64(acc, x);
+
+    switch(op) {
+      case R_REDUCE_SUM: acc = _mm256_add_epi64(acc, x); break;
+      case R_REDUCE_MIN: acc = _mm256_blendv_epi8(acc, x, gt); break;
+      case R_REDUCE_MAX: acc = _mm256_blendv_epi8(x, acc, gt); break;
+    }
+  }
+
+  _mm256_storeu_si256((void *)lanes, acc);
+  *res = lanes[0];
+  for(int j=1; j<4; j++) {
+    switch(op) {
+      case R_REDUCE_SUM: *res += lanes[j]; break;
+      case R_REDUCE_MIN: *res = lanes[j] < *res ? lanes[j] : *res; break;
+      case R_REDUCE_MAX: *res = lanes[j] > *res ? lanes[j] : *res; break;
+    }
+  }
+
+  return i;
+}
+
+R_AVX2 static uint32_t R_f64_reduce_avx2(int op, const double *a, uint32_t n, double *res) {
+  __m256d acc = op == R_REDUCE_SUM ? _mm256_setzero_pd() : _mm256_loadu_pd(a);
+  double lanes[4];
+  uint32_t i = op == R_REDUCE_SUM ? 0 : 4;
+
+  for(; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(a + i);
+
+    switch(op) {
+      case R_REDUCE_SUM: acc = _mm256_add_pd(acc, x); break;
+      case R_REDUCE_MIN: acc = _mm256_min_pd(acc, x); break;
+      case R_REDUCE_MAX: acc = _mm256_max_pd(acc, x); break;
+    }
+  }
+
+  _mm256_storeu_pd(lanes, acc);
+  *res = lanes[0];
+  for(int j=1; j<4; j++) {
+    switch(op) {
+      case R_REDUCE_SUM: *res += lanes[j]; break;
+      case R_REDUCE_MIN: *res = lanes[j] < *res ? lanes[j] : *res; break;
+      case R_REDUCE_MAX: *res = lanes[j] > *res ? lanes[j] : *res; break;
+    }
+  }
+
+  return i;
+}
+
+R_AVX2 static uint32_t R_f64_dot_avx2(const double *a, const double *b, uint32_t n, double *res) {
+  __m256d acc = _mm256_setzero_pd();
+  double lanes[4];
+  uint32_t i = 0;
+
+  for(; i + 4 <= n; i += 4) {
+    acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+
+  _mm256_storeu_pd(lanes, acc);
+  *res = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  return i;
+}
+
+#endif
+
+// operands
+
+typedef struct R_operand {
+  bool vec;
+  bool is_int;
+  uint32_t size;
+  int64_t i64;
+  double f64;
+  const int64_t *i64s;
+  const double *f64s;
+  double *tmp;
+} R_operand;
+
+static bool R_operand_init(R_operand *opnd, R_box *val) {
+  memset(opnd, 0, sizeof(R_operand));
+
+  switch(val->type) {
+    case R_TYPE_INT:
+      opnd->is_int = true;
+      opnd->i64 = val->i64;
+      opnd->f64 = (double)val->i64;
+      opnd->i64s = &opnd->i64;
+      opnd->f64s = &opnd->f64;
+      return true;
+    case R_TYPE_FLOAT:
+      opnd->f64 = val->f64;
+      opnd->f64s = &opnd->f64;
+      return true;
+    case R_TYPE_INTS:
+      opnd->vec = true;
+      opnd->is_int = true;
+      opnd->size = val->size;
+      opnd->i64s = val->i64s;
+      return true;
+    case R_TYPE_FLOATS:
+      opnd->vec = true;
+      opnd->size = val->size;
+      opnd->f64s = val->f64s;
+      return true;
+  }
+
+  return false;
+}
+
+// int arrays mixed with floats are widened into a temporary copy
+static const double *R_operand_f64s(R_operand *opnd) {
+  if(opnd->f64s == NULL) {
+    opnd->tmp = malloc(sizeof(double) * (opnd->size > 0 ? opnd->size : 1));
+    for(uint32_t i=0; i<opnd->size; i++) {
+      opnd->tmp[i] = (double)opnd->i64s[i];
+    }
+    opnd->f64s = opnd->tmp;
+  }
+
+  return opnd->f64s;
+}
+
+// sets up both operands and returns the length of the result, or -1 if the
+// operands can't be combined
+static int64_t R_operands(R_operand *lhs, R_operand *rhs, R_box *l, R_box *r) {
+  if(!R_operand_init(lhs, l) || !R_operand_init(rhs, r)) {
+    return -1;
+  }
+
+  if(lhs->vec && rhs->vec && lhs->size != rhs->size) {
+    return -1;
+  }
+
+  return lhs->vec ? lhs->size : rhs->size;
+}
+
+bool R_array_bin_op(R_box *ret, R_box *lhs, R_box *rhs, int op) {
+  R_operand a, b;
+
+  if(!R_IS_ARRAY(lhs) && !R_IS_ARRAY(rhs)) {
+    return false;
+  }
+
+  int64_t n = R_operands(&a, &b, lhs, rhs);
+  if(n < 0) {
+    R_set_null(ret);
+    return true;
+  }
+
+  uint32_t done = 0;
+
+  if(a.is_int && b.is_int) {
+    R_set_ints(ret, n);
+#ifdef R_ARRAY_AVX2
+    if(R_has_avx2()) {
+      done = R_i64_bin_avx2(op, ret->i64s, a.i64s, a.vec, b.i64s, b.vec, n);
+    }
+#endif
+    R_i64_bin(op, ret->i64s + done, a.i64s + (a.vec ? done : 0), a.vec,
+              b.i64s + (b.vec ? done : 0), b.vec, n - done);
+    return true;
+  }
+
+  const double *af = R_operand_f64s(&a);
+  const double *bf = R_operand_f64s(&b);
+
+  R_set_floats(ret, n);
+#ifdef R_ARRAY_AVX2
+  if(R_has_avx2()) {
+    done = R_f64_bin_avx2(op, ret->f64s, af, a.vec, bf, b.vec, n);
+  }
+#endif
+  R_f64_bin(op, ret->f64s + done, af + (a.vec ? done : 0), a.vec,
+            bf + (b.vec ? done : 0), b.vec, n - done);
+
+  free(a.tmp);
+  free(b.tmp);
+  return true;
+}
+
+// comparisons produce an int array of 0 / 1
+bool R_array_cmp(R_box *ret, R_box *lhs, R_box *rhs, int op) {
+  R_operand a, b;
+
+  if(!R_IS_ARRAY(lhs) && !R_IS_ARRAY(rhs)) {
+    return false;
+  }
+
+  int64_t n = R_operands(&a, &b, lhs, rhs);
+  if(n < 0) {
+    R_set_bool(ret, false);
+    return true;
+  }
+
+  uint32_t done = 0;
+  R_set_ints(ret, n);
+
+  if(a.is_int && b.is_int) {
+#ifdef R_ARRAY_AVX2
+    if(R_has_avx2()) {
+      done = R_i64_cmp_avx2(op, ret->i64s, a.i64s, a.vec, b.i64s, b.vec, n);
+    }
+#endif
+    R_i64_cmp(op, ret->i64s + done, a.i64s + (a.vec ? done : 0), a.vec,
+              b.i64s + (b.vec ? done : 0), b.vec, n - done);
+    return true;
+  }
+
+  const double *af = R_operand_f64s(&a);
+  const double *bf = R_operand_f64s(&b);
+
+#ifdef R_ARRAY_AVX2
+  if(R_has_avx2()) {
+    done = R_f64_cmp_avx2(op, ret->i64s, af, a.vec, bf, b.vec, n);
+  }
+#endif
+  R_f64_cmp(op, ret->i64s + done, af + (a.vec ? done : 0), a.vec,
+            bf + (b.vec ? done : 0), b.vec, n - done);
+
+  free(a.tmp);
+  free(b.tmp);
+  return true;
+}
+
+// elements
+
+void R_array_get(R_box *ret, R_box *array, R_box *key) {
+  if(R_TYPE_ISNT(key, INT) || key->i64 < 0 || key->i64 >= array->size) {
+    R_set_null(ret);
+  }
+  else if(R_TYPE_IS(array, INTS)) {
+    R_set_int(ret, array->i64s[key->i64]);
+  }
+  else {
+    R_set_float(ret, array->f64s[key->i64]);
+  }
+}
+
+// stores outside the array and non-numeric values are ignored
+void R_array_set(R_box *array, R_box *key, R_box *val) {
+  R_operand opnd;
+
+  if(R_TYPE_ISNT(key, INT) || key->i64 < 0 || key->i64 >= array->size) {
+    return;
+  }
+
+  if(!R_operand_init(&opnd, val) || opnd.vec) {
+    return;
+  }
+
+  if(R_TYPE_IS(array, INTS)) {
+    array->i64s[key->i64] = opnd.is_int ? opnd.i64 : (int64_t)opnd.f64;
+  }
+  else {
+    array->f64s[key->i64] = opnd.f64;
+  }
+}
+
+// reductions
+
+static void R_array_reduce(R_box *ret, R_box *array, int op) {
+  uint32_t n = array->size;
+  uint32_t i = 0;
+
+  if(!R_IS_ARRAY(array) || (n == 0 && op != R_REDUCE_SUM)) {
+    R_set_null(ret);
+    return;
+  }
+
+  if(R_TYPE_IS(array, INTS)) {
+    const int64_t *a = array->i64s;
+    int64_t res = op == R_REDUCE_SUM ? 0 : a[0];
+
+#ifdef R_ARRAY_AVX2
+    if(n >= 4 && R_has_avx2()) {
+      i = R_i64_reduce_avx2(op, a, n, &res);
+    }
+#endif
+
+    for(; i<n; i++) {
+      switch(op) {
+        case R_REDUCE_SUM: res += a[i]; break;
+        case R_REDUCE_MIN: res = a[i] < res ? a[i] : res; break;
+        case R_REDUCE_MAX: res = a[i] > res ? a[i] : res; break;
+      }
+    }
+
+    R_set_int(ret, res);
+    return;
+  }
+
+  const double *a = array->f64s;
+  double res = op == R_REDUCE_SUM ? 0 : a[0];
+
+#ifdef R_ARRAY_AVX2
+  if(n >= 4 && R_has_avx2()) {
+    i = R_f64_reduce_avx2(op, a, n, &res);
+  }
+#endif
+
+  for(; i<n; i++) {
+    switch(op) {
+      case R_REDUCE_SUM: res += a[i]; break;
+      case R_REDUCE_MIN: res = a[i] < res ? a[i] : res; break;
+      case R_REDUCE_MAX: res = a[i] > res ? a[i] : res; break;
+    }
+  }
+
+  R_set_float(ret, res);
+}
+
+void R_array_sum(R_box *ret, R_box *array) {
+  R_array_reduce(ret, array, R_REDUCE_SUM);
+}
+
+void R_array_min(R_box *ret, R_box *array) {
+  R_array_reduce(ret, array, R_REDUCE_MIN);
+}
+
+void R_array_max(R_box *ret, R_box *array) {
+  R_array_reduce(ret, array, R_REDUCE_MAX);
+}
+
+void R_array_dot(R_box *ret, R_box *lhs, R_box *rhs) {
+  R_operand a, b;
+
+  if(!R_IS_ARRAY(lhs) || !R_IS_ARRAY(rhs) || R_operands(&a, &b, lhs, rhs) < 0) {
+    R_set_null(ret);
+    return;
+  }
+
+  uint32_t n = a.size;
+  uint32_t i = 0;
+
+  if(a.is_int && b.is_int) {
+    int64_t res = 0;
+    for(; i<n; i++) {
+      res += a.i64s[i] * b.i64s[i];
+    }
+
+    R_set_int(ret, res);
+    return;
+  }
+
+  const double *af = R_operand_f64s(&a);
+  const double *bf = R_operand_f64s(&b);
+  double res = 0;
+
+#ifdef R_ARRAY_AVX2
+  if(R_has_avx2()) {
+    i = R_f64_dot_avx2(af, bf, n, &res);
+  }
+#endif
+
+  for(; i<n; i++) {
+    res += af[i] * bf[i];
+  }
+
+  free(a.tmp);
+  free(b.tmp);
+  R_set_float(ret, res);
+}
+
+// conversions
+
+// builds an array of the given type from a length (zero filled), another
+// array, or a table with keys 0 ... n - 1
+void R_array_convert(R_box *ret, R_box *from, int type) {
+  R_box box;
+  R_box key;
+  uint32_t n = 0;
+
+  switch(from->type) {
+    case R_TYPE_INT:
+      if(from->i64 < 0 || from->i64 > INT32_MAX) {
+        R_set_null(ret);
+        return;
+      }
+      n = from->i64;
+      break;
+
+    case R_TYPE_INTS:
+    case R_TYPE_FLOATS:
+      n = from->size;
+      break;
+
+    case R_TYPE_TABLE:
+      R_set_int(&key, 0);
+      while(n < INT32_MAX && R_table_get(from, &key) != NULL) {
+        n += 1;
+        key.i64 = n;
+      }
+      break;
+
+    default:
+      R_set_null(ret);
+      return;
+  }
+
+  if(type == R_TYPE_INTS) {
+    R_set_ints(&box, n);
+  }
+  else {
+    R_set_floats(&box, n);
+  }
+
+  if(R_TYPE_IS(from, INT)) {
+    memset(box.ptr, 0, sizeof(int64_t) * n);
+  }
+  else if(from->type == type) {
+    memcpy(box.ptr, from->ptr, sizeof(int64_t) * n);
+  }
+  else {
+    R_set_int(&key, 0);
+    for(uint32_t i=0; i<n; i++) {
+      R_box val;
+      key.i64 = i;
+
+      if(R_TYPE_IS(from, TABLE)) {
+        val = *R_table_get(from, &key);
+      }
+      else {
+        R_array_get(&val, from, &key);
+      }
+
+      // anything that isn't a number becomes zero
+      if(R_TYPE_ISNT(&val, INT) && R_TYPE_ISNT(&val, FLOAT)) {
+        R_set_int(&val, 0);
+      }
+
+      R_array_set(&box, &key, &val);
+    }
+  }
+
+  *ret = box;
+}
+
+void R_array_to_table(R_box *ret, R_box *array) {
+  R_box key;
+  R_box val;
+
+  if(!R_IS_ARRAY(array)) {
+    R_set_null(ret);
+    return;
+  }
+
+  // sized so that filling it never resizes
+  R_set_table_sized(ret, array->size * 2 + R_INIT_TABLE_SIZE);
+
+  for(uint32_t i=0; i<(uint32_t)array->size; i++) {
+    R_set_int(&key, i);
+    R_array_get(&val, array, &key);
+    R_table_set(ret, &key, &val);
+  }
+}
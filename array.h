@@ -0,0 +1,23 @@
+#ifndef R_ARRAY_H
+#define R_ARRAY_H
+
+#include "core.h"
+#include <stdbool.h>
+
+#define R_IS_ARRAY(x) (R_TYPE_IS(x, INTS) || R_TYPE_IS(x, FLOATS))
+
+bool R_array_bin_op(R_box *ret, R_box *lhs, R_box *rhs, int op);
+bool R_array_cmp(R_box *ret, R_box *lhs, R_box *rhs, int op);
+
+void R_array_get(R_box *ret, R_box *array, R_box *key);
+void R_array_set(R_box *array, R_box *key, R_box *val);
+
+void R_array_sum(R_box *ret, R_box *array);
+void R_array_min(R_box *ret, R_box *array);
+void R_array_max(R_box *ret, R_box *array);
+void R_array_dot(R_box *ret, R_box *lhs, R_box *rhs);
+
+void R_array_convert(R_box *ret, R_box *from, int type);
+void R_array_to_table(R_box *ret, R_box *array);
+
+#endif
@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include "rain.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// byte buffers over mmap'd files
+//
+// the box points at an R_buf, which points at the R_map that owns the pages.
+// slicing only allocates a new R_buf, so a multi-GB file is never copied, and
+// the mapping goes away once the last slice of it is collected.
+
+static void R_set_buf(R_box *ret, R_map *map, const char *data, uint64_t len) {
+  R_buf *buf = R_alloc(R_KIND_BUF, sizeof(R_buf));
+  buf->map = map;
+  buf->data = data;
+  buf->len = len;
+
+  ret->type = R_TYPE_BUF;
+  ret->ptr = buf;
+  ret->size = 0;
+  ret->meta = NULL;
+}
+
+bool R_set_buf_file(R_box *ret, const char *path) {
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+
+  if(fd < 0) {
+    fprintf(stderr, "Unable to open file %s\n", path);
+    return false;
+  }
+
+  if(fstat(fd, &st) != 0) {
+    fprintf(stderr, "Unable to stat file %s\n", path);
+    close(fd);
+    return false;
+  }
+
+  void *addr = NULL;
+  if(st.st_size > 0) {
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(addr == MAP_FAILED) {
+      fprintf(stderr, "Unable to map file %s\n", path);
+      close(fd);
+      return false;
+    }
+  }
+
+  close(fd);
+
+  R_map *map = R_alloc(R_KIND_MAP, sizeof(R_map));
+  map->addr = addr;
+  map->len = st.st_size;
+
+  R_set_buf(ret, map, addr, st.st_size);
+  return true;
+}
+
+void R_map_release(R_map *map) {
+  if(map->addr != NULL) {
+    munmap(map->addr, map->len);
+    map->addr = NULL;
+  }
+}
+
+uint64_t R_buf_len(R_box *buf) {
+  return ((R_buf *)buf->ptr)->len;
+}
+
+void R_buf_get(R_box *ret, R_box *buf, R_box *key) {
+  R_buf *self = buf->ptr;
+
+  if(R_TYPE_ISNT(key, INT) || key->i64 < 0 || (uint64_t)key->i64 >= self->len) {
+    R_set_null(ret);
+    return;
+  }
+
+  R_set_int(ret, (unsigned char)self->data[key->i64]);
+}
+
+// bounds are clamped; negative bounds count from the end
+void R_buf_slice(R_box *ret, R_box *buf, int64_t start, int64_t end) {
+  R_buf *self = buf->ptr;
+  int64_t len = self->len;
+
+  if(start < 0) {
+    start += len;
+  }
+
+  if(end < 0) {
+    end += len;
+  }
+
+  start = start < 0 ? 0 : start > len ? len : start;
+  end = end < start ? start : end > len ? len : end;
+
+  R_set_buf(ret, self->map, self->data + start, end - start);
+}
+
+// finds a byte (an int) or a string, returning its offset or null
+void R_buf_find(R_box *ret, R_box *buf, R_box *needle, int64_t from) {
+  R_buf *self = buf->ptr;
+  const char *found = NULL;
+
+  if(from < 0 || (uint64_t)from >= self->len) {
+    R_set_null(ret);
+    return;
+  }
+
+  const char *hay = self->data + from;
+  size_t len = self->len - from;
+
+  if(R_TYPE_IS(needle, INT)) {
+    found = memchr(hay, (unsigned char)needle->i64, len);
+  }
+  else if(R_TYPE_IS(needle, STR) && needle->size == 1) {
+    found = memchr(hay, (unsigned char)needle->str[0], len);
+  }
+  else if(R_TYPE_IS(needle, STR) && needle->size > 0) {
+    found = memmem(hay, len, needle->str, needle->size);
+  }
+
+  if(found == NULL) {
+    R_set_null(ret);
+    return;
+  }
+
+  R_set_int(ret, found - self->data);
+}
+
+// fmt is [>]{u,i}{8,16,32,64}: little-endian unless prefixed with >
+void R_buf_read_int(R_box *ret, R_box *buf, int64_t off, const char *fmt) {
+  R_buf *self = buf->ptr;
+  bool big = false;
+  bool sign;
+  int bits;
+
+  if(*fmt == '>') {
+    big = true;
+    fmt += 1;
+  }
+
+  if(*fmt != 'u' && *fmt != 'i') {
+    R_set_null(ret);
+    return;
+  }
+
+  sign = *fmt == 'i';
+  bits = atoi(fmt + 1);
+
+  if(bits != 8 && bits != 16 && bits != 32 && bits != 64) {
+    R_set_null(ret);
+    return;
+  }
+
+  uint64_t width = bits / 8;
+  if(off < 0 || (uint64_t)off + width > self->len) {
+    R_set_null(ret);
+    return;
+  }
+
+  const unsigned char *bytes = (const unsigned char *)self->data + off;
+  uint64_t val = 0;
+
+  for(uint64_t i=0; i<width; i++) {
+    uint64_t byte = bytes[big ? i : width - 1 - i];
+    val = (val << 8) | byte;
+  }
+
+  if(sign && bits < 64 && (val >> (bits - 1)) & 1) {
+    val |= ~0ull << bits;
+  }
+
+  R_set_int(ret, (int64_t)val);
+}
+
+// parses a decimal integer at the start of the buffer
+void R_buf_parse_int(R_box *ret, R_box *buf) {
+  R_buf *self = buf->ptr;
+  uint64_t i = 0;
+  bool neg = false;
+  int64_t val = 0;
+
+  if(i < self->len && (self->data[i] == '-' || self->data[i] == '+')) {
+    neg = self->data[i] == '-';
+    i += 1;
+  }
+
+  uint64_t digits = i;
+  for(; i<self->len && self->data[i] >= '0' && self->data[i] <= '9'; i++) {
+    val = val * 10 + (self->data[i] - '0');
+  }
+
+  if(i == digits) {
+    R_set_null(ret);
+    return;
+  }
+
+  R_set_int(ret, neg ? -val : val);
+}
+
+void R_buf_to_str(R_box *ret, R_box *buf) {
+  R_buf *self = buf->ptr;
+
+  if(self->len > INT32_MAX) {
+    R_set_null(ret);
+    return;
+  }
+
+  ret->type = R_TYPE_STR;
+  ret->str = R_alloc(R_KIND_RAW, self->len + 1);
+  ret->size = self->len;
+  ret->meta = NULL;
+
+  memcpy(ret->str, self->data, self->len);
+  ret->str[self->len] = 0;
+}
+
+// gives back the resident pages of a slice that has been processed. they're
+// read from the file again if touched, so this only affects memory use.
+void R_buf_drop(R_box *buf) {
+  R_buf *self = buf->ptr;
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = ((uintptr_t)self->data + page - 1) & ~(page - 1);
+  uintptr_t end = ((uintptr_t)self->data + self->len) & ~(page - 1);
+
+  if(end > start) {
+    madvise((void *)start, end - start, MADV_DONTNEED);
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef R_BUFFER_H
+#define R_BUFFER_H
+
+#include "core.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// a read-only file mapping, unmapped when the collector frees it
+typedef struct R_map {
+  void *addr;
+  size_t len;
+} R_map;
+
+// a window onto a mapping; slices share the mapping instead of copying it
+typedef struct R_buf {
+  R_map *map;
+  const char *data;
+  uint64_t len;
+} R_buf;
+
+bool R_set_buf_file(R_box *ret, const char *path);
+void R_map_release(R_map *map);
+
+uint64_t R_buf_len(R_box *buf);
+void R_buf_get(R_box *ret, R_box *buf, R_box *key);
+void R_buf_slice(R_box *ret, R_box *buf, int64_t start, int64_t end);
+void R_buf_find(R_box *ret, R_box *buf, R_box *needle, int64_t from);
+void R_buf_read_int(R_box *ret, R_box *buf, int64_t off, const char *fmt);
+void R_buf_parse_int(R_box *ret, R_box *buf);
+void R_buf_to_str(R_box *ret, R_box *buf);
+void R_buf_drop(R_box *buf);
+
+#endif
@@ -2,6 +2,7 @@
 
 #define __USE_GNU
 #include <dlfcn.h>
+#include <unistd.h>
 
 void R_builtin_load(R_vm *vm) {
   R_box name = vm_pop(vm);
@@ -31,6 +32,79 @@ void R_builtin_print(R_vm *vm) {
   }
 }
 
+// json_decode(str or buf)
+void R_builtin_json_decode(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box src = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(R_TYPE_IS(&src, STR)) {
+    R_json_decode(ret, src.str, src.size);
+  }
+  else if(R_TYPE_IS(&src, BUF)) {
+    R_json_decode(ret, ((R_buf *)src.ptr)->data, ((R_buf *)src.ptr)->len);
+  }
+  else {
+    R_set_null(ret);
+  }
+}
+
+void R_builtin_json_encode(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box val = vm_pop(vm);
+  R_json_encode(&vm->frame->ret, &val);
+}
+
+// marshal(val, path): without a path, returns the stream as a string
+void R_builtin_marshal(R_vm *vm) {
+  vm_fit(vm, 2);
+  R_box path = vm_pop(vm);
+  R_box val = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(R_TYPE_ISNT(&path, STR)) {
+    R_marshal(ret, &val);
+    return;
+  }
+
+  FILE *file = fopen(path.str, "wb");
+  if(file == NULL) {
+    fprintf(stderr, "Unable to open file %s\n", path.str);
+    R_set_null(ret);
+    return;
+  }
+
+  R_marshal_out out;
+  R_marshal_open(&out, file);
+  bool ok = R_marshal_write(&out, &val);
+  ok = R_marshal_close(&out) && ok;
+  ok = fclose(file) == 0 && ok;
+
+  // don't leave a partial file that looks like it holds a value
+  if(!ok) {
+    unlink(path.str);
+  }
+
+  R_set_bool(ret, ok);
+}
+
+// unmarshal(str or buf)
+void R_builtin_unmarshal(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box src = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(R_TYPE_IS(&src, STR)) {
+    R_unmarshal(ret, src.str, src.size);
+  }
+  else if(R_TYPE_IS(&src, BUF)) {
+    R_unmarshal(ret, ((R_buf *)src.ptr)->data, ((R_buf *)src.ptr)->len);
+  }
+  else {
+    R_set_null(ret);
+  }
+}
+
 void R_builtin_scope(R_vm *vm) {
   // push frame -2 scope because we don't want to push this function call's
   // scope, we want its outer scope
@@ -53,6 +127,14 @@ void R_builtin_import(R_vm *vm) {
   printf("importing: ");
   R_box_print(&pop);
   if(R_TYPE_IS(&pop, STR)) {
+    R_module *mod = vm_module(vm, pop.str);
+    if(mod != NULL) {
+      if(mod->ready) {
+        vm_save(vm, &mod->value);
+      }
+      return;
+    }
+
     uint32_t module_start = vm->num_instrs;
     vm_import(vm, pop.str);
     R_frame top = *vm->frame;
@@ -61,3 +143,272 @@ void R_builtin_import(R_vm *vm) {
     vm->frame->return_to = module_start - 1;
   }
 }
+
+static void R_stats_set(R_box *table, const char *name, uint64_t num) {
+  R_box key;
+  R_box val;
+  R_set_str(&key, (char *)name);
+  R_set_int(&val, num);
+  R_table_set(table, &key, &val);
+}
+
+void R_builtin_heap_stats(R_vm *vm) {
+  R_heap_stats stats;
+  R_box ret;
+  R_box counts;
+  R_box bytes;
+  R_box pauses;
+  R_box key;
+  R_box val;
+
+  vm_heap_stats(vm, &stats);
+
+  R_set_table(&ret);
+  R_set_table(&counts);
+  R_set_table(&bytes);
+  R_set_table(&pauses);
+
+  for(int i=0; i<R_NUM_KINDS; i++) {
+    R_stats_set(&counts, R_KIND_NAMES[i], stats.count[i]);
+    R_stats_set(&bytes, R_KIND_NAMES[i], stats.bytes[i]);
+  }
+
+  // pause buckets are keyed by their upper bound in microseconds
+  for(int i=0; i<R_PAUSE_BUCKETS; i++) {
+    R_set_int(&key, i == R_PAUSE_BUCKETS - 1 ? -1 : 1l << i);
+    R_set_int(&val, stats.pauses[i]);
+    R_table_set(&pauses, &key, &val);
+  }
+
+  R_set_str(&key, "allocs");
+  R_table_set(&ret, &key, &counts);
+  R_set_str(&key, "bytes");
+  R_table_set(&ret, &key, &bytes);
+  R_set_str(&key, "pauses");
+  R_table_set(&ret, &key, &pauses);
+
+  R_stats_set(&ret, "scopes", stats.scopes);
+  R_stats_set(&ret, "live", stats.live_bytes);
+  R_stats_set(&ret, "collections", stats.collections);
+  R_stats_set(&ret, "pause_total_ns", stats.pause_total_ns);
+  R_stats_set(&ret, "pause_max_ns", stats.pause_max_ns);
+
+  vm_save(vm, &ret);
+}
+
+void R_builtin_ints(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box pop = vm_pop(vm);
+  R_array_convert(&vm->frame->ret, &pop, R_TYPE_INTS);
+}
+
+void R_builtin_floats(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box pop = vm_pop(vm);
+  R_array_convert(&vm->frame->ret, &pop, R_TYPE_FLOATS);
+}
+
+void R_builtin_to_table(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box pop = vm_pop(vm);
+  R_array_to_table(&vm->frame->ret, &pop);
+}
+
+void R_builtin_sum(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box pop = vm_pop(vm);
+  R_array_sum(&vm->frame->ret, &pop);
+}
+
+void R_builtin_min(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box pop = vm_pop(vm);
+  R_array_min(&vm->frame->ret, &pop);
+}
+
+void R_builtin_max(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box pop = vm_pop(vm);
+  R_array_max(&vm->frame->ret, &pop);
+}
+
+void R_builtin_dot(R_vm *vm) {
+  vm_fit(vm, 2);
+  R_box rhs = vm_pop(vm);
+  R_box lhs = vm_pop(vm);
+  R_array_dot(&vm->frame->ret, &lhs, &rhs);
+}
+
+void R_builtin_len(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box pop = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  switch(pop.type) {
+    case R_TYPE_STR:
+    case R_TYPE_INTS:
+    case R_TYPE_FLOATS:
+      R_set_int(ret, pop.size);
+      break;
+    case R_TYPE_BUF:
+      R_set_int(ret, R_buf_len(&pop));
+      break;
+    case R_TYPE_TABLE:
+      R_set_int(ret, pop.table->cur);
+      break;
+    case R_TYPE_FROZEN:
+      R_set_int(ret, ((R_frozen *)pop.ptr)->count);
+      break;
+    default:
+      R_set_null(ret);
+  }
+}
+
+void R_builtin_mmap(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box path = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(R_TYPE_ISNT(&path, STR) || !R_set_buf_file(ret, path.str)) {
+    R_set_null(ret);
+  }
+}
+
+// slice(buf, start, end): end defaults to the end of the buffer
+void R_builtin_slice(R_vm *vm) {
+  vm_fit(vm, 3);
+  R_box end = vm_pop(vm);
+  R_box start = vm_pop(vm);
+  R_box buf = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(R_TYPE_ISNT(&buf, BUF) || R_TYPE_ISNT(&start, INT)) {
+    R_set_null(ret);
+    return;
+  }
+
+  R_buf_slice(ret, &buf, start.i64, R_TYPE_IS(&end, INT) ? end.i64 : INT64_MAX);
+}
+
+// find(buf, needle, from)
+void R_builtin_find(R_vm *vm) {
+  vm_fit(vm, 3);
+  R_box from = vm_pop(vm);
+  R_box needle = vm_pop(vm);
+  R_box buf = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(R_TYPE_ISNT(&buf, BUF)) {
+    R_set_null(ret);
+    return;
+  }
+
+  R_buf_find(ret, &buf, &needle, R_TYPE_IS(&from, INT) ? from.i64 : 0);
+}
+
+// read_int(buf, offset, fmt)
+void R_builtin_read_int(R_vm *vm) {
+  vm_fit(vm, 3);
+  R_box fmt = vm_pop(vm);
+  R_box off = vm_pop(vm);
+  R_box buf = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(R_TYPE_ISNT(&buf, BUF) || R_TYPE_ISNT(&off, INT) || R_TYPE_ISNT(&fmt, STR)) {
+    R_set_null(ret);
+    return;
+  }
+
+  R_buf_read_int(ret, &buf, off.i64, fmt.str);
+}
+
+void R_builtin_parse_int(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box buf = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(R_TYPE_ISNT(&buf, BUF)) {
+    R_set_null(ret);
+    return;
+  }
+
+  R_buf_parse_int(ret, &buf);
+}
+
+void R_builtin_to_str(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box buf = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(R_TYPE_ISNT(&buf, BUF)) {
+    R_set_null(ret);
+    return;
+  }
+
+  R_buf_to_str(ret, &buf);
+}
+
+void R_builtin_drop(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box buf = vm_pop(vm);
+
+  if(R_TYPE_IS(&buf, BUF)) {
+    R_buf_drop(&buf);
+  }
+}
+
+void R_builtin_clone(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box pop = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(R_TYPE_ISNT(&pop, TABLE)) {
+    R_set_null(ret);
+    return;
+  }
+
+  R_table_clone(&pop, ret);
+}
+
+// merge(dst, src) copies every key of src into dst and returns dst
+void R_builtin_merge(R_vm *vm) {
+  vm_fit(vm, 2);
+  R_box src = vm_pop(vm);
+  R_box dst = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(R_TYPE_ISNT(&dst, TABLE) || R_TYPE_ISNT(&src, TABLE)) {
+    R_set_null(ret);
+    return;
+  }
+
+  R_table_merge(&dst, &src);
+  *ret = dst;
+}
+
+// freeze(table, name): name is optional and publishes the result to every VM
+void R_builtin_freeze(R_vm *vm) {
+  vm_fit(vm, 2);
+  R_box name = vm_pop(vm);
+  R_box table = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(!R_freeze(ret, &table)) {
+    R_set_null(ret);
+    return;
+  }
+
+  if(R_TYPE_IS(&name, STR)) {
+    R_frozen_publish(name.str, ret);
+  }
+}
+
+void R_builtin_frozen(R_vm *vm) {
+  vm_fit(vm, 1);
+  R_box name = vm_pop(vm);
+  R_box *ret = &vm->frame->ret;
+
+  if(R_TYPE_ISNT(&name, STR) || !R_frozen_lookup(name.str, ret)) {
+    R_set_null(ret);
+  }
+}
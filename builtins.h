@@ -5,8 +5,32 @@
 
 void R_builtin_load(R_vm *vm);
 void R_builtin_print(R_vm *vm);
+void R_builtin_json_decode(R_vm *vm);
+void R_builtin_json_encode(R_vm *vm);
+void R_builtin_marshal(R_vm *vm);
+void R_builtin_unmarshal(R_vm *vm);
 void R_builtin_scope(R_vm *vm);
 void R_builtin_meta(R_vm *vm);
 void R_builtin_import(R_vm *vm);
+void R_builtin_heap_stats(R_vm *vm);
+void R_builtin_ints(R_vm *vm);
+void R_builtin_floats(R_vm *vm);
+void R_builtin_to_table(R_vm *vm);
+void R_builtin_sum(R_vm *vm);
+void R_builtin_min(R_vm *vm);
+void R_builtin_max(R_vm *vm);
+void R_builtin_dot(R_vm *vm);
+void R_builtin_len(R_vm *vm);
+void R_builtin_mmap(R_vm *vm);
+void R_builtin_slice(R_vm *vm);
+void R_builtin_find(R_vm *vm);
+void R_builtin_read_int(R_vm *vm);
+void R_builtin_parse_int(R_vm *vm);
+void R_builtin_to_str(R_vm *vm);
+void R_builtin_drop(R_vm *vm);
+void R_builtin_clone(R_vm *vm);
+void R_builtin_merge(R_vm *vm);
+void R_builtin_freeze(R_vm *vm);
+void R_builtin_frozen(R_vm *vm);
 
 #endif
@@ -3,40 +3,56 @@
 #include <stdio.h>
 #include <string.h>
 
-void R_box_print(R_box *val) {
+void R_box_fprint(FILE *out, R_box *val) {
   switch(val->type) {
     case R_TYPE_NULL:
-      printf("null\n");
+      fprintf(out, "null\n");
       break;
     case R_TYPE_INT:
-      printf("%ld\n", val->i64);
+      fprintf(out, "%ld\n", val->i64);
       break;
     case R_TYPE_FLOAT:
-      printf("%f\n", val->f64);
+      fprintf(out, "%f\n", val->f64);
       break;
     case R_TYPE_BOOL:
-      printf(val->i64 != 0 ? "true\n" : "false\n");
+      fprintf(out, "%s\n", val->i64 != 0 ? "true" : "false");
       break;
     case R_TYPE_STR:
-      printf("%s\n", val->str);
+      fprintf(out, "%s\n", val->str);
       break;
     case R_TYPE_TABLE:
-      printf("table 0x%08lx\n", (unsigned long)val->ptr);
+      fprintf(out, "table 0x%08lx\n", (unsigned long)val->ptr);
       break;
     case R_TYPE_FUNC:
-      printf("func 0x%04lx\n", val->u64);
+      fprintf(out, "func 0x%04lx\n", val->u64);
       break;
     case R_TYPE_CFUNC:
-      printf("cfunc 0x%08lx\n", (unsigned long)val->ptr);
+      fprintf(out, "cfunc 0x%08lx\n", (unsigned long)val->ptr);
       break;
     case R_TYPE_CDATA:
-      printf("cdata 0x%08lx\n", (unsigned long)val->ptr);
+      fprintf(out, "cdata 0x%08lx\n", (unsigned long)val->ptr);
+      break;
+    case R_TYPE_INTS:
+      fprintf(out, "ints[%d] 0x%08lx\n", val->size, (unsigned long)val->ptr);
+      break;
+    case R_TYPE_FLOATS:
+      fprintf(out, "floats[%d] 0x%08lx\n", val->size, (unsigned long)val->ptr);
+      break;
+    case R_TYPE_FROZEN:
+      fprintf(out, "frozen 0x%08lx\n", (unsigned long)val->ptr);
+      break;
+    case R_TYPE_BUF:
+      fprintf(out, "buffer[%lu] 0x%08lx\n", (unsigned long)R_buf_len(val), (unsigned long)val->ptr);
       break;
     default:
-      printf("unknown\n");
+      fprintf(out, "unknown\n");
   }
 }
 
+void R_box_print(R_box *val) {
+  R_box_fprint(stdout, val);
+}
+
 bool R_has_meta(R_box *val) {
   return (val->meta != NULL) && (R_TYPE_ISNT(val->meta, NULL));
 }
@@ -87,7 +103,7 @@ void R_set_strcpy(R_box *ret, const char *s) {
   int size = strlen(s);
 
   ret->type = R_TYPE_STR;
-  ret->str = GC_malloc(size + 1);
+  ret->str = R_alloc(R_KIND_RAW, size + 1);
   ret->size = size;
 
   memcpy(ret->str, s, size);
@@ -96,10 +112,13 @@ void R_set_strcpy(R_box *ret, const char *s) {
 }
 
 void R_set_table_sized(R_box *ret, uint32_t size) {
-  R_table *table = GC_malloc(sizeof(R_table));
+  R_table *table = R_alloc(R_KIND_TABLE, sizeof(R_table));
   table->cur = 0;
   table->max = size;
-  table->items = GC_malloc(sizeof(R_item *) * size);
+  table->flags = 0;
+  table->items = R_alloc(R_KIND_ITEMS, sizeof(R_item *) * size);
+  table->shape = NULL;
+  table->slots = NULL;
 
   ret->type = R_TYPE_TABLE;
   ret->table = table;
@@ -107,8 +126,20 @@ void R_set_table_sized(R_box *ret, uint32_t size) {
   ret->meta = NULL;
 }
 
+// empty tables start out as records and become dictionaries when needed
 void R_set_table(R_box *ret) {
-  R_set_table_sized(ret, R_INIT_TABLE_SIZE);
+  R_table *table = R_alloc(R_KIND_TABLE, sizeof(R_table));
+  table->cur = 0;
+  table->max = 0;
+  table->flags = 0;
+  table->items = NULL;
+  table->shape = &R_shape_root;
+  table->slots = NULL;
+
+  ret->type = R_TYPE_TABLE;
+  ret->table = table;
+  ret->size = 0;
+  ret->meta = NULL;
 }
 
 void R_set_cfunc(R_box *ret, void *p) {
@@ -125,28 +156,51 @@ void R_set_cdata(R_box *ret, void *p) {
   ret->meta = NULL;
 }
 
+// array elements are uninitialized
+void R_set_ints(R_box *ret, uint32_t size) {
+  ret->type = R_TYPE_INTS;
+  ret->i64s = R_alloc(R_KIND_RAW, sizeof(int64_t) * (size > 0 ? size : 1));
+  ret->size = size;
+  ret->meta = NULL;
+}
+
+void R_set_floats(R_box *ret, uint32_t size) {
+  ret->type = R_TYPE_FLOATS;
+  ret->f64s = R_alloc(R_KIND_RAW, sizeof(double) * (size > 0 ? size : 1));
+  ret->size = size;
+  ret->meta = NULL;
+}
+
 void R_set_meta(R_box *val, R_box *meta) {
   val->meta = meta;
 }
 
-void R_op_print(R_op *instr) {
+void R_op_fprint(FILE *out, R_op *instr) {
   switch(R_OP(instr)) {
     case PUSH_CONST:
     case BIN_OP:
     case UN_OP:
     case CMP:
     case CALL:
+    case CALL_METHOD:
     case FIT:
-      printf("%s (%d)\n", R_INSTR_NAMES[R_OP(instr)], R_UI(instr));
+    case PUSH_TABLE:
+    case REGS:
+      fprintf(out, "%s (%d)\n", R_INSTR_NAMES[R_OP(instr)], R_UI(instr));
       break;
     case JUMP:
     case JUMPIF:
-      printf("%s (%d)\n", R_INSTR_NAMES[R_OP(instr)], R_SI(instr));
+    case NEXT:
+      fprintf(out, "%s (%d)\n", R_INSTR_NAMES[R_OP(instr)], R_SI(instr));
       break;
     case CALLTO:
-      printf("%s (%02x)\n", R_INSTR_NAMES[R_OP(instr)], R_UI(instr));
+      fprintf(out, "%s (%02x)\n", R_INSTR_NAMES[R_OP(instr)], R_UI(instr));
       break;
     default:
-      printf("%s\n", R_INSTR_NAMES[R_OP(instr)]);
+      fprintf(out, "%s\n", R_INSTR_NAMES[R_OP(instr)]);
   }
 }
+
+void R_op_print(R_op *instr) {
+  R_op_fprint(stdout, instr);
+}
@@ -16,6 +16,10 @@
 #define R_TYPE_FUNC  6
 #define R_TYPE_CFUNC 7
 #define R_TYPE_CDATA 8
+#define R_TYPE_INTS  9  // packed int64 array, size elements at i64s
+#define R_TYPE_FLOATS 10 // packed float64 array, size elements at f64s
+#define R_TYPE_BUF   11 // byte buffer, ptr is an R_buf
+#define R_TYPE_FROZEN 12 // immutable table, ptr is an R_frozen
 
 #define R_TYPE_IS(x, t) ((x)->type == R_TYPE_##t)
 #define R_TYPE_ISNT(x, t) ((x)->type != R_TYPE_##t)
@@ -27,6 +31,7 @@
 #define R_INIT_TABLE_SIZE 32
 
 struct R_table;
+struct R_shape;
 
 typedef struct R_box {
   char type;
@@ -38,6 +43,8 @@ typedef struct R_box {
     char *str;
     struct R_table *table;
     void *ptr;
+    int64_t *i64s;
+    double *f64s;
   };
   struct R_box *meta;
 } R_box;
@@ -53,14 +60,21 @@ typedef struct R_item {
   R_box val;
 } R_item;
 
+// a table is either a dictionary (items) or a record (shape and slots); see
+// table.c
 typedef struct R_table {
   uint32_t cur;
   uint32_t max;
+  uint32_t flags;
   R_item **items;
+  struct R_shape *shape;
+  R_box *slots;
 } R_table;
 
 void R_box_print(R_box *val);
+void R_box_fprint(FILE *out, R_box *val);
 void R_op_print(R_op *instr);
+void R_op_fprint(FILE *out, R_op *instr);
 
 bool R_has_meta(R_box *val);
 void R_set_box(R_box *ret, R_box *from);
@@ -74,6 +88,8 @@ void R_set_table(R_box *ret);
 void R_set_table_sized(R_box *ret, uint32_t size);
 void R_set_cfunc(R_box *ret, void *p);
 void R_set_cdata(R_box *ret, void *p);
+void R_set_ints(R_box *ret, uint32_t size);
+void R_set_floats(R_box *ret, uint32_t size);
 void R_set_meta(R_box *val, R_box *meta);
 
 #endif
@@ -1,9 +1,13 @@
 #include "rain.h"
 #include <stdio.h>
+#include <string.h>
 
 int main(int argv, char **argc) {
+  bool regs = argv > 2 && strcmp(argc[1], "--regs") == 0;
+  const char *fname = argc[regs ? 2 : 1];
+
   if(argv < 2) {
-    fprintf(stderr, "Usage: %s FILE\n", argc[0]);
+    fprintf(stderr, "Usage: %s [--regs] FILE\n", argc[0]);
     return 1;
   }
 
@@ -13,8 +17,11 @@ int main(int argv, char **argc) {
     return 1;
   }
 
-  if(!vm_import(this, argc[1])) {
-    fprintf(stderr, "Unable to import file %s\n", argc[1]);
+  // show the register code the loader would run instead of the file as is
+  this->use_regs = regs;
+
+  if(!vm_import(this, fname)) {
+    fprintf(stderr, "Unable to import file %s\n", fname);
     return 1;
   }
 
@@ -33,6 +40,19 @@ int main(int argv, char **argc) {
   for(uint32_t i=0; i<this->num_instrs; i++) {
     printf("  %02x ", i);
     R_op_print(this->instrs + i);
+
+    if(R_OP(this->instrs + i) == REGS) {
+      R_reg_op *op = this->reg_ops + R_UI(this->instrs + i);
+      do {
+        printf("       ");
+        R_reg_op_fprint(stdout, op);
+      } while((op++)->op != R_ROP_EXIT);
+    }
+
+    if(R_OP(this->instrs + i) == CALL_METHOD) {
+      R_method_site *site = this->methods + R_UI(this->instrs + i);
+      printf("       %s, %u args\n", this->consts[site->name].str, site->argc);
+    }
   }
 
   return 0;
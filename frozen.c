@@ -0,0 +1,336 @@
+#include "rain.h"
+
+#include <pthread.h>
+#include <string.h>
+
+// freezing makes two passes over the table graph. the first finds every
+// distinct table and sizes the arena; the second lays the tables out in it.
+// shared and cyclic references are preserved because each table is frozen
+// once and referenced by position.
+
+typedef struct R_freeze_state {
+  // open addressed map from source table to its position
+  R_table **keys;
+  uint32_t *vals;
+  uint32_t map_max;
+
+  R_box *tables;
+  uint32_t num_tables;
+  uint32_t max_tables;
+
+  size_t num_items;
+  size_t num_buckets;
+  size_t str_bytes;
+  bool ok;
+
+  // filled in by the second pass
+  R_frozen *headers;
+  R_item *items;
+  uint32_t *buckets;
+  char *strs;
+} R_freeze_state;
+
+static uint64_t R_frozen_mix(uint64_t hash) {
+  return hash * 0x9E3779B97F4A7C15ull;
+}
+
+static uint32_t R_frozen_buckets(uint32_t count) {
+  uint32_t num = 2;
+  while(num < count) {
+    num *= 2;
+  }
+  return num;
+}
+
+static int64_t R_freeze_find(R_freeze_state *state, R_table *table) {
+  uint64_t idx = R_frozen_mix((uintptr_t)table) >> 32;
+
+  for(;; idx++) {
+    idx &= state->map_max - 1;
+    if(state->keys[idx] == NULL) {
+      return -1;
+    }
+    if(state->keys[idx] == table) {
+      return state->vals[idx];
+    }
+  }
+}
+
+static void R_freeze_insert(R_freeze_state *state, R_table *table, uint32_t pos) {
+  if((state->num_tables + 1) * 2 > state->map_max) {
+    R_table **keys = state->keys;
+    uint32_t *vals = state->vals;
+    uint32_t max = state->map_max;
+
+    state->map_max = max == 0 ? 64 : max * 2;
+    state->keys = calloc(state->map_max, sizeof(R_table *));
+    state->vals = calloc(state->map_max, sizeof(uint32_t));
+
+    for(uint32_t i=0; i<max; i++) {
+      if(keys[i] != NULL) {
+        uint64_t idx = R_frozen_mix((uintptr_t)keys[i]) >> 32;
+        while(state->keys[idx & (state->map_max - 1)] != NULL) {
+          idx++;
+        }
+        state->keys[idx & (state->map_max - 1)] = keys[i];
+        state->vals[idx & (state->map_max - 1)] = vals[i];
+      }
+    }
+
+    free(keys);
+    free(vals);
+  }
+
+  uint64_t idx = R_frozen_mix((uintptr_t)table) >> 32;
+  while(state->keys[idx & (state->map_max - 1)] != NULL) {
+    idx++;
+  }
+  state->keys[idx & (state->map_max - 1)] = table;
+  state->vals[idx & (state->map_max - 1)] = pos;
+}
+
+static void R_freeze_measure(R_freeze_state *state, R_box *val);
+
+static void R_freeze_measure_table(R_freeze_state *state, R_box *table) {
+  uint32_t pos = 0;
+  R_box key;
+  R_box val;
+
+  if(state->map_max > 0 && R_freeze_find(state, table->table) >= 0) {
+    return;
+  }
+
+  if(state->num_tables == state->max_tables) {
+    state->max_tables = state->max_tables == 0 ? 16 : state->max_tables * 2;
+    state->tables = realloc(state->tables, sizeof(R_box) * state->max_tables);
+  }
+
+  R_freeze_insert(state, table->table, state->num_tables);
+  state->tables[state->num_tables++] = *table;
+
+  while(R_table_next(table, &pos, &key, &val)) {
+    state->num_items += 1;
+    R_freeze_measure(state, &key);
+    R_freeze_measure(state, &val);
+  }
+
+  state->num_buckets += R_frozen_buckets(table->table->cur) + 1;
+}
+
+static void R_freeze_measure(R_freeze_state *state, R_box *val) {
+  // a meta can change how a value behaves, so it can't be left behind
+  if(R_has_meta(val)) {
+    state->ok = false;
+    return;
+  }
+
+  switch(val->type) {
+    case R_TYPE_NULL:
+    case R_TYPE_INT:
+    case R_TYPE_FLOAT:
+    case R_TYPE_BOOL:
+    case R_TYPE_CFUNC:
+    case R_TYPE_FROZEN:
+      break;
+    case R_TYPE_STR:
+      state->str_bytes += val->size + 1;
+      break;
+    case R_TYPE_TABLE:
+      R_freeze_measure_table(state, val);
+      break;
+    default:
+      // functions belong to one VM's code and everything else is mutable
+      state->ok = false;
+  }
+}
+
+static void R_freeze_copy(R_freeze_state *state, R_box *to, R_box *from) {
+  // values with metas were turned away, but a null one still points at the
+  // GC heap
+  *to = *from;
+  to->meta = NULL;
+
+  if(R_TYPE_IS(from, STR)) {
+    memcpy(state->strs, from->str, from->size + 1);
+    to->str = state->strs;
+    state->strs += from->size + 1;
+  }
+  else if(R_TYPE_IS(from, TABLE)) {
+    to->type = R_TYPE_FROZEN;
+    to->ptr = &state->headers[R_freeze_find(state, from->table)];
+    to->size = 0;
+  }
+}
+
+static int R_frozen_cmp(const void *lhs, const void *rhs) {
+  uint64_t a = ((const R_item *)lhs)->hash;
+  uint64_t b = ((const R_item *)rhs)->hash;
+  return a < b ? -1 : a > b;
+}
+
+static void R_freeze_fill(R_freeze_state *state, R_box *table, R_frozen *self) {
+  uint32_t pos = 0;
+  uint32_t count = 0;
+  uint32_t num_buckets = R_frozen_buckets(table->table->cur);
+  R_box key;
+  R_box val;
+
+  self->items = state->items;
+  self->buckets = state->buckets;
+
+  while(R_table_next(table, &pos, &key, &val)) {
+    R_item *item = &self->items[count++];
+    R_freeze_copy(state, &item->key, &key);
+    R_freeze_copy(state, &item->val, &val);
+    item->hash = R_frozen_mix(R_hash(&item->key));
+  }
+
+  qsort(self->items, count, sizeof(R_item), R_frozen_cmp);
+
+  self->count = count;
+  self->shift = 64 - __builtin_ctz(num_buckets);
+
+  // buckets[b] is the first item whose hash lands in bucket b or later
+  uint32_t item = 0;
+  for(uint32_t b=0; b<=num_buckets; b++) {
+    while(item < count && (self->items[item].hash >> self->shift) < b) {
+      item += 1;
+    }
+    self->buckets[b] = item;
+  }
+
+  state->items += count;
+  state->buckets += num_buckets + 1;
+}
+
+bool R_freeze(R_box *ret, R_box *table) {
+  R_freeze_state state = {.ok = true};
+
+  if(R_TYPE_IS(table, FROZEN)) {
+    *ret = *table;
+    return true;
+  }
+
+  if(R_TYPE_ISNT(table, TABLE)) {
+    fprintf(stderr, "Only tables can be frozen\n");
+    return false;
+  }
+
+  R_freeze_measure(&state, table);
+
+  if(!state.ok) {
+    fprintf(stderr, "Unable to freeze table: it holds functions, metas or mutable data\n");
+    free(state.keys);
+    free(state.vals);
+    free(state.tables);
+    return false;
+  }
+
+  size_t size = sizeof(R_frozen) * state.num_tables +
+                sizeof(R_item) * state.num_items +
+                sizeof(uint32_t) * state.num_buckets +
+                state.str_bytes;
+  char *arena = malloc(size);
+
+  if(arena == NULL) {
+    fprintf(stderr, "Unable to allocate frozen table\n");
+    free(state.keys);
+    free(state.vals);
+    free(state.tables);
+    return false;
+  }
+
+  state.headers = (R_frozen *)arena;
+  state.items = (R_item *)(state.headers + state.num_tables);
+  state.buckets = (uint32_t *)(state.items + state.num_items);
+  state.strs = (char *)(state.buckets + state.num_buckets);
+
+  for(uint32_t i=0; i<state.num_tables; i++) {
+    R_freeze_fill(&state, &state.tables[i], &state.headers[i]);
+  }
+
+  ret->type = R_TYPE_FROZEN;
+  ret->ptr = &state.headers[0];
+  ret->size = 0;
+  ret->meta = NULL;
+
+  free(state.keys);
+  free(state.vals);
+  free(state.tables);
+  return true;
+}
+
+R_box *R_frozen_get(R_box *frozen, R_box *key) {
+  R_frozen *self = frozen->ptr;
+  uint64_t hash = R_frozen_mix(R_hash(key));
+  uint64_t bucket = hash >> self->shift;
+
+  for(uint32_t i=self->buckets[bucket]; i<self->buckets[bucket + 1]; i++) {
+    if(self->items[i].hash == hash && R_hash_eq(key, &self->items[i].key)) {
+      return &self->items[i].val;
+    }
+  }
+
+  return NULL;
+}
+
+bool R_frozen_next(R_box *frozen, uint32_t *pos, R_box *key, R_box *val) {
+  R_frozen *self = frozen->ptr;
+
+  if(*pos >= self->count) {
+    return false;
+  }
+
+  *key = self->items[*pos].key;
+  *val = self->items[*pos].val;
+  *pos += 1;
+  return true;
+}
+
+// process wide registry, so other VMs can pick frozen tables up by name. the
+// lock only covers the registry; the tables themselves are read lock-free.
+
+typedef struct R_shared {
+  char *name;
+  R_box val;
+} R_shared;
+
+static pthread_mutex_t R_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static R_shared *R_shared_tables;
+static uint32_t R_num_shared;
+
+void R_frozen_publish(const char *name, R_box *frozen) {
+  pthread_mutex_lock(&R_shared_lock);
+
+  uint32_t i = 0;
+  for(; i<R_num_shared; i++) {
+    if(strcmp(R_shared_tables[i].name, name) == 0) {
+      break;
+    }
+  }
+
+  if(i == R_num_shared) {
+    R_num_shared += 1;
+    R_shared_tables = realloc(R_shared_tables, sizeof(R_shared) * R_num_shared);
+    R_shared_tables[i].name = strdup(name);
+  }
+
+  R_shared_tables[i].val = *frozen;
+  pthread_mutex_unlock(&R_shared_lock);
+}
+
+bool R_frozen_lookup(const char *name, R_box *ret) {
+  bool found = false;
+
+  pthread_mutex_lock(&R_shared_lock);
+  for(uint32_t i=0; i<R_num_shared; i++) {
+    if(strcmp(R_shared_tables[i].name, name) == 0) {
+      *ret = R_shared_tables[i].val;
+      found = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&R_shared_lock);
+
+  return found;
+}
@@ -0,0 +1,26 @@
+#ifndef R_FROZEN_H
+#define R_FROZEN_H
+
+#include "core.h"
+#include <stdbool.h>
+
+// an immutable table. the items are sorted by hash and found through a
+// bucket index over the top bits of the hash. every table reachable from a
+// frozen table is frozen into the same arena, which lives outside the GC heap
+// and is never freed, so it can be read from any VM on any thread. tables
+// or values with metas can't be frozen.
+typedef struct R_frozen {
+  uint32_t count;
+  uint32_t shift;
+  uint32_t *buckets;
+  R_item *items;
+} R_frozen;
+
+bool R_freeze(R_box *ret, R_box *table);
+R_box *R_frozen_get(R_box *frozen, R_box *key);
+bool R_frozen_next(R_box *frozen, uint32_t *pos, R_box *key, R_box *val);
+
+void R_frozen_publish(const char *name, R_box *frozen);
+bool R_frozen_lookup(const char *name, R_box *ret);
+
+#endif
@@ -0,0 +1,721 @@
+#include "rain.h"
+
+#include <string.h>
+#include <time.h>
+
+__thread R_vm *R_heap_vm = NULL;
+volatile bool R_heap_collecting = false;
+
+const char *R_KIND_NAMES[R_NUM_KINDS] = {
+  "raw",
+  "meta",
+  "box_array",
+  "table",
+  "item_array",
+  "item",
+  "frame_array",
+  "string_array",
+  "vm",
+  "module_array",
+  "buffer",
+  "mapping",
+  "method_array",
+};
+
+static R_heap_stats R_gc_stats;
+static uint64_t R_gc_start;
+
+static inline void R_heap_count(int kind, size_t size) {
+  if(R_heap_vm != NULL) {
+    R_heap_vm->stats.count[kind] += 1;
+    R_heap_vm->stats.bytes[kind] += size;
+
+    if(R_heap_vm->alloc_prof != NULL) {
+      vm_alloc_prof_charge(R_heap_vm, size);
+    }
+  }
+}
+
+static uint64_t R_heap_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void R_heap_pause_begin() {
+  R_heap_collecting = true;
+  R_gc_start = R_heap_now();
+  R_TRACE(R_heap_vm, R_EV_GC_BEGIN, 0, 0);
+  R_PROBE1(gc__start, R_gc_stats.collections);
+}
+
+static void R_heap_pause_end() {
+  uint64_t pause = R_heap_now() - R_gc_start;
+  uint64_t us = pause / 1000;
+  int bucket = 0;
+
+  R_heap_collecting = false;
+  R_TRACE(R_heap_vm, R_EV_GC_END, 0, pause);
+  R_PROBE2(gc__done, R_gc_stats.collections, pause);
+
+  while(bucket < R_PAUSE_BUCKETS - 1 && us >= (1ull << bucket)) {
+    bucket += 1;
+  }
+
+  R_gc_stats.collections += 1;
+  R_gc_stats.pause_total_ns += pause;
+  R_gc_stats.pauses[bucket] += 1;
+  if(pause > R_gc_stats.pause_max_ns) {
+    R_gc_stats.pause_max_ns = pause;
+  }
+}
+
+#define R_OBJ_OLD        0x01
+#define R_OBJ_MARK       0x02
+#define R_OBJ_REMEMBERED 0x04
+
+#define R_HDR(p) ((R_obj *)(p) - 1)
+#define R_PAYLOAD(o) ((void *)((R_obj *)(o) + 1))
+#define R_ALIGN(n) (((n) + 15) & ~(size_t)15)
+
+// mapped snapshot images, see snapshot.c
+#define R_IMAGES_MAX 16
+
+static char *R_image_base[R_IMAGES_MAX];
+static size_t R_image_size[R_IMAGES_MAX];
+static uint32_t R_num_images;
+
+static bool R_heap_image_add(void *base, size_t size) {
+  if(R_num_images == R_IMAGES_MAX) {
+    fprintf(stderr, "Too many snapshot images\n");
+    return false;
+  }
+
+  R_image_base[R_num_images] = base;
+  R_image_size[R_num_images] = size;
+  R_num_images += 1;
+  return true;
+}
+
+bool R_heap_in_image(void *ptr) {
+  for(uint32_t i=0; i<R_num_images; i++) {
+    if((char *)ptr >= R_image_base[i] && (char *)ptr < R_image_base[i] + R_image_size[i]) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// image objects look like old objects that are never on the old list
+void R_heap_image_obj(R_obj *obj, int kind, size_t size) {
+  obj->kind = kind;
+  obj->flags = R_OBJ_OLD;
+  obj->size = size;
+  obj->next = NULL;
+  obj->fwd = NULL;
+}
+
+#ifndef R_GC_PRECISE
+
+#define GC_THREADS
+#include <gc.h>
+
+static void R_heap_event(GC_EventType event) {
+  switch(event) {
+    case GC_EVENT_START:
+      R_heap_pause_begin();
+      break;
+    case GC_EVENT_END:
+      R_heap_pause_end();
+      break;
+    default:
+      break;
+  }
+}
+
+void R_heap_init() {
+  GC_init();
+  GC_set_on_collection_event(R_heap_event);
+  GC_allow_register_threads();
+}
+
+// threads that run VMs have to be registered so their stacks get scanned
+void R_heap_thread_begin() {
+  struct GC_stack_base base;
+
+  GC_get_stack_base(&base);
+  GC_register_my_thread(&base);
+}
+
+void R_heap_thread_end() {
+  GC_unregister_my_thread();
+}
+
+static void R_heap_finalize(void *obj, void *data) {
+  R_map_release(obj);
+}
+
+void *R_alloc(int kind, size_t size) {
+  R_heap_count(kind, size);
+
+  if(kind == R_KIND_MAP) {
+    void *ptr = GC_malloc_atomic(size);
+    GC_register_finalizer(ptr, R_heap_finalize, NULL, NULL, NULL);
+    return ptr;
+  }
+
+  if(kind == R_KIND_RAW) {
+    return GC_malloc_atomic(size);
+  }
+
+  // embedders may only hold VMs from memory Boehm doesn't scan
+  if(kind == R_KIND_VM) {
+    return GC_malloc_uncollectable(size);
+  }
+
+  return GC_malloc(size);
+}
+
+void *R_realloc(void *ptr, int kind, size_t size) {
+  // image objects aren't Boehm's to resize
+  if(ptr != NULL && R_heap_in_image(ptr)) {
+    void *ret = R_alloc(kind, size);
+    size_t prev = R_HDR(ptr)->size;
+    memcpy(ret, ptr, prev < size ? prev : size);
+    return ret;
+  }
+
+  R_heap_count(kind, size);
+  return GC_realloc(ptr, size);
+}
+
+// images may point into the heap, so they're scanned like any other root
+void R_heap_image(void *base, size_t size) {
+  if(R_heap_image_add(base, size)) {
+    GC_add_roots(base, (char *)base + size);
+  }
+}
+
+void R_heap_root(R_vm *vm) {
+  // Boehm scans everything conservatively
+}
+
+// VMs are uncollectable, so they have to be freed by hand
+void R_heap_unroot(R_vm *vm) {
+  GC_free(vm);
+}
+
+void R_heap_collect(bool major) {
+  GC_gcollect();
+}
+
+void R_heap_gc_stats(R_heap_stats *out) {
+  *out = R_gc_stats;
+  out->live_bytes = GC_get_heap_size() - GC_get_free_bytes();
+}
+
+#else
+
+// precise generational collector
+//
+// young objects are bump allocated in a fixed nursery and copied into the old
+// generation when they survive a minor collection. old objects are allocated
+// individually, kept on a list, and reclaimed by a non-moving mark & sweep.
+// old objects that are mutated to point at young ones are found through the
+// write barriers in R_table_set_aux, which remember either the whole object or
+// just the written item slot so that huge tables aren't rescanned on every
+// collection. the VM arrays (stack, frames, consts, strings) are mutated
+// everywhere, so they're rescanned on every collection instead.
+
+#define R_NURSERY_SIZE (4 * 1024 * 1024)
+#define R_NURSERY_LIMIT (R_NURSERY_SIZE / 4 * 3)
+#define R_LARGE_OBJECT (R_NURSERY_SIZE / 16)
+#define R_MAJOR_MIN (16 * 1024 * 1024)
+
+typedef struct R_ptrs {
+  void **ptrs;
+  size_t cur;
+  size_t max;
+} R_ptrs;
+
+bool R_heap_wants_gc = false;
+
+static bool R_heap_ready = false;
+static bool R_heap_wants_major = false;
+
+static char *R_nursery;
+static size_t R_nursery_used;
+
+static R_obj *R_old;
+static size_t R_old_bytes;
+static size_t R_major_limit = R_MAJOR_MIN;
+
+// open addressed set of old payload pointers, used to tell heap pointers from
+// static strings and host data during marking
+static void **R_old_set;
+static size_t R_old_set_cur;
+static size_t R_old_set_max;
+
+static R_ptrs R_roots;
+static R_ptrs R_remembered;
+static R_ptrs R_remembered_slots;
+static R_ptrs R_worklist;
+static R_ptrs R_image_marked;
+
+static void R_ptrs_push(R_ptrs *list, void *ptr) {
+  if(list->cur >= list->max) {
+    list->max = list->max == 0 ? 64 : list->max * 2;
+    list->ptrs = realloc(list->ptrs, sizeof(void *) * list->max);
+  }
+
+  list->ptrs[list->cur] = ptr;
+  list->cur += 1;
+}
+
+static inline bool R_is_young(void *ptr) {
+  return (char *)ptr >= R_nursery && (char *)ptr < R_nursery + R_NURSERY_SIZE;
+}
+
+static inline size_t R_set_slot(void *ptr, size_t max) {
+  return (((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ull) & (max - 1);
+}
+
+static void R_old_set_add(void *ptr);
+
+static void R_old_set_grow(size_t max) {
+  void **prev = R_old_set;
+  size_t prev_max = R_old_set_max;
+
+  R_old_set = calloc(max, sizeof(void *));
+  R_old_set_max = max;
+  R_old_set_cur = 0;
+
+  for(size_t i=0; i<prev_max; i++) {
+    if(prev[i] != NULL) {
+      R_old_set_add(prev[i]);
+    }
+  }
+
+  free(prev);
+}
+
+static void R_old_set_add(void *ptr) {
+  if((R_old_set_cur + 1) * 2 > R_old_set_max) {
+    R_old_set_grow(R_old_set_max * 2);
+  }
+
+  size_t idx = R_set_slot(ptr, R_old_set_max);
+  while(R_old_set[idx] != NULL) {
+    idx = (idx + 1) & (R_old_set_max - 1);
+  }
+
+  R_old_set[idx] = ptr;
+  R_old_set_cur += 1;
+}
+
+static bool R_old_set_has(void *ptr) {
+  size_t idx = R_set_slot(ptr, R_old_set_max);
+  while(R_old_set[idx] != NULL) {
+    if(R_old_set[idx] == ptr) {
+      return true;
+    }
+
+    idx = (idx + 1) & (R_old_set_max - 1);
+  }
+
+  return false;
+}
+
+static void *R_alloc_old(int kind, size_t size) {
+  R_obj *obj = calloc(1, sizeof(R_obj) + size);
+  if(obj == NULL) {
+    fprintf(stderr, "Out of memory allocating %zu bytes\n", size);
+    abort();
+  }
+
+  obj->kind = kind;
+  obj->flags = R_OBJ_OLD;
+  obj->size = size;
+  obj->next = R_old;
+  R_old = obj;
+
+  R_old_bytes += size;
+  if(R_old_bytes > R_major_limit) {
+    R_heap_wants_major = true;
+    R_heap_wants_gc = true;
+  }
+
+  R_old_set_add(R_PAYLOAD(obj));
+  return R_PAYLOAD(obj);
+}
+
+void R_heap_init() {
+  if(R_heap_ready) {
+    return;
+  }
+
+  R_nursery = calloc(1, R_NURSERY_SIZE);
+  R_nursery_used = 0;
+  R_old_set_grow(1024);
+  R_heap_ready = true;
+}
+
+// the precise heap is single threaded, so there's nothing to register
+void R_heap_thread_begin() {
+}
+
+void R_heap_thread_end() {
+}
+
+void *R_alloc(int kind, size_t size) {
+  size_t need = R_ALIGN(sizeof(R_obj) + size);
+
+  R_heap_count(kind, size);
+
+  // VMs are roots and must never move, mappings need to be released when
+  // swept, and large objects aren't worth copying
+  if(kind == R_KIND_VM || kind == R_KIND_MAP || size > R_LARGE_OBJECT ||
+     R_nursery_used + need > R_NURSERY_SIZE) {
+    void *ptr = R_alloc_old(kind, size);
+
+    // the object may be filled with young pointers before the next
+    // collection, so treat it as already written
+    if(kind != R_KIND_RAW && kind != R_KIND_VM && kind != R_KIND_MAP) {
+      R_HDR(ptr)->flags |= R_OBJ_REMEMBERED;
+      R_ptrs_push(&R_remembered, ptr);
+    }
+
+    return ptr;
+  }
+
+  R_obj *obj = (R_obj *)(R_nursery + R_nursery_used);
+  R_nursery_used += need;
+
+  obj->kind = kind;
+  obj->flags = 0;
+  obj->size = size;
+  obj->next = NULL;
+  obj->fwd = NULL;
+
+  if(R_nursery_used > R_NURSERY_LIMIT) {
+    R_heap_wants_gc = true;
+  }
+
+  return R_PAYLOAD(obj);
+}
+
+void *R_realloc(void *ptr, int kind, size_t size) {
+  void *ret = R_alloc(kind, size);
+
+  if(ptr != NULL) {
+    size_t prev = R_HDR(ptr)->size;
+    memcpy(ret, ptr, prev < size ? prev : size);
+  }
+
+  return ret;
+}
+
+void R_heap_root(R_vm *vm) {
+  R_ptrs_push(&R_roots, vm);
+}
+
+// the VM and whatever only it reached are swept by the next major collection
+void R_heap_unroot(R_vm *vm) {
+  for(size_t i=0; i<R_roots.cur; i++) {
+    if(R_roots.ptrs[i] == vm) {
+      R_roots.cur -= 1;
+      R_roots.ptrs[i] = R_roots.ptrs[R_roots.cur];
+      break;
+    }
+  }
+}
+
+// image objects are found by address instead of through the old set. writes
+// to them go through the barriers like any old object, so minor collections
+// only need to look at the ones that were written.
+void R_heap_image(void *base, size_t size) {
+  R_heap_image_add(base, size);
+}
+
+void R_heap_barrier(void *obj) {
+  if(R_is_young(obj)) {
+    return;
+  }
+
+  R_obj *hdr = R_HDR(obj);
+  if(!(hdr->flags & R_OBJ_REMEMBERED)) {
+    hdr->flags |= R_OBJ_REMEMBERED;
+    R_ptrs_push(&R_remembered, obj);
+  }
+}
+
+void R_heap_barrier_slot(void **slot) {
+  if(!R_is_young(slot)) {
+    R_ptrs_push(&R_remembered_slots, slot);
+  }
+}
+
+// copy a young object into the old generation, or return its forwarded copy
+static void *R_heap_evacuate(void *ptr) {
+  if(ptr == NULL || !R_is_young(ptr)) {
+    return ptr;
+  }
+
+  R_obj *obj = R_HDR(ptr);
+  if(obj->fwd != NULL) {
+    return obj->fwd;
+  }
+
+  void *copy = R_alloc_old(obj->kind, obj->size);
+  memcpy(copy, ptr, obj->size);
+  obj->fwd = copy;
+  R_ptrs_push(&R_worklist, copy);
+
+  return copy;
+}
+
+// mark an old or image object and queue it for scanning; other pointers are
+// static strings or host data and are left alone
+static void *R_heap_mark(void *ptr) {
+  bool image = false;
+
+  if(ptr == NULL) {
+    return ptr;
+  }
+
+  if(!R_old_set_has(ptr)) {
+    if(!R_heap_in_image(ptr)) {
+      return ptr;
+    }
+
+    image = true;
+  }
+
+  R_obj *obj = R_HDR(ptr);
+  if(!(obj->flags & R_OBJ_MARK)) {
+    obj->flags |= R_OBJ_MARK;
+    R_ptrs_push(&R_worklist, ptr);
+
+    // image objects aren't swept, so their marks are cleared separately
+    if(image) {
+      R_ptrs_push(&R_image_marked, ptr);
+    }
+  }
+
+  return ptr;
+}
+
+typedef void *(*R_visit)(void *);
+
+static void R_scan_box(R_box *box, R_visit visit) {
+  switch(box->type) {
+    case R_TYPE_STR:
+      box->str = visit(box->str);
+      break;
+    case R_TYPE_TABLE:
+      box->table = visit(box->table);
+      break;
+    case R_TYPE_INTS:
+    case R_TYPE_FLOATS:
+    case R_TYPE_BUF:
+      box->ptr = visit(box->ptr);
+      break;
+  }
+
+  box->meta = visit(box->meta);
+}
+
+static void R_scan(void *ptr, int kind, size_t size, R_visit visit);
+
+static void R_scan_vm(R_vm *vm, R_visit visit) {
+  // dead slots may hold stale pointers from before the last collection
+  for(uint32_t i=vm->stack_ptr; i<vm->stack_size; i++) {
+    R_set_null(&vm->stack[i]);
+  }
+
+  memset(vm->frames + vm->frame_ptr, 0,
+         sizeof(R_frame) * (vm->frame_size - vm->frame_ptr));
+
+  ptrdiff_t frame = vm->frame - vm->frames;
+
+  vm->consts = visit(vm->consts);
+  vm->instrs = visit(vm->instrs);
+  vm->strings = visit(vm->strings);
+  vm->stack = visit(vm->stack);
+  vm->frames = visit(vm->frames);
+  vm->frame = vm->frames + frame;
+  vm->natives = visit(vm->natives);
+  vm->reg_ops = visit(vm->reg_ops);
+  vm->reg_replaced = visit(vm->reg_replaced);
+  vm->builtins = visit(vm->builtins);
+  vm->modules = visit(vm->modules);
+  vm->methods = visit(vm->methods);
+
+  // these are written without barriers, so always scan their contents
+  R_scan(vm->consts, R_KIND_BOXES, sizeof(R_box) * vm->num_consts, visit);
+  R_scan(vm->strings, R_KIND_STRS, sizeof(char *) * vm->num_strings, visit);
+  R_scan(vm->stack, R_KIND_BOXES, sizeof(R_box) * vm->stack_ptr, visit);
+  R_scan(vm->frames, R_KIND_FRAMES, sizeof(R_frame) * vm->frame_ptr, visit);
+  R_scan(vm->modules, R_KIND_MODULES, sizeof(R_module) * vm->num_modules, visit);
+  R_scan(vm->methods, R_KIND_METHODS, sizeof(R_method_site) * vm->num_methods, visit);
+}
+
+static void R_scan(void *ptr, int kind, size_t size, R_visit visit) {
+  switch(kind) {
+    case R_KIND_BOX:
+      R_scan_box(ptr, visit);
+      break;
+
+    case R_KIND_BOXES:
+      for(size_t i=0; i<size / sizeof(R_box); i++) {
+        R_scan_box((R_box *)ptr + i, visit);
+      }
+      break;
+
+    case R_KIND_TABLE: {
+      R_table *table = ptr;
+      table->items = visit(table->items);
+      table->slots = visit(table->slots);
+      break;
+    }
+
+    case R_KIND_ITEMS:
+    case R_KIND_STRS:
+      for(size_t i=0; i<size / sizeof(void *); i++) {
+        ((void **)ptr)[i] = visit(((void **)ptr)[i]);
+      }
+      break;
+
+    case R_KIND_ITEM:
+      R_scan_box(&((R_item *)ptr)->key, visit);
+      R_scan_box(&((R_item *)ptr)->val, visit);
+      break;
+
+    case R_KIND_FRAMES:
+      for(size_t i=0; i<size / sizeof(R_frame); i++) {
+        R_scan_box(&((R_frame *)ptr)[i].scope, visit);
+        R_scan_box(&((R_frame *)ptr)[i].ret, visit);
+      }
+      break;
+
+    case R_KIND_MODULES:
+      for(size_t i=0; i<size / sizeof(R_module); i++) {
+        R_module *mod = (R_module *)ptr + i;
+        mod->path = visit(mod->path);
+        R_scan_box(&mod->scope, visit);
+        R_scan_box(&mod->value, visit);
+      }
+      break;
+
+    case R_KIND_BUF:
+      ((R_buf *)ptr)->map = visit(((R_buf *)ptr)->map);
+      break;
+
+    case R_KIND_METHODS:
+      for(size_t i=0; i<size / sizeof(R_method_site); i++) {
+        R_method_site *site = (R_method_site *)ptr + i;
+        site->meta = visit(site->meta);
+        R_scan_box(&site->method, visit);
+      }
+      break;
+
+    case R_KIND_VM:
+      R_scan_vm(ptr, visit);
+      break;
+  }
+}
+
+static void R_heap_drain(R_visit visit) {
+  while(R_worklist.cur > 0) {
+    R_worklist.cur -= 1;
+    void *ptr = R_worklist.ptrs[R_worklist.cur];
+    R_scan(ptr, R_HDR(ptr)->kind, R_HDR(ptr)->size, visit);
+  }
+}
+
+static void R_heap_minor() {
+  for(size_t i=0; i<R_roots.cur; i++) {
+    R_scan_vm(R_roots.ptrs[i], R_heap_evacuate);
+  }
+
+  for(size_t i=0; i<R_remembered.cur; i++) {
+    void *ptr = R_remembered.ptrs[i];
+    R_HDR(ptr)->flags &= ~R_OBJ_REMEMBERED;
+    R_scan(ptr, R_HDR(ptr)->kind, R_HDR(ptr)->size, R_heap_evacuate);
+  }
+  R_remembered.cur = 0;
+
+  for(size_t i=0; i<R_remembered_slots.cur; i++) {
+    void **slot = R_remembered_slots.ptrs[i];
+    *slot = R_heap_evacuate(*slot);
+  }
+  R_remembered_slots.cur = 0;
+
+  R_heap_drain(R_heap_evacuate);
+
+  memset(R_nursery, 0, R_nursery_used);
+  R_nursery_used = 0;
+}
+
+static void R_heap_major() {
+  for(size_t i=0; i<R_roots.cur; i++) {
+    R_heap_mark(R_roots.ptrs[i]);
+  }
+
+  R_heap_drain(R_heap_mark);
+
+  R_obj **link = &R_old;
+  size_t live = 0;
+
+  // rebuild the old set from the survivors
+  memset(R_old_set, 0, sizeof(void *) * R_old_set_max);
+  R_old_set_cur = 0;
+
+  while(*link != NULL) {
+    R_obj *obj = *link;
+
+    if(obj->flags & R_OBJ_MARK) {
+      obj->flags &= ~R_OBJ_MARK;
+      live += obj->size;
+      R_old_set_add(R_PAYLOAD(obj));
+      link = &obj->next;
+    }
+    else {
+      if(obj->kind == R_KIND_MAP) {
+        R_map_release(R_PAYLOAD(obj));
+      }
+
+      *link = obj->next;
+      free(obj);
+    }
+  }
+
+  for(size_t i=0; i<R_image_marked.cur; i++) {
+    R_HDR(R_image_marked.ptrs[i])->flags &= ~R_OBJ_MARK;
+  }
+  R_image_marked.cur = 0;
+
+  R_old_bytes = live;
+  R_major_limit = live * 2 > R_MAJOR_MIN ? live * 2 : R_MAJOR_MIN;
+}
+
+void R_heap_collect(bool major) {
+  R_heap_pause_begin();
+  R_heap_minor();
+
+  if(major || R_heap_wants_major) {
+    R_heap_major();
+    R_heap_wants_major = false;
+  }
+
+  R_heap_wants_gc = false;
+  R_heap_pause_end();
+}
+
+void R_heap_gc_stats(R_heap_stats *out) {
+  *out = R_gc_stats;
+  out->live_bytes = R_old_bytes + R_nursery_used;
+}
+
+#endif
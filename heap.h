@@ -0,0 +1,101 @@
+#ifndef R_HEAP_H
+#define R_HEAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// allocation kinds tell the precise collector how to trace an object. the
+// Boehm backend only uses them to choose between atomic and scanned memory.
+#define R_KIND_RAW    0 // no pointers: string data, instructions
+#define R_KIND_BOX    1 // a single R_box (metas)
+#define R_KIND_BOXES  2 // an array of R_box (stack, consts)
+#define R_KIND_TABLE  3 // an R_table
+#define R_KIND_ITEMS  4 // an array of R_item pointers
+#define R_KIND_ITEM   5 // an R_item
+#define R_KIND_FRAMES 6 // an array of R_frame
+#define R_KIND_STRS   7 // an array of char pointers
+#define R_KIND_VM     8 // an R_vm, never moved and always a root
+#define R_KIND_MODULES 9 // an array of R_module
+#define R_KIND_BUF    10 // an R_buf
+#define R_KIND_MAP    11 // an R_map, never moved and released when freed
+#define R_KIND_METHODS 12 // an array of R_method_site
+#define R_NUM_KINDS   13
+
+// pause histogram buckets count collections that took less than 2^i us; the
+// last bucket holds everything slower
+#define R_PAUSE_BUCKETS 20
+
+typedef struct R_heap_stats {
+  // per VM
+  uint64_t count[R_NUM_KINDS];
+  uint64_t bytes[R_NUM_KINDS];
+  uint64_t scopes;
+
+  // process wide
+  uint64_t live_bytes;
+  uint64_t collections;
+  uint64_t pause_total_ns;
+  uint64_t pause_max_ns;
+  uint64_t pauses[R_PAUSE_BUCKETS];
+} R_heap_stats;
+
+// every object in the precise heap, and every object in a snapshot image, is
+// preceded by a header
+typedef struct R_obj {
+  uint32_t kind;
+  uint32_t flags;
+  size_t size;
+  struct R_obj *next;
+  void *fwd;
+} R_obj;
+
+struct R_vm;
+
+// allocations are charged to the VM that is currently executing on this thread
+extern __thread struct R_vm *R_heap_vm;
+extern volatile bool R_heap_collecting;
+extern const char *R_KIND_NAMES[R_NUM_KINDS];
+
+void R_heap_init();
+void *R_alloc(int kind, size_t size);
+void *R_realloc(void *ptr, int kind, size_t size);
+void R_heap_root(struct R_vm *vm);
+void R_heap_unroot(struct R_vm *vm);
+void R_heap_thread_begin();
+void R_heap_thread_end();
+void R_heap_collect(bool major);
+void R_heap_gc_stats(R_heap_stats *out);
+
+// snapshot images are mapped outside the heap but hold heap objects, so the
+// collector has to be told where they are. image objects are never freed.
+void R_heap_image(void *base, size_t size);
+bool R_heap_in_image(void *ptr);
+void R_heap_image_obj(R_obj *obj, int kind, size_t size);
+
+#ifdef R_GC_PRECISE
+
+// the precise collector only runs at instruction boundaries, when the only
+// live references are reachable from the registered VMs. allocations never
+// collect; they set R_heap_wants_gc and the next safepoint does the work.
+extern bool R_heap_wants_gc;
+
+void R_heap_barrier(void *obj);
+void R_heap_barrier_slot(void **slot);
+
+#define R_heap_safepoint() do { \
+  if(R_heap_wants_gc) R_heap_collect(false); \
+} while(0)
+
+#define R_heap_write(obj) R_heap_barrier(obj)
+#define R_heap_write_slot(slot) R_heap_barrier_slot((void **)(slot))
+
+#else
+
+#define R_heap_safepoint() do {} while(0)
+#define R_heap_write(obj) do {} while(0)
+#define R_heap_write_slot(slot) do {} while(0)
+
+#endif
+
+#endif
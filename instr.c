@@ -26,6 +26,10 @@ void (*R_INSTR_TABLE[NUM_INSTRS])(R_vm *, R_op *) = {
   R_LOAD,
   R_SAVE,
   R_FIT,
+  R_NEXT,
+  R_REGS,
+  R_CALL_METHOD,
+  R_IMPORT_AT,
 };
 
 
@@ -53,6 +57,10 @@ const char *R_INSTR_NAMES[NUM_INSTRS] = {
   "LOAD",
   "SAVE",
   "FIT",
+  "NEXT",
+  "REGS",
+  "CALL_METHOD",
+  "IMPORT_AT",
 };
 
 void R_PRINT(R_vm *vm, R_op *instr) {
@@ -72,15 +80,20 @@ void R_PUSH_SCOPE(R_vm *vm, R_op *instr) {
 void R_UN_OP(R_vm *vm, R_op *instr) {
 }
 
-void R_BIN_OP(R_vm *vm, R_op *instr) {
-  R_box rhs = vm_pop(vm);
-  R_box lhs = vm_top(vm);
-  R_box *top = &vm->stack[vm->stack_ptr - 1];
+// the value operations are shared by the stack and register interpreters.
+// the result may be written over either operand.
+void R_bin_op(R_box *top, R_box *left, R_box *right, uint32_t op) {
+  R_box lhs = *left;
+  R_box rhs = *right;
   bool do_float = false;
   double lhs_f, rhs_f;
 
+  if(R_array_bin_op(top, &lhs, &rhs, op)) {
+    return;
+  }
+
   if(R_TYPE_IS(&lhs, INT) && R_TYPE_IS(&rhs, INT)) {
-    switch(R_UI(instr)) {
+    switch(op) {
       case BIN_ADD: R_set_int(top, lhs.i64 + rhs.i64); break;
       case BIN_SUB: R_set_int(top, lhs.i64 - rhs.i64); break;
       case BIN_MUL: R_set_int(top, lhs.i64 * rhs.i64); break;
@@ -105,7 +118,7 @@ void R_BIN_OP(R_vm *vm, R_op *instr) {
   }
 
   if(do_float) {
-    switch(R_UI(instr)) {
+    switch(op) {
       case BIN_ADD: R_set_float(top, lhs_f + rhs_f); break;
       case BIN_SUB: R_set_float(top, lhs_f - rhs_f); break;
       case BIN_MUL: R_set_float(top, lhs_f * rhs_f); break;
@@ -117,10 +130,19 @@ void R_BIN_OP(R_vm *vm, R_op *instr) {
   R_set_null(top);
 }
 
-void R_CMP(R_vm *vm, R_op *instr) {
+void R_BIN_OP(R_vm *vm, R_op *instr) {
   R_box rhs = vm_pop(vm);
-  R_box lhs = vm_top(vm);
   R_box *top = &vm->stack[vm->stack_ptr - 1];
+  R_bin_op(top, top, &rhs, R_UI(instr));
+}
+
+void R_cmp(R_box *top, R_box *left, R_box *right, uint32_t op) {
+  R_box lhs = *left;
+  R_box rhs = *right;
+
+  if(R_array_cmp(top, &lhs, &rhs, op)) {
+    return;
+  }
 
   if(lhs.type != rhs.type) {
     R_set_bool(top, false);
@@ -128,7 +150,7 @@ void R_CMP(R_vm *vm, R_op *instr) {
   }
 
   if(R_TYPE_IS(&lhs, INT) && R_TYPE_IS(&rhs, INT)) {
-    switch(R_UI(instr)) {
+    switch(op) {
       case CMP_LT: R_set_bool(top, lhs.i64 < rhs.i64); break;
       case CMP_LE: R_set_bool(top, lhs.i64 <= rhs.i64); break;
       case CMP_GT: R_set_bool(top, lhs.i64 > rhs.i64); break;
@@ -141,7 +163,7 @@ void R_CMP(R_vm *vm, R_op *instr) {
 
   // TODO: add int/float and float/int comparisons?
   else if(R_TYPE_IS(&lhs, FLOAT) && R_TYPE_IS(&rhs, FLOAT)) {
-    switch(R_UI(instr)) {
+    switch(op) {
       case CMP_LT: R_set_bool(top, lhs.f64 < rhs.f64); break;
       case CMP_LE: R_set_bool(top, lhs.f64 <= rhs.f64); break;
       case CMP_GT: R_set_bool(top, lhs.f64 > rhs.f64); break;
@@ -153,7 +175,7 @@ void R_CMP(R_vm *vm, R_op *instr) {
   }
 
   else if(R_TYPE_IS(&lhs, BOOL) && R_TYPE_IS(&rhs, BOOL)) {
-    switch(R_UI(instr)) {
+    switch(op) {
       case CMP_LT: R_set_bool(top, lhs.u64 < rhs.u64); break;
       case CMP_LE: R_set_bool(top, lhs.u64 <= rhs.u64); break;
       case CMP_GT: R_set_bool(top, lhs.u64 > rhs.u64); break;
@@ -167,6 +189,12 @@ void R_CMP(R_vm *vm, R_op *instr) {
   R_set_null(top);
 }
 
+void R_CMP(R_vm *vm, R_op *instr) {
+  R_box rhs = vm_pop(vm);
+  R_box *top = &vm->stack[vm->stack_ptr - 1];
+  R_cmp(top, top, &rhs, R_UI(instr));
+}
+
 
 void R_JUMP(R_vm *vm, R_op *instr) {
   vm->instr_ptr += R_SI(instr);
@@ -194,22 +222,58 @@ void R_POP(R_vm *vm, R_op *instr) {
 }
 
 
+void R_set(R_box *table, R_box *key, R_box *val) {
+  if(R_IS_ARRAY(table)) {
+    R_array_set(table, key, val);
+    return;
+  }
+
+  // buffers are read-only
+  if(R_TYPE_IS(table, BUF)) {
+    return;
+  }
+
+  if(R_TYPE_IS(table, FROZEN)) {
+    fprintf(stderr, "Cannot write to a frozen table\n");
+    return;
+  }
+
+  R_table_set(table, key, val);
+}
+
 void R_SET(R_vm *vm, R_op *instr) {
   R_box table = vm_pop(vm);
   R_box key = vm_pop(vm);
   R_box val = vm_pop(vm);
-  R_table_set(&table, &key, &val);
+
+  R_set(&table, &key, &val);
 }
 
 
-void R_GET(R_vm *vm, R_op *instr) {
-  R_box table = vm_pop(vm);
+// looks the key up through the table's chain of metas
+void R_get(R_box *top, R_box *src, R_box *idx) {
+  R_box table = *src;
+  R_box key = *idx;
   R_box *cur = &table;
-  R_box key = vm_top(vm);
-  R_box *top = &vm->stack[vm->stack_ptr - 1];
   R_box *res;
+
+  if(R_IS_ARRAY(&table)) {
+    R_array_get(top, &table, &key);
+    return;
+  }
+
+  if(R_TYPE_IS(&table, BUF)) {
+    R_buf_get(top, &table, &key);
+    return;
+  }
+
   while(cur != NULL) {
-    res = R_table_get(cur, &key);
+    if(R_TYPE_IS(cur, FROZEN)) {
+      res = R_frozen_get(cur, &key);
+    }
+    else {
+      res = R_table_get(cur, &key);
+    }
 
     if(res != NULL) {
       *top = *res;
@@ -227,9 +291,27 @@ void R_GET(R_vm *vm, R_op *instr) {
   R_set_null(top);
 }
 
+void R_GET(R_vm *vm, R_op *instr) {
+  R_box table = vm_pop(vm);
+  R_box *top = &vm->stack[vm->stack_ptr - 1];
+  R_get(top, &table, top);
+}
+
+void R_new_table(R_box *top, uint32_t want) {
+  if(want > R_SHAPE_MAX) {
+    R_set_table_sized(top, want * 2 + 2);
+    return;
+  }
+
+  R_set_table(top);
+  if(want > 0) {
+    R_table_reserve(top, want);
+  }
+}
+
+// the operand is the number of keys the table is expected to hold, or 0
 void R_PUSH_TABLE(R_vm *vm, R_op *instr) {
-  R_set_table(&vm->stack[vm->stack_ptr]);
-  vm->stack_ptr += 1;
+  R_new_table(vm_alloc(vm), R_UI(instr));
 }
 
 void R_NOP(R_vm *vm, R_op *instr) {
@@ -246,47 +328,119 @@ void R_RETURN(R_vm *vm, R_op *instr) {
 void R_IMPORT(R_vm *vm, R_op *instr) {
   R_box pop = vm_pop(vm);
   if(R_TYPE_IS(&pop, STR)) {
-    vm_import(vm, pop.str);
-    vm->instr_ptr -= 1;
+    // modules that are still initializing import as null
+    R_module *mod = vm_module(vm, pop.str);
+    if(mod != NULL) {
+      R_box null;
+      R_set_null(&null);
+      vm_push(vm, mod->ready ? &mod->value : &null);
+      return;
+    }
+
+    if(vm_import(vm, pop.str)) {
+      vm->instr_ptr -= 1;
+      return;
+    }
+  }
+
+  R_box null;
+  R_set_null(&null);
+  vm_push(vm, &null);
+}
+
+// a module linked into the same image by rainld. the operand is where its
+// body starts and the path on the stack is only used to register it.
+void R_IMPORT_AT(R_vm *vm, R_op *instr) {
+  R_box pop = vm_pop(vm);
+  R_module *mod = vm_module_at(vm, R_UI(instr));
+
+  if(mod != NULL) {
+    R_box null;
+    R_set_null(&null);
+    vm_push(vm, mod->ready ? &mod->value : &null);
+    return;
   }
+
+  vm_import_at(vm, R_TYPE_IS(&pop, STR) ? pop.str : "", R_UI(instr));
+  vm->instr_ptr -= 1;
 }
 
 void R_CALL(R_vm *vm, R_op *instr) {
   R_box pop = vm_pop(vm);
-  R_box scope;
+  vm_call_box(vm, &pop, R_UI(instr));
+}
 
-  if(R_TYPE_IS(&pop, FUNC)) {
-    if(R_has_meta(&pop)) {
-      R_table_clone(pop.meta, &scope);
-    }
-    else {
-      R_set_table(&scope);
-    }
+// the receiver's own keys come first, then the chain of metas like GET. only
+// methods found on the chain are cached, and every table it passed through is
+// watched so that changing any of them invalidates the cache.
+static void R_method_lookup(R_vm *vm, R_method_site *site, R_box *recv, R_box *ret) {
+  uint64_t epoch = atomic_load_explicit(&R_table_epoch, memory_order_relaxed);
+  R_box *name = &vm->consts[site->name];
+  R_box *cur = recv;
+  R_box *res;
 
-    vm_call(vm, pop.u64 - 1, &scope, R_UI(instr));
+  if(R_TYPE_ISNT(recv, TABLE)) {
+    R_get(ret, recv, name);
+    return;
   }
 
-  else if(R_TYPE_IS(&pop, CFUNC)) {
-    if(R_has_meta(&pop)) {
-      R_table_clone(pop.meta, &scope);
+  res = R_table_get(recv, name);
+  if(res != NULL) {
+    *ret = *res;
+    return;
+  }
+
+  while(R_has_meta(cur)) {
+    cur = cur->meta;
+
+    if(R_TYPE_IS(cur, FROZEN)) {
+      res = R_frozen_get(cur, name);
+    }
+    else if(R_TYPE_IS(cur, TABLE)) {
+      cur->table->flags |= R_TABLE_WATCHED;
+      res = R_table_get(cur, name);
     }
     else {
-      R_set_table(&scope);
+      break;
     }
 
-    vm_call(vm, vm->instr_ptr, &scope, R_UI(instr));
+    if(res != NULL) {
+      site->epoch = epoch;
+      site->shape = recv->table->shape;
+      site->meta = recv->meta;
+      site->method = *res;
+      *ret = *res;
+      return;
+    }
+  }
 
-    void (*fn)(R_vm *) = (void (*)(R_vm *))pop.ptr;
-    fn(vm);
+  R_set_null(ret);
+}
 
-    vm_ret(vm);
+// the receiver and argc arguments are on the stack, so the receiver is
+// already in place as the method's first argument
+void R_CALL_METHOD(R_vm *vm, R_op *instr) {
+  R_method_site *site = &vm->methods[R_UI(instr)];
+  R_box *recv = &vm->stack[vm->stack_ptr - site->argc - 1];
+  R_box method;
+
+  if(site->meta != NULL && recv->meta == site->meta && R_TYPE_IS(recv, TABLE) &&
+     site->epoch == atomic_load_explicit(&R_table_epoch, memory_order_relaxed) &&
+     ((recv->table->shape != NULL && recv->table->shape == site->shape) ||
+      R_table_get(recv, &vm->consts[site->name]) == NULL)) {
+    method = site->method;
+  }
+  else {
+    R_method_lookup(vm, site, recv, &method);
   }
+
+  vm_call_box(vm, &method, site->argc + 1);
 }
 
 void R_SET_META(R_vm *vm, R_op *instr) {
   R_box pop = vm_pop(vm);
   R_box *top = &vm->stack[vm->stack_ptr - 1];
-  top->meta = GC_malloc(sizeof(R_box));
+  top->meta = R_alloc(R_KIND_BOX, sizeof(R_box));
   *(top->meta) = pop;
 }
 
@@ -318,3 +472,125 @@ void R_SAVE(R_vm *vm, R_op *instr) {
 void R_FIT(R_vm *vm, R_op *instr) {
   vm_fit(vm, R_UI(instr));
 }
+
+// expects the iterable and a cursor (null to start) on the stack. pushes the
+// next key and value and advances the cursor, or pops both and jumps when
+// there's nothing left. arrays and buffers are walked by index.
+void R_NEXT(R_vm *vm, R_op *instr) {
+  R_box *iter = &vm->stack[vm->stack_ptr - 2];
+  R_box *cursor = &vm->stack[vm->stack_ptr - 1];
+  uint32_t pos = R_TYPE_IS(cursor, INT) ? cursor->i64 : 0;
+  R_box key;
+  R_box val;
+  bool found = false;
+
+  if(R_TYPE_IS(iter, TABLE)) {
+    found = R_table_next(iter, &pos, &key, &val);
+  }
+  else if(R_TYPE_IS(iter, FROZEN)) {
+    found = R_frozen_next(iter, &pos, &key, &val);
+  }
+  else if(R_IS_ARRAY(iter) || R_TYPE_IS(iter, BUF)) {
+    R_set_int(&key, pos);
+    if(R_TYPE_IS(iter, BUF)) {
+      R_buf_get(&val, iter, &key);
+    }
+    else {
+      R_array_get(&val, iter, &key);
+    }
+
+    found = R_TYPE_ISNT(&val, NULL);
+    pos += 1;
+  }
+
+  if(found) {
+    R_set_int(cursor, pos);
+    vm_push(vm, &key);
+    vm_push(vm, &val);
+    return;
+  }
+
+  vm_pop(vm);
+  vm_pop(vm);
+  vm->instr_ptr += R_SI(instr);
+}
+
+static inline R_box *R_reg_arg(R_vm *vm, R_box *regs, uint32_t arg) {
+  if(arg == R_REG_SCOPE) {
+    return &vm->frames[vm->frame_ptr - 1].scope;
+  }
+
+  if(arg & R_REG_CONST) {
+    return &vm->consts[arg & ~R_REG_CONST];
+  }
+
+  return &regs[arg];
+}
+
+// run the register ops the operand points at until one leaves for a stack
+// instruction. collections only happen at safepoints between instructions,
+// so the registers never need to be traced. instr_ptr follows the stack
+// instruction each op came from, so allocations and samples land there.
+void R_REGS(R_vm *vm, R_op *instr) {
+  R_box regs[R_REGS_MAX];
+  R_reg_op *first = vm->reg_ops + R_UI(instr);
+  R_reg_op *op = first;
+  R_box *val;
+
+  while(true) {
+    vm->instr_ptr = op->at;
+
+    switch(op->op) {
+      case R_ROP_GET:
+        R_get(&regs[op->dst], R_reg_arg(vm, regs, op->a), R_reg_arg(vm, regs, op->b));
+        break;
+
+      case R_ROP_SET:
+        R_set(R_reg_arg(vm, regs, op->a), R_reg_arg(vm, regs, op->b),
+              R_reg_arg(vm, regs, op->c));
+        break;
+
+      case R_ROP_BIN:
+        R_bin_op(&regs[op->dst], R_reg_arg(vm, regs, op->a), R_reg_arg(vm, regs, op->b),
+                 op->sub);
+        break;
+
+      case R_ROP_CMP:
+        R_cmp(&regs[op->dst], R_reg_arg(vm, regs, op->a), R_reg_arg(vm, regs, op->b),
+              op->sub);
+        break;
+
+      case R_ROP_PRINT:
+        R_box_print(R_reg_arg(vm, regs, op->a));
+        break;
+
+      case R_ROP_PUSH:
+        vm_push(vm, R_reg_arg(vm, regs, op->a));
+        break;
+
+      case R_ROP_POP:
+        regs[op->dst] = vm_pop(vm);
+        break;
+
+      case R_ROP_TABLE:
+        R_new_table(&regs[op->dst], op->a);
+        break;
+
+      case R_ROP_JUMPIF:
+        val = R_reg_arg(vm, regs, op->a);
+        if(val->type != R_TYPE_NULL && !(val->type == R_TYPE_BOOL && val->i64 == 0)) {
+          vm->instr_ptr = op->b - 1;
+          vm->run_instrs += op - first;
+          return;
+        }
+        break;
+
+      case R_ROP_EXIT:
+        vm->instr_ptr = op->b - 1;
+        vm->run_instrs += op - first;
+        return;
+    }
+
+    op += 1;
+  }
+}
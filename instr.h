@@ -3,7 +3,7 @@
 
 #include "rain.h"
 
-#define NUM_INSTRS 0x17
+#define NUM_INSTRS 0x1B
 
 #define PUSH_CONST 0x00
 #define PRINT      0x01
@@ -28,6 +28,10 @@
 #define LOAD       0x14
 #define SAVE       0x15
 #define FIT        0x16
+#define NEXT       0x17
+#define REGS       0x18
+#define CALL_METHOD 0x19
+#define IMPORT_AT  0x1A
 
 #define CMP_LT     0x00
 #define CMP_LE     0x01
@@ -67,9 +71,19 @@ void R_GET_META(R_vm *vm, R_op *instr);
 void R_LOAD(R_vm *vm, R_op *instr);
 void R_SAVE(R_vm *vm, R_op *instr);
 void R_FIT(R_vm *vm, R_op *instr);
+void R_NEXT(R_vm *vm, R_op *instr);
+void R_REGS(R_vm *vm, R_op *instr);
+void R_CALL_METHOD(R_vm *vm, R_op *instr);
+void R_IMPORT_AT(R_vm *vm, R_op *instr);
 
-void (*R_INSTR_TABLE[NUM_INSTRS])(R_vm *, R_op *);
+void R_bin_op(R_box *top, R_box *left, R_box *right, uint32_t op);
+void R_cmp(R_box *top, R_box *left, R_box *right, uint32_t op);
+void R_get(R_box *top, R_box *src, R_box *idx);
+void R_set(R_box *table, R_box *key, R_box *val);
+void R_new_table(R_box *top, uint32_t want);
 
-const char *R_INSTR_NAMES[NUM_INSTRS];
+extern void (*R_INSTR_TABLE[NUM_INSTRS])(R_vm *, R_op *);
+
+extern const char *R_INSTR_NAMES[NUM_INSTRS];
 
 #endif
@@ -0,0 +1,1089 @@
+#include "rain.h"
+
+#include <math.h>
+#include <string.h>
+
+// json
+//
+// decoding takes two passes. the first finds every quote and structural
+// character outside of strings, 64 bytes at a time, and records their offsets.
+// the second walks those offsets to build values, so string contents are
+// never scanned byte by byte and every object and array knows how many
+// members it has before it's created. object keys are interned for the
+// length of a decode, so a key repeated across a million objects is one
+// string.
+//
+// encoding appends to a buffer that each thread keeps between calls, and
+// only copies the finished text into the heap.
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#define R_JSON_SSE2
+#endif
+
+// encode buffers bigger than this are given back instead of kept
+#define R_JSON_KEEP (16 * 1024 * 1024)
+
+typedef struct R_json_masks {
+  uint64_t quote;
+  uint64_t backslash;
+  uint64_t op;
+} R_json_masks;
+
+// a container being filled in
+typedef struct R_json_level {
+  R_box box;
+  R_box key;
+  bool object;
+  int64_t next;
+} R_json_level;
+
+typedef struct R_json {
+  const char *data;
+  size_t len;
+  bool escapes;
+
+  // offsets of structural characters and quotes, ending with len
+  uint32_t *idx;
+  uint32_t num_idx;
+  uint32_t at;
+
+  // members of the container opened at each offset
+  uint32_t *counts;
+
+  // interned keys
+  char **keys;
+  uint64_t *key_hashes;
+  uint32_t num_keys;
+  uint32_t max_keys;
+
+  char *scratch;
+  size_t scratch_max;
+} R_json;
+
+static void R_json_classify(const char *p, R_json_masks *out) {
+  out->quote = 0;
+  out->backslash = 0;
+  out->op = 0;
+
+#ifdef R_JSON_SSE2
+  // {} and [] differ only in bit 5
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  const __m128i open = _mm_set1_epi8('{');
+  const __m128i close = _mm_set1_epi8('}');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+
+  for(int i=0; i<4; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+    __m128i lower = _mm_or_si128(v, case_bit);
+    __m128i op = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(lower, open), _mm_cmpeq_epi8(lower, close)),
+      _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+
+    out->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << (16 * i);
+    out->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)) << (16 * i);
+    out->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << (16 * i);
+  }
+#else
+  for(int i=0; i<64; i++) {
+    char c = p[i];
+    uint64_t bit = 1ull << i;
+
+    if(c == '"') {
+      out->quote |= bit;
+    }
+    else if(c == '\\') {
+      out->backslash |= bit;
+    }
+    else if((c | 0x20) == '{' || (c | 0x20) == '}' || c == ':' || c == ',') {
+      out->op |= bit;
+    }
+  }
+#endif
+}
+
+// the characters escaped by a backslash. *carry is set when the block ends in
+// a backslash that escapes the first character of the next one.
+static uint64_t R_json_escaped(uint64_t backslash, uint64_t *carry) {
+  uint64_t escaped = *carry;
+
+  *carry = 0;
+
+  while(backslash != 0) {
+    uint64_t bit = backslash & -backslash;
+    backslash ^= bit;
+
+    if(escaped & bit) {
+      continue;
+    }
+
+    if(bit == 1ull << 63) {
+      *carry = 1;
+    }
+    else {
+      escaped |= bit << 1;
+    }
+  }
+
+  return escaped;
+}
+
+// each bit is the parity of the quotes up to and including it, which marks
+// everything from an opening quote up to its closing quote
+static inline uint64_t R_json_prefix_xor(uint64_t bits) {
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+static bool R_json_index(R_json *js) {
+  uint64_t escape_carry = 0;
+  uint64_t string_carry = 0;
+  R_json_masks masks;
+  char tail[64];
+
+  js->idx = malloc(sizeof(uint32_t) * (js->len + 1));
+  js->num_idx = 0;
+
+  for(size_t base=0; base<js->len; base+=64) {
+    const char *p = js->data + base;
+
+    if(js->len - base < 64) {
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, p, js->len - base);
+      p = tail;
+    }
+
+    R_json_classify(p, &masks);
+
+    if(masks.backslash != 0 || escape_carry != 0) {
+      js->escapes = true;
+      masks.quote &= ~R_json_escaped(masks.backslash, &escape_carry);
+    }
+
+    uint64_t inside = R_json_prefix_xor(masks.quote) ^ string_carry;
+    string_carry = (uint64_t)((int64_t)inside >> 63);
+
+    uint64_t bits = (masks.op & ~inside) | masks.quote;
+    while(bits != 0) {
+      js->idx[js->num_idx] = base + __builtin_ctzll(bits);
+      js->num_idx += 1;
+      bits &= bits - 1;
+    }
+  }
+
+  js->idx[js->num_idx] = js->len;
+  return string_carry == 0;
+}
+
+static inline bool R_json_space(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// count the members of every container and check that they're balanced. *p
+// is left at the first bracket that isn't.
+static bool R_json_count(R_json *js, size_t *p) {
+  uint32_t open[R_JSON_DEPTH];
+  uint32_t depth = 0;
+
+  js->counts = malloc(sizeof(uint32_t) * (js->num_idx + 1));
+
+  for(uint32_t i=0; i<js->num_idx; i++) {
+    char c = js->data[js->idx[i]];
+
+    switch(c) {
+      case '{':
+      case '[':
+        if(depth == R_JSON_DEPTH) {
+          *p = js->idx[i];
+          return false;
+        }
+
+        js->counts[i] = 0;
+        open[depth] = i;
+        depth += 1;
+        break;
+
+      case ',':
+        if(depth > 0) {
+          js->counts[open[depth - 1]] += 1;
+        }
+        break;
+
+      case '}':
+      case ']': {
+        if(depth == 0 || js->data[js->idx[open[depth - 1]]] != (c == '}' ? '{' : '[')) {
+          *p = js->idx[i];
+          return false;
+        }
+
+        depth -= 1;
+        uint32_t from = open[depth];
+        bool empty = from + 1 == i;
+
+        // scalars aren't indexed, so look for one between the brackets
+        for(uint32_t j=js->idx[from]+1; empty && j<js->idx[i]; j++) {
+          empty = R_json_space(js->data[j]);
+        }
+
+        if(!empty) {
+          js->counts[from] += 1;
+        }
+        break;
+      }
+    }
+  }
+
+  if(depth > 0) {
+    *p = js->idx[open[depth - 1]];
+    return false;
+  }
+
+  return true;
+}
+
+static inline size_t R_json_skip(R_json *js, size_t p) {
+  while(p < js->len && R_json_space(js->data[p])) {
+    p += 1;
+  }
+
+  return p;
+}
+
+// consume the indexed character at p
+static inline bool R_json_take(R_json *js, size_t p) {
+  if(js->idx[js->at] != p) {
+    return false;
+  }
+
+  js->at += 1;
+  return true;
+}
+
+static bool R_json_hex(const char *from, const char *to, uint32_t *out) {
+  *out = 0;
+
+  if(to - from < 4) {
+    return false;
+  }
+
+  for(int i=0; i<4; i++) {
+    char c = from[i];
+    *out <<= 4;
+
+    if(c >= '0' && c <= '9') {
+      *out |= c - '0';
+    }
+    else if((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+      *out |= (c | 0x20) - 'a' + 10;
+    }
+    else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static int R_json_utf8(char *out, uint32_t cp) {
+  if(cp < 0x80) {
+    out[0] = cp;
+    return 1;
+  }
+
+  if(cp < 0x800) {
+    out[0] = 0xC0 | (cp >> 6);
+    out[1] = 0x80 | (cp & 0x3F);
+    return 2;
+  }
+
+  if(cp < 0x10000) {
+    out[0] = 0xE0 | (cp >> 12);
+    out[1] = 0x80 | ((cp >> 6) & 0x3F);
+    out[2] = 0x80 | (cp & 0x3F);
+    return 3;
+  }
+
+  out[0] = 0xF0 | (cp >> 18);
+  out[1] = 0x80 | ((cp >> 12) & 0x3F);
+  out[2] = 0x80 | ((cp >> 6) & 0x3F);
+  out[3] = 0x80 | (cp & 0x3F);
+  return 4;
+}
+
+// decode [from, to) into out, which is never longer. returns the length
+// written or -1 for a bad escape.
+static int64_t R_json_unescape(char *out, const char *from, const char *to) {
+  char *start = out;
+
+  while(from < to) {
+    const char *bs = memchr(from, '\\', to - from);
+    if(bs == NULL) {
+      bs = to;
+    }
+
+    memcpy(out, from, bs - from);
+    out += bs - from;
+    from = bs;
+
+    if(from == to) {
+      break;
+    }
+
+    if(to - from < 2) {
+      return -1;
+    }
+
+    switch(from[1]) {
+      case '"': *out++ = '"'; break;
+      case '\\': *out++ = '\\'; break;
+      case '/': *out++ = '/'; break;
+      case 'b': *out++ = '\b'; break;
+      case 'f': *out++ = '\f'; break;
+      case 'n': *out++ = '\n'; break;
+      case 'r': *out++ = '\r'; break;
+      case 't': *out++ = '\t'; break;
+
+      case 'u': {
+        uint32_t cp;
+        uint32_t low;
+
+        if(!R_json_hex(from + 2, to, &cp)) {
+          return -1;
+        }
+
+        from += 6;
+
+        // surrogate pairs are two escapes for one code point
+        if(cp >= 0xD800 && cp < 0xDC00 && to - from >= 6 && from[0] == '\\' &&
+           from[1] == 'u' && R_json_hex(from + 2, to, &low) && low >= 0xDC00 && low < 0xE000) {
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+          from += 6;
+        }
+
+        out += R_json_utf8(out, cp);
+        continue;
+      }
+
+      default:
+        return -1;
+    }
+
+    from += 2;
+  }
+
+  return out - start;
+}
+
+// the string whose opening quote is at p
+static bool R_json_string(R_json *js, size_t *p, R_box *ret) {
+  if(!R_json_take(js, *p)) {
+    return false;
+  }
+
+  size_t end = js->idx[js->at];
+  if(end >= js->len || !R_json_take(js, end)) {
+    return false;
+  }
+
+  const char *from = js->data + *p + 1;
+  size_t len = end - *p - 1;
+  char *str = R_alloc(R_KIND_RAW, len + 1);
+  int64_t size = len;
+
+  if(js->escapes && memchr(from, '\\', len) != NULL) {
+    size = R_json_unescape(str, from, from + len);
+    if(size < 0) {
+      return false;
+    }
+  }
+  else {
+    memcpy(str, from, len);
+  }
+
+  str[size] = 0;
+  ret->type = R_TYPE_STR;
+  ret->str = str;
+  ret->size = size;
+  ret->meta = NULL;
+
+  *p = end + 1;
+  return true;
+}
+
+static inline uint64_t R_json_hash(const char *s, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  for(size_t i=0; i<len; i++) {
+    hash = (hash ^ (uint8_t)s[i]) * 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+static void R_json_intern(R_json *js, char *key, uint64_t hash);
+
+static void R_json_grow_keys(R_json *js) {
+  char **keys = js->keys;
+  uint64_t *hashes = js->key_hashes;
+  uint32_t max = js->max_keys;
+
+  // the table is heap memory so the keys it holds stay alive
+  js->max_keys = max == 0 ? 256 : max * 2;
+  js->keys = R_alloc(R_KIND_STRS, sizeof(char *) * js->max_keys);
+  js->key_hashes = malloc(sizeof(uint64_t) * js->max_keys);
+  js->num_keys = 0;
+
+  for(uint32_t i=0; i<max; i++) {
+    if(keys[i] != NULL) {
+      R_json_intern(js, keys[i], hashes[i]);
+    }
+  }
+
+  free(hashes);
+}
+
+static void R_json_intern(R_json *js, char *key, uint64_t hash) {
+  uint32_t idx = hash & (js->max_keys - 1);
+
+  while(js->keys[idx] != NULL) {
+    idx = (idx + 1) & (js->max_keys - 1);
+  }
+
+  js->keys[idx] = key;
+  js->key_hashes[idx] = hash;
+  js->num_keys += 1;
+}
+
+// the key whose opening quote is at p
+static bool R_json_key(R_json *js, size_t *p, R_box *ret) {
+  if(js->data[*p] != '"' || !R_json_take(js, *p)) {
+    return false;
+  }
+
+  size_t end = js->idx[js->at];
+  if(end >= js->len || !R_json_take(js, end)) {
+    return false;
+  }
+
+  const char *from = js->data + *p + 1;
+  size_t len = end - *p - 1;
+
+  if(js->escapes && memchr(from, '\\', len) != NULL) {
+    if(len + 1 > js->scratch_max) {
+      js->scratch_max = len + 1;
+      js->scratch = realloc(js->scratch, js->scratch_max);
+    }
+
+    int64_t size = R_json_unescape(js->scratch, from, from + len);
+    if(size < 0) {
+      return false;
+    }
+
+    from = js->scratch;
+    len = size;
+  }
+
+  uint64_t hash = R_json_hash(from, len);
+  uint32_t idx = hash & (js->max_keys - 1);
+  char *key = NULL;
+
+  while(js->keys[idx] != NULL) {
+    if(js->key_hashes[idx] == hash && strncmp(js->keys[idx], from, len) == 0 &&
+       js->keys[idx][len] == 0) {
+      key = js->keys[idx];
+      break;
+    }
+
+    idx = (idx + 1) & (js->max_keys - 1);
+  }
+
+  if(key == NULL) {
+    key = R_alloc(R_KIND_RAW, len + 1);
+    memcpy(key, from, len);
+    key[len] = 0;
+
+    if((js->num_keys + 1) * 2 > js->max_keys) {
+      R_json_grow_keys(js);
+    }
+
+    R_json_intern(js, key, hash);
+  }
+
+  ret->type = R_TYPE_STR;
+  ret->str = key;
+  ret->size = len;
+  ret->meta = NULL;
+
+  *p = end + 1;
+  return true;
+}
+
+static inline bool R_json_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+static bool R_json_number(R_json *js, size_t *p, R_box *ret) {
+  const char *start = js->data + *p;
+  const char *end = js->data + js->len;
+  const char *at = start;
+  bool neg = false;
+  uint64_t val = 0;
+
+  if(at < end && *at == '-') {
+    neg = true;
+    at += 1;
+  }
+
+  const char *digits = at;
+  while(at < end && R_json_digit(*at)) {
+    val = val * 10 + (*at - '0');
+    at += 1;
+  }
+
+  if(at == digits) {
+    return false;
+  }
+
+  // 19 digits always fit in 64 bits before the sign is applied
+  bool frac = at < end && (*at == '.' || *at == 'e' || *at == 'E');
+  if(!frac && at - digits <= 19 && val <= (uint64_t)INT64_MAX + neg) {
+    R_set_int(ret, neg ? (int64_t)(0 - val) : (int64_t)val);
+    *p = at - js->data;
+    return true;
+  }
+
+  while(at < end && (R_json_digit(*at) || *at == '.' || *at == 'e' || *at == 'E' ||
+                     *at == '+' || *at == '-')) {
+    at += 1;
+  }
+
+  // the input isn't necessarily terminated, so strtod gets a copy
+  size_t len = at - start;
+  if(len + 1 > js->scratch_max) {
+    js->scratch_max = len + 1;
+    js->scratch = realloc(js->scratch, js->scratch_max);
+  }
+
+  memcpy(js->scratch, start, len);
+  js->scratch[len] = 0;
+
+  char *parsed;
+  R_set_float(ret, strtod(js->scratch, &parsed));
+  if(parsed != js->scratch + len) {
+    return false;
+  }
+
+  *p = at - js->data;
+  return true;
+}
+
+static bool R_json_literal(R_json *js, size_t *p, const char *word) {
+  size_t len = strlen(word);
+
+  if(js->len - *p < len || memcmp(js->data + *p, word, len) != 0) {
+    return false;
+  }
+
+  *p += len;
+  return true;
+}
+
+static bool R_json_scalar(R_json *js, size_t *p, R_box *ret) {
+  switch(js->data[*p]) {
+    case '"':
+      return R_json_string(js, p, ret);
+
+    case 't':
+      R_set_bool(ret, true);
+      return R_json_literal(js, p, "true");
+
+    case 'f':
+      R_set_bool(ret, false);
+      return R_json_literal(js, p, "false");
+
+    case 'n':
+      R_set_null(ret);
+      return R_json_literal(js, p, "null");
+  }
+
+  return R_json_number(js, p, ret);
+}
+
+// store a finished value in the container at the top, or in ret
+static void R_json_put(R_json_level *top, R_box *ret, R_box *val) {
+  R_box key;
+
+  if(top == NULL) {
+    *ret = *val;
+  }
+  else if(top->object) {
+    R_table_set(&top->box, &top->key, val);
+  }
+  else {
+    R_set_int(&key, top->next);
+    top->next += 1;
+    R_table_set(&top->box, &key, val);
+  }
+}
+
+// containers are stored in their parent as soon as they're made, so
+// everything built so far stays reachable from ret
+static bool R_json_parse(R_json *js, R_box *ret, size_t *p) {
+  R_json_level *levels = malloc(sizeof(R_json_level) * R_JSON_DEPTH);
+  R_json_level *top = NULL;
+  uint32_t depth = 0;
+  bool ok = false;
+  R_box val;
+  char c;
+
+  js->at = 0;
+
+value:
+  *p = R_json_skip(js, *p);
+  if(*p >= js->len) {
+    goto done;
+  }
+
+  c = js->data[*p];
+  if(c == '{' || c == '[') {
+    uint32_t count = js->counts[js->at];
+
+    if(!R_json_take(js, *p)) {
+      goto done;
+    }
+
+    *p += 1;
+
+    // arrays are keyed by ints, which make dictionaries anyway
+    if(c == '{') {
+      R_new_table(&val, count);
+    }
+    else {
+      R_set_table_sized(&val, count * 2 + 2);
+    }
+
+    R_json_put(top, ret, &val);
+
+    top = &levels[depth];
+    depth += 1;
+    top->box = val;
+    top->object = c == '{';
+    top->next = 0;
+
+    *p = R_json_skip(js, *p);
+    if(*p < js->len && js->data[*p] == (c == '{' ? '}' : ']')) {
+      goto close;
+    }
+
+    if(top->object) {
+      goto key;
+    }
+
+    goto value;
+  }
+
+  if(!R_json_scalar(js, p, &val)) {
+    goto done;
+  }
+
+  R_json_put(top, ret, &val);
+  goto next;
+
+key:
+  *p = R_json_skip(js, *p);
+  if(*p >= js->len || !R_json_key(js, p, &top->key)) {
+    goto done;
+  }
+
+  *p = R_json_skip(js, *p);
+  if(*p >= js->len || js->data[*p] != ':' || !R_json_take(js, *p)) {
+    goto done;
+  }
+
+  *p += 1;
+  goto value;
+
+close:
+  if(!R_json_take(js, *p)) {
+    goto done;
+  }
+
+  *p += 1;
+  depth -= 1;
+  top = depth > 0 ? &levels[depth - 1] : NULL;
+
+next:
+  *p = R_json_skip(js, *p);
+
+  if(top == NULL) {
+    ok = *p == js->len;
+    goto done;
+  }
+
+  if(*p >= js->len) {
+    goto done;
+  }
+
+  c = js->data[*p];
+  if(c == ',') {
+    if(!R_json_take(js, *p)) {
+      goto done;
+    }
+
+    *p += 1;
+    if(top->object) {
+      goto key;
+    }
+
+    goto value;
+  }
+
+  if(c == (top->object ? '}' : ']')) {
+    goto close;
+  }
+
+done:
+  free(levels);
+  return ok;
+}
+
+bool R_json_decode(R_box *ret, const char *data, size_t len) {
+  R_json js = {.data = data, .len = len};
+  size_t p = 0;
+  bool ok = false;
+
+  R_set_null(ret);
+
+  if(len >= UINT32_MAX) {
+    fprintf(stderr, "JSON input of %zu bytes is too large\n", len);
+    return false;
+  }
+
+  R_json_grow_keys(&js);
+
+  // an unterminated string runs to the end
+  if(!R_json_index(&js)) {
+    p = len;
+  }
+  else if(R_json_count(&js, &p)) {
+    ok = R_json_parse(&js, ret, &p);
+  }
+
+  if(!ok) {
+    fprintf(stderr, "Invalid JSON at byte %zu\n", p);
+    R_set_null(ret);
+  }
+
+  free(js.idx);
+  free(js.counts);
+  free(js.key_hashes);
+  free(js.scratch);
+  return ok;
+}
+
+typedef struct R_json_out {
+  char *data;
+  size_t len;
+  size_t max;
+} R_json_out;
+
+static __thread R_json_out R_json_buf;
+
+static inline char *R_json_reserve(R_json_out *out, size_t size) {
+  if(out->len + size > out->max) {
+    while(out->len + size > out->max) {
+      out->max = out->max == 0 ? 4096 : out->max * 2;
+    }
+
+    out->data = realloc(out->data, out->max);
+  }
+
+  return out->data + out->len;
+}
+
+static inline void R_json_write(R_json_out *out, const char *data, size_t size) {
+  memcpy(R_json_reserve(out, size), data, size);
+  out->len += size;
+}
+
+// what each byte turns into inside a string: 0 for itself, 'u' for a \u
+// escape, or the character after the backslash
+static const char R_json_escape[256] = {
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  ['"'] = '"',
+  ['\\'] = '\\',
+};
+
+static void R_json_write_str(R_json_out *out, const char *str, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  size_t run = 0;
+
+  R_json_write(out, "\"", 1);
+
+  for(size_t i=0; i<len; i++) {
+    char esc = R_json_escape[(uint8_t)str[i]];
+
+    if(esc == 0) {
+      continue;
+    }
+
+    R_json_write(out, str + run, i - run);
+    run = i + 1;
+
+    char *at = R_json_reserve(out, 6);
+    at[0] = '\\';
+    at[1] = esc;
+
+    if(esc == 'u') {
+      at[2] = '0';
+      at[3] = '0';
+      at[4] = hex[(uint8_t)str[i] >> 4];
+      at[5] = hex[str[i] & 0xF];
+      out->len += 6;
+    }
+    else {
+      out->len += 2;
+    }
+  }
+
+  R_json_write(out, str + run, len - run);
+  R_json_write(out, "\"", 1);
+}
+
+static void R_json_write_int(R_json_out *out, int64_t val) {
+  char tmp[24];
+  char *at = tmp + sizeof(tmp);
+  uint64_t mag = val < 0 ? 0 - (uint64_t)val : (uint64_t)val;
+
+  do {
+    at -= 1;
+    *at = '0' + mag % 10;
+    mag /= 10;
+  } while(mag > 0);
+
+  if(val < 0) {
+    at -= 1;
+    *at = '-';
+  }
+
+  R_json_write(out, at, tmp + sizeof(tmp) - at);
+}
+
+// the shortest of %.15g and %.17g that reads back the same, and always
+// something that decodes as a float again
+static void R_json_write_float(R_json_out *out, double val) {
+  char tmp[32];
+
+  if(!isfinite(val)) {
+    R_json_write(out, "null", 4);
+    return;
+  }
+
+  int len = snprintf(tmp, sizeof(tmp), "%.15g", val);
+  if(strtod(tmp, NULL) != val) {
+    len = snprintf(tmp, sizeof(tmp), "%.17g", val);
+  }
+
+  R_json_write(out, tmp, len);
+
+  if(strpbrk(tmp, ".e") == NULL) {
+    R_json_write(out, ".0", 2);
+  }
+}
+
+static bool R_json_next(R_box *val, uint32_t *pos, R_box *key, R_box *item) {
+  if(R_TYPE_IS(val, TABLE)) {
+    return R_table_next(val, pos, key, item);
+  }
+
+  return R_frozen_next(val, pos, key, item);
+}
+
+// tables whose keys are exactly 0 to n-1 are arrays
+static bool R_json_is_array(R_box *val, uint32_t *count) {
+  uint32_t pos = 0;
+  R_box key;
+  R_box item;
+
+  *count = 0;
+  while(R_json_next(val, &pos, &key, &item)) {
+    *count += 1;
+  }
+
+  pos = 0;
+  while(R_json_next(val, &pos, &key, &item)) {
+    if(R_TYPE_ISNT(&key, INT) || key.i64 < 0 || key.i64 >= *count) {
+      return false;
+    }
+  }
+
+  return *count > 0;
+}
+
+static bool R_json_write_value(R_json_out *out, R_box *val, uint32_t depth);
+
+static bool R_json_write_table(R_json_out *out, R_box *val, uint32_t depth) {
+  uint32_t count;
+  uint32_t pos = 0;
+  R_box key;
+  R_box item;
+
+  if(R_json_is_array(val, &count)) {
+    R_json_write(out, "[", 1);
+
+    for(uint32_t i=0; i<count; i++) {
+      R_set_int(&key, i);
+      R_box *at = R_TYPE_IS(val, TABLE) ? R_table_get(val, &key) : R_frozen_get(val, &key);
+
+      if(i > 0) {
+        R_json_write(out, ",", 1);
+      }
+
+      if(!R_json_write_value(out, at, depth + 1)) {
+        return false;
+      }
+    }
+
+    R_json_write(out, "]", 1);
+    return true;
+  }
+
+  R_json_write(out, "{", 1);
+
+  for(bool first=true; R_json_next(val, &pos, &key, &item); first=false) {
+    if(!first) {
+      R_json_write(out, ",", 1);
+    }
+
+    // object keys are always strings
+    switch(key.type) {
+      case R_TYPE_STR:
+        R_json_write_str(out, key.str, key.size);
+        break;
+
+      case R_TYPE_INT:
+      case R_TYPE_FLOAT:
+      case R_TYPE_BOOL:
+        R_json_write(out, "\"", 1);
+        R_json_write_value(out, &key, depth + 1);
+        R_json_write(out, "\"", 1);
+        break;
+
+      default:
+        fprintf(stderr, "Unable to encode a key of type %d as JSON\n", key.type);
+        return false;
+    }
+
+    R_json_write(out, ":", 1);
+
+    if(!R_json_write_value(out, &item, depth + 1)) {
+      return false;
+    }
+  }
+
+  R_json_write(out, "}", 1);
+  return true;
+}
+
+static bool R_json_write_value(R_json_out *out, R_box *val, uint32_t depth) {
+  if(depth > R_JSON_DEPTH) {
+    fprintf(stderr, "Unable to encode JSON nested deeper than %d\n", R_JSON_DEPTH);
+    return false;
+  }
+
+  switch(val->type) {
+    case R_TYPE_NULL:
+      R_json_write(out, "null", 4);
+      return true;
+
+    case R_TYPE_BOOL:
+      if(val->u64) {
+        R_json_write(out, "true", 4);
+      }
+      else {
+        R_json_write(out, "false", 5);
+      }
+      return true;
+
+    case R_TYPE_INT:
+      R_json_write_int(out, val->i64);
+      return true;
+
+    case R_TYPE_FLOAT:
+      R_json_write_float(out, val->f64);
+      return true;
+
+    case R_TYPE_STR:
+      R_json_write_str(out, val->str, val->size);
+      return true;
+
+    case R_TYPE_BUF:
+      R_json_write_str(out, ((R_buf *)val->ptr)->data, ((R_buf *)val->ptr)->len);
+      return true;
+
+    case R_TYPE_INTS:
+    case R_TYPE_FLOATS:
+      R_json_write(out, "[", 1);
+
+      for(int32_t i=0; i<val->size; i++) {
+        if(i > 0) {
+          R_json_write(out, ",", 1);
+        }
+
+        if(R_TYPE_IS(val, INTS)) {
+          R_json_write_int(out, val->i64s[i]);
+        }
+        else {
+          R_json_write_float(out, val->f64s[i]);
+        }
+      }
+
+      R_json_write(out, "]", 1);
+      return true;
+
+    case R_TYPE_TABLE:
+    case R_TYPE_FROZEN:
+      return R_json_write_table(out, val, depth);
+  }
+
+  fprintf(stderr, "Unable to encode a value of type %d as JSON\n", val->type);
+  return false;
+}
+
+bool R_json_encode(R_box *ret, R_box *val) {
+  R_json_out *out = &R_json_buf;
+  bool ok;
+
+  out->len = 0;
+  ok = R_json_write_value(out, val, 0);
+
+  if(ok) {
+    ret->type = R_TYPE_STR;
+    ret->str = R_alloc(R_KIND_RAW, out->len + 1);
+    ret->size = out->len;
+    ret->meta = NULL;
+
+    memcpy(ret->str, out->data, out->len);
+    ret->str[out->len] = 0;
+  }
+  else {
+    R_set_null(ret);
+  }
+
+  if(out->max > R_JSON_KEEP) {
+    free(out->data);
+    out->data = NULL;
+    out->max = 0;
+  }
+
+  return ok;
+}
@@ -0,0 +1,13 @@
+#ifndef R_JSON_H
+#define R_JSON_H
+
+#include "core.h"
+#include <stdbool.h>
+
+// nesting deeper than this is rejected, which also catches cycles on encode
+#define R_JSON_DEPTH 1024
+
+bool R_json_decode(R_box *ret, const char *data, size_t len);
+bool R_json_encode(R_box *ret, R_box *val);
+
+#endif
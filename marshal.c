@@ -0,0 +1,682 @@
+#include "rain.h"
+
+#include <string.h>
+
+// marshal
+//
+// the format is close to the values themselves: numbers are stored raw,
+// strings keep their terminating zero and packed arrays are one block of
+// elements, so writing them is a memcpy into the buffer (or straight to the
+// file) and reading them is a memcpy out of it. tables keyed 0 to n-1 are
+// written as lists, which drop the keys and are read into a dictionary
+// that's already big enough for them.
+
+// file writers flush once the buffer holds this much, and write payloads at
+// least this big without copying them into it
+#define R_MARSHAL_CHUNK (256 * 1024)
+
+// buffers and reference maps bigger than this are given back on close
+#define R_MARSHAL_KEEP (16 * 1024 * 1024)
+
+static void R_marshal_flush(R_marshal_out *out) {
+  if(out->file == NULL || out->len == 0) {
+    return;
+  }
+
+  if(fwrite(out->data, 1, out->len, out->file) != out->len && out->ok) {
+    fprintf(stderr, "Unable to write marshal data\n");
+    out->ok = false;
+  }
+
+  out->sent += out->len;
+  out->len = 0;
+}
+
+static inline char *R_marshal_reserve(R_marshal_out *out, size_t size) {
+  if(out->file != NULL && out->len + size > R_MARSHAL_CHUNK) {
+    R_marshal_flush(out);
+  }
+
+  if(out->len + size > out->max) {
+    while(out->len + size > out->max) {
+      out->max = out->max == 0 ? 4096 : out->max * 2;
+    }
+
+    out->data = realloc(out->data, out->max);
+  }
+
+  return out->data + out->len;
+}
+
+static void R_marshal_bytes(R_marshal_out *out, const void *data, size_t size) {
+  if(out->file != NULL && size >= R_MARSHAL_CHUNK) {
+    R_marshal_flush(out);
+
+    if(fwrite(data, 1, size, out->file) != size && out->ok) {
+      fprintf(stderr, "Unable to write marshal data\n");
+      out->ok = false;
+    }
+
+    out->sent += size;
+    return;
+  }
+
+  memcpy(R_marshal_reserve(out, size), data, size);
+  out->len += size;
+}
+
+static inline void R_marshal_tag(R_marshal_out *out, uint8_t tag) {
+  *R_marshal_reserve(out, 1) = tag;
+  out->len += 1;
+}
+
+static inline void R_marshal_u32(R_marshal_out *out, uint32_t val) {
+  memcpy(R_marshal_reserve(out, 4), &val, 4);
+  out->len += 4;
+}
+
+static inline void R_marshal_u64(R_marshal_out *out, uint64_t val) {
+  memcpy(R_marshal_reserve(out, 8), &val, 8);
+  out->len += 8;
+}
+
+static inline uint32_t R_marshal_slot(uintptr_t key, uint32_t max) {
+  return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (max - 1);
+}
+
+// the number of an object that was already written, or -1 after numbering it.
+// keys are offset by one so that zero can mean an empty slot.
+static int64_t R_marshal_number(R_marshal_out *out, const void *ptr) {
+  uintptr_t key = (uintptr_t)ptr + 1;
+
+  if((out->num_refs + 1) * 2 > out->ref_max) {
+    uint32_t old_max = out->ref_max;
+    R_marshal_ref *old = out->refs;
+
+    out->ref_max = old_max == 0 ? 256 : old_max * 2;
+    out->refs = calloc(out->ref_max, sizeof(R_marshal_ref));
+
+    for(uint32_t i=0; i<old_max; i++) {
+      if(old[i].key != 0) {
+        uint32_t idx = R_marshal_slot(old[i].key, out->ref_max);
+        while(out->refs[idx].key != 0) {
+          idx = (idx + 1) & (out->ref_max - 1);
+        }
+
+        out->refs[idx] = old[i];
+      }
+    }
+
+    free(old);
+  }
+
+  uint32_t idx = R_marshal_slot(key, out->ref_max);
+  while(out->refs[idx].key != 0) {
+    if(out->refs[idx].key == key) {
+      return out->refs[idx].num;
+    }
+
+    idx = (idx + 1) & (out->ref_max - 1);
+  }
+
+  out->refs[idx].key = key;
+  out->refs[idx].num = out->num_refs;
+  out->num_refs += 1;
+  return -1;
+}
+
+static bool R_marshal_value(R_marshal_out *out, R_box *val, uint32_t depth);
+
+static bool R_marshal_next(R_box *val, uint32_t *pos, R_box *key, R_box *item) {
+  if(R_TYPE_IS(val, TABLE)) {
+    return R_table_next(val, pos, key, item);
+  }
+
+  return R_frozen_next(val, pos, key, item);
+}
+
+// records only have string keys, so only dictionaries can be lists
+static bool R_marshal_is_list(R_box *val, uint32_t count) {
+  uint32_t pos = 0;
+  R_box key;
+  R_box item;
+
+  if(count == 0 || (R_TYPE_IS(val, TABLE) && val->table->shape != NULL)) {
+    return false;
+  }
+
+  while(R_marshal_next(val, &pos, &key, &item)) {
+    if(R_TYPE_ISNT(&key, INT) || key.i64 < 0 || key.i64 >= count) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// string keys are numbered by address, which records share through their
+// shape. other strings are written out every time, since numbering them all
+// costs more than it saves.
+static bool R_marshal_key(R_marshal_out *out, R_box *key, uint32_t depth) {
+  int64_t ref;
+
+  if(R_TYPE_ISNT(key, STR) || R_has_meta(key)) {
+    return R_marshal_value(out, key, depth);
+  }
+
+  if((ref = R_marshal_number(out, key->str)) >= 0) {
+    R_marshal_tag(out, R_MARSHAL_REF);
+    R_marshal_u32(out, ref);
+    return true;
+  }
+
+  R_marshal_tag(out, R_MARSHAL_NAME);
+  R_marshal_u32(out, key->size);
+  R_marshal_bytes(out, key->str, key->size + 1);
+  return true;
+}
+
+static bool R_marshal_table(R_marshal_out *out, R_box *val, uint8_t meta, uint32_t depth) {
+  bool frozen = R_TYPE_IS(val, FROZEN);
+  uint32_t count = frozen ? ((R_frozen *)val->ptr)->count : val->table->cur;
+  bool list = R_marshal_is_list(val, count);
+  uint32_t pos = 0;
+  R_box key;
+  R_box item;
+
+  R_marshal_tag(out, (list ? R_MARSHAL_LIST : R_MARSHAL_TABLE) | meta);
+  R_marshal_u32(out, count);
+
+  // the meta comes first, so references back to this table from inside it
+  // are read with their meta already set
+  if(meta && !R_marshal_value(out, val->meta, depth + 1)) {
+    return false;
+  }
+
+  if(list) {
+    for(uint32_t i=0; i<count; i++) {
+      R_set_int(&key, i);
+      R_box *at = frozen ? R_frozen_get(val, &key) : R_table_get(val, &key);
+
+      if(!R_marshal_value(out, at, depth + 1)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  while(R_marshal_next(val, &pos, &key, &item)) {
+    if(!R_marshal_key(out, &key, depth + 1) || !R_marshal_value(out, &item, depth + 1)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool R_marshal_value(R_marshal_out *out, R_box *val, uint32_t depth) {
+  uint8_t meta = R_has_meta(val) ? R_MARSHAL_META : 0;
+  const void *obj = NULL;
+  int64_t ref;
+
+  if(depth > R_MARSHAL_DEPTH) {
+    fprintf(stderr, "Unable to marshal values nested deeper than %d\n", R_MARSHAL_DEPTH);
+    return false;
+  }
+
+  switch(val->type) {
+    case R_TYPE_INTS:
+    case R_TYPE_FLOATS:
+    case R_TYPE_TABLE:
+    case R_TYPE_FROZEN:
+      obj = val->ptr;
+      break;
+  }
+
+  if(obj != NULL && (ref = R_marshal_number(out, obj)) >= 0) {
+    R_marshal_tag(out, R_MARSHAL_REF | meta);
+    R_marshal_u32(out, ref);
+    return !meta || R_marshal_value(out, val->meta, depth + 1);
+  }
+
+  switch(val->type) {
+    case R_TYPE_NULL:
+      R_marshal_tag(out, R_MARSHAL_NULL | meta);
+      break;
+
+    case R_TYPE_BOOL:
+      R_marshal_tag(out, (val->u64 ? R_MARSHAL_TRUE : R_MARSHAL_FALSE) | meta);
+      break;
+
+    case R_TYPE_INT:
+      if(val->i64 >= INT32_MIN && val->i64 <= INT32_MAX) {
+        R_marshal_tag(out, R_MARSHAL_INT32 | meta);
+        R_marshal_u32(out, (uint32_t)val->i64);
+      }
+      else {
+        R_marshal_tag(out, R_MARSHAL_INT64 | meta);
+        R_marshal_u64(out, val->u64);
+      }
+      break;
+
+    case R_TYPE_FLOAT:
+      R_marshal_tag(out, R_MARSHAL_FLOAT | meta);
+      R_marshal_u64(out, val->u64);
+      break;
+
+    case R_TYPE_FUNC:
+      R_marshal_tag(out, R_MARSHAL_FUNC | meta);
+      R_marshal_u64(out, val->u64);
+      break;
+
+    case R_TYPE_STR:
+      R_marshal_tag(out, R_MARSHAL_STR | meta);
+      R_marshal_u32(out, val->size);
+      R_marshal_bytes(out, val->str, val->size + 1);
+      break;
+
+    case R_TYPE_BUF:
+      R_marshal_tag(out, R_MARSHAL_STR | meta);
+      R_marshal_u32(out, ((R_buf *)val->ptr)->len);
+      R_marshal_bytes(out, ((R_buf *)val->ptr)->data, ((R_buf *)val->ptr)->len);
+      R_marshal_tag(out, 0);
+      break;
+
+    case R_TYPE_INTS:
+    case R_TYPE_FLOATS:
+      R_marshal_tag(out, (R_TYPE_IS(val, INTS) ? R_MARSHAL_INTS : R_MARSHAL_FLOATS) | meta);
+      R_marshal_u32(out, val->size);
+      R_marshal_bytes(out, val->ptr, sizeof(int64_t) * val->size);
+      break;
+
+    case R_TYPE_TABLE:
+    case R_TYPE_FROZEN:
+      return R_marshal_table(out, val, meta, depth);
+
+    default:
+      fprintf(stderr, "Unable to marshal a value of type %d\n", val->type);
+      return false;
+  }
+
+  return !meta || R_marshal_value(out, val->meta, depth + 1);
+}
+
+void R_marshal_open(R_marshal_out *out, FILE *file) {
+  memset(out, 0, sizeof(R_marshal_out));
+  out->file = file;
+  out->ok = true;
+
+  R_marshal_u32(out, R_MARSHAL_MAGIC);
+  R_marshal_u32(out, R_MARSHAL_VERSION);
+}
+
+// file writers hand each value to the file as soon as it's written
+bool R_marshal_write(R_marshal_out *out, R_box *val) {
+  size_t start = out->len;
+  uint64_t sent = out->sent;
+
+  if(out->num_refs > 0) {
+    memset(out->refs, 0, sizeof(R_marshal_ref) * out->ref_max);
+    out->num_refs = 0;
+  }
+
+  // a value that fails is dropped, unless part of it already went to the file
+  if(!R_marshal_value(out, val, 0)) {
+    if(out->sent != sent) {
+      out->ok = false;
+    }
+
+    out->len = start;
+    return false;
+  }
+
+  R_marshal_flush(out);
+  return out->ok;
+}
+
+// flushes and frees everything but the buffer of a writer without a file
+bool R_marshal_close(R_marshal_out *out) {
+  R_marshal_flush(out);
+
+  if(out->file != NULL) {
+    free(out->data);
+    out->data = NULL;
+    out->max = 0;
+  }
+
+  free(out->refs);
+  out->refs = NULL;
+  out->ref_max = 0;
+  out->num_refs = 0;
+
+  return out->ok;
+}
+
+// the whole stream for one value, as a string
+bool R_marshal(R_box *ret, R_box *val) {
+  static __thread R_marshal_out out;
+  bool ok;
+
+  // keep the buffer and map between calls, like the json encoder
+  out.file = NULL;
+  out.len = 0;
+  out.ok = true;
+  R_marshal_u32(&out, R_MARSHAL_MAGIC);
+  R_marshal_u32(&out, R_MARSHAL_VERSION);
+
+  ok = R_marshal_write(&out, val);
+
+  if(ok) {
+    ret->type = R_TYPE_STR;
+    ret->str = R_alloc(R_KIND_RAW, out.len + 1);
+    ret->size = out.len;
+    ret->meta = NULL;
+
+    memcpy(ret->str, out.data, out.len);
+    ret->str[out.len] = 0;
+  }
+  else {
+    R_set_null(ret);
+  }
+
+  if(out.max > R_MARSHAL_KEEP) {
+    free(out.data);
+    out.data = NULL;
+    out.max = 0;
+  }
+
+  if(out.ref_max > R_MARSHAL_KEEP / sizeof(R_marshal_ref)) {
+    R_marshal_close(&out);
+  }
+
+  return ok;
+}
+
+static bool R_unmarshal_fail(R_marshal_in *in) {
+  if(in->ok) {
+    fprintf(stderr, "Invalid marshal data at byte %zu\n", in->pos);
+    in->ok = false;
+  }
+
+  return false;
+}
+
+static inline bool R_unmarshal_need(R_marshal_in *in, size_t size) {
+  return in->len - in->pos >= size || R_unmarshal_fail(in);
+}
+
+static inline bool R_unmarshal_u32(R_marshal_in *in, uint32_t *val) {
+  if(!R_unmarshal_need(in, 4)) {
+    return false;
+  }
+
+  memcpy(val, in->data + in->pos, 4);
+  in->pos += 4;
+  return true;
+}
+
+static inline bool R_unmarshal_u64(R_marshal_in *in, uint64_t *val) {
+  if(!R_unmarshal_need(in, 8)) {
+    return false;
+  }
+
+  memcpy(val, in->data + in->pos, 8);
+  in->pos += 8;
+  return true;
+}
+
+// numbered values are kept in a heap array, which the Boehm collector scans
+// through the reader, so tables still being filled in stay alive
+static uint32_t R_unmarshal_number(R_marshal_in *in, R_box *val) {
+  if(in->num_refs == in->max_refs) {
+    in->max_refs = in->max_refs == 0 ? 256 : in->max_refs * 2;
+    in->refs = R_realloc(in->refs, R_KIND_BOXES, sizeof(R_box) * in->max_refs);
+  }
+
+  in->refs[in->num_refs] = *val;
+  in->num_refs += 1;
+  return in->num_refs - 1;
+}
+
+static bool R_unmarshal_value(R_marshal_in *in, R_box *ret, uint32_t depth);
+
+// reads a meta into val and, if it has a number, into its numbered copy.
+// a reference whose meta is its original's shares the original's meta box.
+static bool R_unmarshal_meta(R_marshal_in *in, R_box *val, int64_t num, uint32_t depth) {
+  R_box meta;
+
+  if(!R_unmarshal_value(in, &meta, depth + 1)) {
+    return false;
+  }
+
+  R_box *orig = num >= 0 ? in->refs[num].meta : NULL;
+  if(orig != NULL && orig->type == meta.type && orig->u64 == meta.u64) {
+    val->meta = orig;
+    return true;
+  }
+
+  val->meta = R_alloc(R_KIND_BOX, sizeof(R_box));
+  *(val->meta) = meta;
+
+  if(num >= 0 && orig == NULL) {
+    in->refs[num].meta = val->meta;
+  }
+
+  return true;
+}
+
+static bool R_unmarshal_table(R_marshal_in *in, R_box *ret, bool list, bool meta, uint32_t depth) {
+  uint32_t count;
+  R_box key;
+  R_box val;
+
+  if(!R_unmarshal_u32(in, &count)) {
+    return false;
+  }
+
+  // every member takes at least a byte, so don't trust a count that couldn't
+  // fit in what's left
+  if(count > (in->len - in->pos) / (list ? 1 : 2)) {
+    return R_unmarshal_fail(in);
+  }
+
+  if(list) {
+    R_set_table_sized(ret, count * 2 + 2);
+  }
+  else {
+    R_new_table(ret, count);
+  }
+
+  uint32_t num = R_unmarshal_number(in, ret);
+
+  if(meta && !R_unmarshal_meta(in, ret, num, depth)) {
+    return false;
+  }
+
+  for(uint32_t i=0; i<count; i++) {
+    if(list) {
+      R_set_int(&key, i);
+    }
+    else if(!R_unmarshal_value(in, &key, depth + 1)) {
+      return false;
+    }
+
+    if(!R_unmarshal_value(in, &val, depth + 1)) {
+      return false;
+    }
+
+    R_table_set(ret, &key, &val);
+  }
+
+  return true;
+}
+
+static bool R_unmarshal_value(R_marshal_in *in, R_box *ret, uint32_t depth) {
+  uint32_t u32;
+  uint64_t u64;
+  int64_t num = -1;
+
+  R_set_null(ret);
+
+  if(depth > R_MARSHAL_DEPTH || !R_unmarshal_need(in, 1)) {
+    return R_unmarshal_fail(in);
+  }
+
+  uint8_t tag = in->data[in->pos] & ~R_MARSHAL_META;
+  bool meta = in->data[in->pos] & R_MARSHAL_META;
+  in->pos += 1;
+
+  switch(tag) {
+    case R_MARSHAL_NULL:
+      break;
+
+    case R_MARSHAL_FALSE:
+    case R_MARSHAL_TRUE:
+      R_set_bool(ret, tag == R_MARSHAL_TRUE);
+      break;
+
+    case R_MARSHAL_INT32:
+      if(!R_unmarshal_u32(in, &u32)) {
+        return false;
+      }
+      R_set_int(ret, (int32_t)u32);
+      break;
+
+    case R_MARSHAL_INT64:
+    case R_MARSHAL_FLOAT:
+    case R_MARSHAL_FUNC:
+      if(!R_unmarshal_u64(in, &u64)) {
+        return false;
+      }
+      R_set_int(ret, 0);
+      ret->u64 = u64;
+      ret->type = tag == R_MARSHAL_INT64 ? R_TYPE_INT :
+                  tag == R_MARSHAL_FLOAT ? R_TYPE_FLOAT : R_TYPE_FUNC;
+      break;
+
+    case R_MARSHAL_STR:
+    case R_MARSHAL_NAME:
+      if(!R_unmarshal_u32(in, &u32) || !R_unmarshal_need(in, (size_t)u32 + 1)) {
+        return false;
+      }
+
+      if(u32 > INT32_MAX || in->data[in->pos + u32] != 0) {
+        return R_unmarshal_fail(in);
+      }
+
+      ret->type = R_TYPE_STR;
+      ret->str = R_alloc(R_KIND_RAW, u32 + 1);
+      ret->size = u32;
+      memcpy(ret->str, in->data + in->pos, u32 + 1);
+      in->pos += u32 + 1;
+
+      if(tag == R_MARSHAL_NAME) {
+        num = R_unmarshal_number(in, ret);
+      }
+      break;
+
+    case R_MARSHAL_INTS:
+    case R_MARSHAL_FLOATS:
+      if(!R_unmarshal_u32(in, &u32) || !R_unmarshal_need(in, sizeof(int64_t) * u32)) {
+        return false;
+      }
+
+      if(u32 > INT32_MAX) {
+        return R_unmarshal_fail(in);
+      }
+
+      if(tag == R_MARSHAL_INTS) {
+        R_set_ints(ret, u32);
+      }
+      else {
+        R_set_floats(ret, u32);
+      }
+
+      memcpy(ret->ptr, in->data + in->pos, sizeof(int64_t) * u32);
+      in->pos += sizeof(int64_t) * u32;
+      num = R_unmarshal_number(in, ret);
+      break;
+
+    case R_MARSHAL_TABLE:
+    case R_MARSHAL_LIST:
+      return R_unmarshal_table(in, ret, tag == R_MARSHAL_LIST, meta, depth);
+
+    case R_MARSHAL_REF:
+      if(!R_unmarshal_u32(in, &u32)) {
+        return false;
+      }
+
+      if(u32 >= in->num_refs) {
+        return R_unmarshal_fail(in);
+      }
+
+      *ret = in->refs[u32];
+      ret->meta = NULL;
+      num = u32;
+      break;
+
+    default:
+      in->pos -= 1;
+      return R_unmarshal_fail(in);
+  }
+
+  return !meta || R_unmarshal_meta(in, ret, num, depth);
+}
+
+bool R_unmarshal_open(R_marshal_in *in, const char *data, size_t len) {
+  uint32_t magic;
+  uint32_t version;
+
+  memset(in, 0, sizeof(R_marshal_in));
+  in->data = data;
+  in->len = len;
+  in->ok = true;
+
+  if(!R_unmarshal_u32(in, &magic) || !R_unmarshal_u32(in, &version)) {
+    return false;
+  }
+
+  if(magic != R_MARSHAL_MAGIC || version != R_MARSHAL_VERSION) {
+    fprintf(stderr, "Unable to read marshal data: bad magic or version\n");
+    in->ok = false;
+    return false;
+  }
+
+  return true;
+}
+
+// false at the end of the stream as well as on errors, which clear ok
+bool R_unmarshal_next(R_marshal_in *in, R_box *ret) {
+  if(!in->ok || in->pos == in->len) {
+    R_set_null(ret);
+    return false;
+  }
+
+  in->num_refs = 0;
+  if(!R_unmarshal_value(in, ret, 0)) {
+    R_set_null(ret);
+    return false;
+  }
+
+  return true;
+}
+
+void R_unmarshal_close(R_marshal_in *in) {
+  in->refs = NULL;
+  in->num_refs = 0;
+  in->max_refs = 0;
+}
+
+// the first value of a stream
+bool R_unmarshal(R_box *ret, const char *data, size_t len) {
+  R_marshal_in in;
+  bool ok = R_unmarshal_open(&in, data, len) && R_unmarshal_next(&in, ret);
+
+  if(!ok) {
+    R_set_null(ret);
+  }
+
+  R_unmarshal_close(&in);
+  return ok;
+}
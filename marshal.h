@@ -0,0 +1,87 @@
+#ifndef R_MARSHAL_H
+#define R_MARSHAL_H
+
+#include "core.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+// a marshal stream is a header followed by any number of values. each value
+// is a tag byte and its payload, in host byte order. tables, arrays and table
+// keys are numbered in the order they're first written, and written again
+// only as a reference to that number, so shared and cyclic graphs round-trip
+// with the same shape and a key repeated across a million records is written
+// once. numbering starts over with every top-level value.
+//
+// function references are instruction offsets, so they only mean anything to
+// a VM with the same code loaded. frozen tables come back as plain tables.
+
+#define R_MARSHAL_MAGIC   0x4d4d5652 // "RVMM"
+#define R_MARSHAL_VERSION 1
+
+// nesting deeper than this is rejected
+#define R_MARSHAL_DEPTH 1024
+
+#define R_MARSHAL_NULL   0x00
+#define R_MARSHAL_FALSE  0x01
+#define R_MARSHAL_TRUE   0x02
+#define R_MARSHAL_INT32  0x03 // int32
+#define R_MARSHAL_INT64  0x04 // int64
+#define R_MARSHAL_FLOAT  0x05 // float64
+#define R_MARSHAL_STR    0x06 // uint32 length, bytes, a zero byte
+#define R_MARSHAL_NAME   0x07 // a string that's numbered, used for keys
+#define R_MARSHAL_TABLE  0x08 // uint32 count, count keys and values
+#define R_MARSHAL_LIST   0x09 // uint32 count, count values keyed 0 to count-1
+#define R_MARSHAL_INTS   0x0A // uint32 count, count int64s
+#define R_MARSHAL_FLOATS 0x0B // uint32 count, count float64s
+#define R_MARSHAL_FUNC   0x0C // uint64 instruction offset
+#define R_MARSHAL_REF    0x0D // uint32 number of an earlier value
+
+// set on a tag when the value has a meta, which follows the count of a table
+// or list and the whole value otherwise
+#define R_MARSHAL_META   0x80
+
+typedef struct R_marshal_ref {
+  uintptr_t key;
+  uint32_t num;
+} R_marshal_ref;
+
+// a writer appends to its buffer. a writer with a file flushes it after every
+// value or whenever it fills up, and writes payloads bigger than it directly.
+typedef struct R_marshal_out {
+  FILE *file;
+  char *data;
+  size_t len;
+  size_t max;
+  uint64_t sent;
+  bool ok;
+
+  // open addressed map from an object's address to its number
+  R_marshal_ref *refs;
+  uint32_t ref_max;
+  uint32_t num_refs;
+} R_marshal_out;
+
+// a reader works in place over memory it doesn't own, such as a string or a
+// mapped file, which has to stay put until the reader is closed
+typedef struct R_marshal_in {
+  const char *data;
+  size_t len;
+  size_t pos;
+  bool ok;
+
+  R_box *refs;
+  uint32_t num_refs;
+  uint32_t max_refs;
+} R_marshal_in;
+
+void R_marshal_open(R_marshal_out *out, FILE *file);
+bool R_marshal_write(R_marshal_out *out, R_box *val);
+bool R_marshal_close(R_marshal_out *out);
+bool R_marshal(R_box *ret, R_box *val);
+
+bool R_unmarshal_open(R_marshal_in *in, const char *data, size_t len);
+bool R_unmarshal_next(R_marshal_in *in, R_box *ret);
+void R_unmarshal_close(R_marshal_in *in);
+bool R_unmarshal(R_box *ret, const char *data, size_t len);
+
+#endif
@@ -0,0 +1,257 @@
+#include "rain.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// call with the lock held
+static R_fetch *R_prefetch_find(R_prefetch *pre, struct stat *st) {
+  for(R_fetch *fetch = pre->fetches; fetch != NULL; fetch = fetch->next) {
+    if(fetch->dev == st->st_dev && fetch->ino == st->st_ino) {
+      return fetch;
+    }
+  }
+
+  return NULL;
+}
+
+// call with the lock held
+static R_fetch *R_prefetch_add(R_prefetch *pre, const char *path, struct stat *st) {
+  R_fetch *fetch = calloc(1, sizeof(R_fetch));
+  fetch->path = strdup(path);
+  fetch->dev = st->st_dev;
+  fetch->ino = st->st_ino;
+
+  fetch->next = pre->fetches;
+  pre->fetches = fetch;
+
+  return fetch;
+}
+
+// call with the lock held
+static void R_prefetch_push(R_prefetch *pre, R_fetch *fetch) {
+  fetch->queue_next = NULL;
+
+  if(pre->tail == NULL) {
+    pre->head = fetch;
+  }
+  else {
+    pre->tail->queue_next = fetch;
+  }
+
+  pre->tail = fetch;
+}
+
+// call with the lock held
+static R_fetch *R_prefetch_pop(R_prefetch *pre) {
+  R_fetch *fetch = pre->head;
+
+  pre->head = fetch->queue_next;
+  if(pre->head == NULL) {
+    pre->tail = NULL;
+  }
+
+  return fetch;
+}
+
+static void R_prefetch_queue(R_prefetch *pre, const char *path) {
+  size_t len = strlen(path);
+  struct stat st;
+
+  // native modules are loaded with dlopen, and files that aren't there are
+  // left for vm_import to complain about
+  if(len > 3 && strcmp(path + len - 3, ".so") == 0) {
+    return;
+  }
+
+  if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return;
+  }
+
+  pthread_mutex_lock(&pre->lock);
+
+  if(R_prefetch_find(pre, &st) == NULL) {
+    R_prefetch_push(pre, R_prefetch_add(pre, path, &st));
+    pthread_cond_signal(&pre->ready);
+  }
+
+  pthread_mutex_unlock(&pre->lock);
+}
+
+static void *R_prefetch_main(void *arg) {
+  R_prefetch *pre = arg;
+
+  R_prof_block();
+  pthread_mutex_lock(&pre->lock);
+
+  while(true) {
+    while(pre->head == NULL && !pre->stopping) {
+      pthread_cond_wait(&pre->ready, &pre->lock);
+    }
+
+    if(pre->stopping) {
+      break;
+    }
+
+    R_fetch *fetch = R_prefetch_pop(pre);
+    if(fetch->taken) {
+      continue;
+    }
+
+    fetch->busy = true;
+    pthread_mutex_unlock(&pre->lock);
+
+    FILE *fp = fopen(fetch->path, "rb");
+    bool opened = fp != NULL;
+    bool ok = false;
+
+    if(opened) {
+      ok = vm_parse(fp, &fetch->unit);
+      fclose(fp);
+
+      if(ok) {
+        R_prefetch_scan(pre, &fetch->unit);
+      }
+    }
+
+    pthread_mutex_lock(&pre->lock);
+    fetch->busy = false;
+    fetch->done = true;
+    fetch->opened = opened;
+    fetch->ok = ok;
+    pthread_cond_broadcast(&pre->done);
+  }
+
+  pthread_mutex_unlock(&pre->lock);
+
+  return NULL;
+}
+
+R_prefetch *R_prefetch_new(uint32_t threads) {
+  if(threads == 0) {
+    threads = 1;
+  }
+
+  R_prefetch *pre = calloc(1, sizeof(R_prefetch));
+  pthread_mutex_init(&pre->lock, NULL);
+  pthread_cond_init(&pre->ready, NULL);
+  pthread_cond_init(&pre->done, NULL);
+
+  pre->threads = malloc(sizeof(pthread_t) * threads);
+
+  for(uint32_t i=0; i<threads; i++) {
+    if(pthread_create(&pre->threads[i], NULL, R_prefetch_main, pre) != 0) {
+      fprintf(stderr, "Unable to start prefetch thread\n");
+      R_prefetch_free(pre);
+      return NULL;
+    }
+
+    pre->num_threads += 1;
+  }
+
+  return pre;
+}
+
+// queue the modules a parsed unit looks like it will import. the constants
+// still hold string indices at this point.
+void R_prefetch_scan(R_prefetch *pre, R_unit *unit) {
+  for(uint32_t i=0; i<unit->header.num_consts; i++) {
+    R_box *val = &unit->consts[i];
+
+    if(!R_TYPE_IS(val, STR)) {
+      continue;
+    }
+
+    const char *str = unit->chars + unit->offsets[val->u64];
+    size_t len = strlen(str);
+
+    if(len > 4 && strcmp(str + len - 4, ".rnc") == 0) {
+      R_prefetch_queue(pre, str);
+    }
+  }
+
+  for(uint32_t i=0; i+1<unit->header.num_instrs; i++) {
+    R_op *instr = &unit->instrs[i];
+
+    if(R_OP(instr) != PUSH_CONST || R_OP(instr + 1) != IMPORT) {
+      continue;
+    }
+
+    R_box *val = &unit->consts[R_UI(instr)];
+    if(R_TYPE_IS(val, STR)) {
+      R_prefetch_queue(pre, unit->chars + unit->offsets[val->u64]);
+    }
+  }
+}
+
+// hand the parsed unit for fname over to vm_import, waiting for a worker that
+// is still reading it. returns false if the VM should read the file itself:
+// nothing fetched it, or a worker hadn't started on it yet and now won't, or
+// couldn't open it. otherwise ok says whether it parsed; unit is the caller's
+// to free either way.
+bool R_prefetch_take(R_prefetch *pre, const char *fname, R_unit *unit, bool *ok) {
+  struct stat st;
+
+  if(stat(fname, &st) != 0) {
+    return false;
+  }
+
+  pthread_mutex_lock(&pre->lock);
+
+  R_fetch *fetch = R_prefetch_find(pre, &st);
+  if(fetch == NULL) {
+    // keep later scans from queueing a module that's already loaded
+    fetch = R_prefetch_add(pre, fname, &st);
+  }
+
+  if(fetch->taken || (!fetch->busy && !fetch->done)) {
+    fetch->taken = true;
+    pthread_mutex_unlock(&pre->lock);
+    return false;
+  }
+
+  while(fetch->busy) {
+    pthread_cond_wait(&pre->done, &pre->lock);
+  }
+
+  fetch->taken = true;
+  pthread_mutex_unlock(&pre->lock);
+
+  if(!fetch->opened) {
+    return false;
+  }
+
+  *unit = fetch->unit;
+  *ok = fetch->ok;
+  memset(&fetch->unit, 0, sizeof(R_unit));
+
+  return true;
+}
+
+// stop the workers after the files they're reading and drop every unit that
+// wasn't taken
+void R_prefetch_free(R_prefetch *pre) {
+  pthread_mutex_lock(&pre->lock);
+  pre->stopping = true;
+  pthread_cond_broadcast(&pre->ready);
+  pthread_mutex_unlock(&pre->lock);
+
+  for(uint32_t i=0; i<pre->num_threads; i++) {
+    pthread_join(pre->threads[i], NULL);
+  }
+
+  R_fetch *fetch = pre->fetches;
+  while(fetch != NULL) {
+    R_fetch *next = fetch->next;
+    vm_unit_free(&fetch->unit);
+    free(fetch->path);
+    free(fetch);
+    fetch = next;
+  }
+
+  pthread_cond_destroy(&pre->done);
+  pthread_cond_destroy(&pre->ready);
+  pthread_mutex_destroy(&pre->lock);
+  free(pre->threads);
+  free(pre);
+}
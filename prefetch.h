@@ -0,0 +1,52 @@
+#ifndef R_PREFETCH_H
+#define R_PREFETCH_H
+
+#include "vm.h"
+#include <pthread.h>
+#include <stdbool.h>
+
+// a module file the prefetcher has seen, keyed by its file identity so
+// different paths to the same file are read once. a worker parses it into
+// unit unless vm_import takes it first.
+typedef struct R_fetch {
+  char *path;
+  uint64_t dev;
+  uint64_t ino;
+
+  bool taken;  // vm_import has claimed it
+  bool busy;   // a worker is reading it
+  bool done;   // the worker has finished
+  bool opened; // the worker could open the file
+  bool ok;     // and parse it
+  R_unit unit;
+
+  struct R_fetch *next;
+  struct R_fetch *queue_next;
+} R_fetch;
+
+// reads and validates the modules a program is going to import on a pool of
+// threads while the VM is busy with others. when a module is loaded, the
+// constants it pushes right before an IMPORT and every other string constant
+// that names a .rnc file are queued, so a worker gets to a module's imports
+// (and theirs) before its body asks for them. vm_import then only has to
+// splice the parsed unit into the VM. workers never touch the heap.
+typedef struct R_prefetch {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_cond_t done;
+
+  R_fetch *fetches;
+  R_fetch *head;
+  R_fetch *tail;
+  bool stopping;
+
+  uint32_t num_threads;
+  pthread_t *threads;
+} R_prefetch;
+
+R_prefetch *R_prefetch_new(uint32_t threads);
+void R_prefetch_scan(R_prefetch *pre, R_unit *unit);
+bool R_prefetch_take(R_prefetch *pre, const char *fname, R_unit *unit, bool *ok);
+void R_prefetch_free(R_prefetch *pre);
+
+#endif
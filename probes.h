@@ -0,0 +1,43 @@
+#ifndef R_PROBES_H
+#define R_PROBES_H
+
+// USDT probes under the provider "rain", for attaching bpftrace, perf or
+// systemtap to a running VM:
+//
+//   call(vm, to, argc)              a frame is pushed for a call to instruction to
+//   return(vm, return_to)           it's popped, returning to return_to
+//   cfunc(vm, fn, argc)             a C function is called
+//   import(vm, path, start)         a module is loaded at instruction start
+//   table__resize(table, old, new)  a dictionary grows from old to new buckets
+//   gc__start(collections)          a collection begins
+//   gc__done(collections, pause)    it ends after pause ns
+//
+// instructions are indices, as in the matching events of trace.h.
+// eg. bpftrace -e 'usdt:./librain.so:rain:import { printf("%s\n", str(arg1)); }'
+//
+// each probe compiles to a nop plus a note describing where its arguments
+// are, and a tracer patches the nop while it's attached. without
+// <sys/sdt.h>, or built with -DR_NO_PROBES, they compile to nothing.
+
+#if !defined(R_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define R_PROBES
+#endif
+#endif
+
+#ifdef R_PROBES
+
+#define R_PROBE1(name, a) DTRACE_PROBE1(rain, name, a)
+#define R_PROBE2(name, a, b) DTRACE_PROBE2(rain, name, a, b)
+#define R_PROBE3(name, a, b, c) DTRACE_PROBE3(rain, name, a, b, c)
+
+#else
+
+#define R_PROBE1(name, a) do {} while(0)
+#define R_PROBE2(name, a, b) do {} while(0)
+#define R_PROBE3(name, a, b, c) do {} while(0)
+
+#endif
+
+#endif
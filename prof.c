@@ -0,0 +1,495 @@
+#include "rain.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// sampling profiler
+//
+// SIGPROF records instr_ptr and the return addresses of every frame into a
+// single producer / single consumer ring. a background thread drains the ring
+// and counts identical stacks; symbolization to function names happens once,
+// when the profile is written as folded stacks.
+
+#define R_PROF_GC UINT32_MAX
+
+typedef struct R_sample {
+  uint32_t depth;
+  uint32_t pcs[R_PROF_DEPTH];
+} R_sample;
+
+typedef struct R_stack {
+  uint64_t hash;
+  uint64_t count;
+  uint32_t depth;
+  uint32_t *pcs;
+} R_stack;
+
+static R_vm *R_prof_vm;
+static R_sample R_prof_ring[R_PROF_RING];
+static atomic_uint R_prof_head;
+static atomic_uint R_prof_tail;
+static atomic_ulong R_prof_dropped;
+static atomic_bool R_prof_running;
+static pthread_t R_prof_thread;
+
+static R_stack *R_prof_stacks;
+static size_t R_prof_cur;
+static size_t R_prof_max;
+
+static void R_prof_signal(int sig) {
+  R_vm *vm = R_prof_vm;
+  unsigned head = atomic_load_explicit(&R_prof_head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&R_prof_tail, memory_order_acquire);
+
+  if(vm == NULL) {
+    return;
+  }
+
+  if(head - tail >= R_PROF_RING) {
+    atomic_fetch_add_explicit(&R_prof_dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  R_sample *sample = &R_prof_ring[head % R_PROF_RING];
+  uint32_t frames = vm->frame_ptr;
+  uint32_t skip = frames + 2 > R_PROF_DEPTH ? frames + 2 - R_PROF_DEPTH : 0;
+  uint32_t depth = 0;
+
+  // the caller of frame i is the function of frame i - 1, so frame 0's
+  // return address (the host) is never recorded
+  for(uint32_t i=skip + 1; i<frames; i++) {
+    sample->pcs[depth++] = vm->frames[i].return_to;
+  }
+
+  sample->pcs[depth++] = vm->instr_ptr;
+  if(R_heap_collecting) {
+    sample->pcs[depth++] = R_PROF_GC;
+  }
+
+  sample->depth = depth;
+
+  atomic_store_explicit(&R_prof_head, head + 1, memory_order_release);
+}
+
+static uint64_t R_prof_hash(uint32_t *pcs, uint32_t depth) {
+  uint64_t hash = 5381;
+
+  for(uint32_t i=0; i<depth; i++) {
+    hash = (hash ^ pcs[i]) * 0x100000001B3ull;
+  }
+
+  return hash;
+}
+
+static void R_prof_count(uint32_t *pcs, uint32_t depth, uint64_t count);
+
+static void R_prof_grow() {
+  R_stack *prev = R_prof_stacks;
+  size_t prev_max = R_prof_max;
+
+  R_prof_max = prev_max == 0 ? 256 : prev_max * 2;
+  R_prof_stacks = calloc(R_prof_max, sizeof(R_stack));
+  R_prof_cur = 0;
+
+  for(size_t i=0; i<prev_max; i++) {
+    if(prev[i].pcs != NULL) {
+      size_t idx = prev[i].hash & (R_prof_max - 1);
+      while(R_prof_stacks[idx].pcs != NULL) {
+        idx = (idx + 1) & (R_prof_max - 1);
+      }
+
+      R_prof_stacks[idx] = prev[i];
+      R_prof_cur += 1;
+    }
+  }
+
+  free(prev);
+}
+
+static void R_prof_count(uint32_t *pcs, uint32_t depth, uint64_t count) {
+  if((R_prof_cur + 1) * 2 > R_prof_max) {
+    R_prof_grow();
+  }
+
+  uint64_t hash = R_prof_hash(pcs, depth);
+  size_t idx = hash & (R_prof_max - 1);
+
+  while(R_prof_stacks[idx].pcs != NULL) {
+    R_stack *stack = &R_prof_stacks[idx];
+    if(stack->hash == hash && stack->depth == depth &&
+       memcmp(stack->pcs, pcs, sizeof(uint32_t) * depth) == 0) {
+      stack->count += count;
+      return;
+    }
+
+    idx = (idx + 1) & (R_prof_max - 1);
+  }
+
+  R_prof_stacks[idx].hash = hash;
+  R_prof_stacks[idx].count = count;
+  R_prof_stacks[idx].depth = depth;
+  R_prof_stacks[idx].pcs = malloc(sizeof(uint32_t) * depth);
+  memcpy(R_prof_stacks[idx].pcs, pcs, sizeof(uint32_t) * depth);
+  R_prof_cur += 1;
+}
+
+static void R_prof_drain() {
+  unsigned tail = atomic_load_explicit(&R_prof_tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&R_prof_head, memory_order_acquire);
+
+  while(tail != head) {
+    R_sample *sample = &R_prof_ring[tail % R_PROF_RING];
+    R_prof_count(sample->pcs, sample->depth, 1);
+    tail += 1;
+  }
+
+  atomic_store_explicit(&R_prof_tail, tail, memory_order_release);
+}
+
+// the ring only has one producer, the thread running the VM, so every other
+// thread the process starts has to call this before SIGPROF can land on it
+void R_prof_block(void) {
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+static void *R_prof_main(void *arg) {
+  R_prof_block();
+
+  while(atomic_load(&R_prof_running)) {
+    R_prof_drain();
+    usleep(50000);
+  }
+
+  return NULL;
+}
+
+bool vm_prof_start(R_vm *this, int hz) {
+  struct sigaction sa;
+  struct itimerval timer;
+
+  if(R_prof_vm != NULL) {
+    fprintf(stderr, "Profiler already running\n");
+    return false;
+  }
+
+  R_prof_vm = this;
+  atomic_store(&R_prof_running, true);
+
+  if(pthread_create(&R_prof_thread, NULL, R_prof_main, NULL) != 0) {
+    fprintf(stderr, "Unable to start profiler thread\n");
+    atomic_store(&R_prof_running, false);
+    R_prof_vm = NULL;
+    return false;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = R_prof_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 1000000 / hz;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, NULL);
+
+  return true;
+}
+
+// the entry point of the function containing an instruction: the closest
+// preceding module start, FUNC constant or CALLTO target
+uint32_t vm_func_entry(R_vm *this, uint32_t instr) {
+  uint32_t best = 0;
+
+  for(uint32_t i=0; i<this->num_modules; i++) {
+    uint32_t start = this->modules[i].start;
+    if(start <= instr && start > best) {
+      best = start;
+    }
+  }
+
+  for(uint32_t i=0; i<this->num_consts; i++) {
+    if(R_TYPE_IS(&this->consts[i], FUNC)) {
+      uint32_t start = this->consts[i].u64;
+      if(start <= instr && start > best) {
+        best = start;
+      }
+    }
+  }
+
+  for(uint32_t i=0; i<this->num_instrs; i++) {
+    R_op *op = vm_stack_instr(this, i);
+    if(R_OP(op) == CALLTO) {
+      uint32_t start = R_UI(op);
+      if(start <= instr && start > best) {
+        best = start;
+      }
+    }
+  }
+
+  return best;
+}
+
+// modules are named after their file; functions after the name they're
+// first stored under (PUSH_CONST func, PUSH_CONST name, ..., SET) in the
+// stack code, whether or not it was translated to register ops
+void vm_func_name(R_vm *this, uint32_t entry, char *buf, size_t size) {
+  for(uint32_t i=0; i<this->num_modules; i++) {
+    if(this->modules[i].start == entry) {
+      const char *base = strrchr(this->modules[i].path, '/');
+      snprintf(buf, size, "%s", base != NULL ? base + 1 : this->modules[i].path);
+      return;
+    }
+  }
+
+  for(uint32_t i=0; i + 2 < this->num_instrs; i++) {
+    R_op *op = vm_stack_instr(this, i);
+    R_op *next = vm_stack_instr(this, i + 1);
+
+    if(R_OP(op) != PUSH_CONST || R_OP(next) != PUSH_CONST) {
+      continue;
+    }
+
+    R_box *func = &this->consts[R_UI(op)];
+    R_box *name = &this->consts[R_UI(next)];
+    if(R_TYPE_ISNT(func, FUNC) || func->u64 != entry || R_TYPE_ISNT(name, STR)) {
+      continue;
+    }
+
+    for(uint32_t j=i + 2; j < i + 6 && j < this->num_instrs; j++) {
+      if(R_OP(vm_stack_instr(this, j)) == SET) {
+        snprintf(buf, size, "%s", name->str);
+        return;
+      }
+    }
+  }
+
+  snprintf(buf, size, "func_%04x", entry);
+}
+
+static int R_prof_cmp(const void *lhs, const void *rhs) {
+  return strcmp(*(char **)lhs, *(char **)rhs);
+}
+
+bool vm_prof_stop(R_vm *this, const char *path) {
+  struct itimerval timer;
+
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  signal(SIGPROF, SIG_IGN);
+
+  atomic_store(&R_prof_running, false);
+  pthread_join(R_prof_thread, NULL);
+  R_prof_drain();
+  R_prof_vm = NULL;
+
+  FILE *out = fopen(path, "w");
+  if(out == NULL) {
+    fprintf(stderr, "Unable to open file %s\n", path);
+    return false;
+  }
+
+  // symbolize every stack into a line, then merge stacks that only differed
+  // by instruction offsets within the same functions
+  char **lines = malloc(sizeof(char *) * (R_prof_cur + 1));
+  size_t num_lines = 0;
+  char name[256];
+
+  for(size_t i=0; i<R_prof_max; i++) {
+    R_stack *stack = &R_prof_stacks[i];
+    if(stack->pcs == NULL) {
+      continue;
+    }
+
+    size_t len = 0;
+    char *line = malloc(stack->depth * sizeof(name) + 32);
+
+    for(uint32_t j=0; j<stack->depth; j++) {
+      if(stack->pcs[j] == R_PROF_GC) {
+        snprintf(name, sizeof(name), "[gc]");
+      }
+      else if(stack->pcs[j] >= this->num_instrs) {
+        snprintf(name, sizeof(name), "[host]");
+      }
+      else {
+        vm_func_name(this, vm_func_entry(this, stack->pcs[j]), name, sizeof(name));
+      }
+
+      len += sprintf(line + len, j == 0 ? "%s" : ";%s", name);
+    }
+
+    // stash the count after the terminator so sorting keeps them together
+    memcpy(line + len + 1, &stack->count, sizeof(uint64_t));
+    lines[num_lines++] = line;
+
+    free(stack->pcs);
+    stack->pcs = NULL;
+  }
+
+  qsort(lines, num_lines, sizeof(char *), R_prof_cmp);
+
+  for(size_t i=0; i<num_lines; ) {
+    uint64_t total = 0;
+    size_t j = i;
+
+    for(; j<num_lines && strcmp(lines[i], lines[j]) == 0; j++) {
+      uint64_t count;
+      memcpy(&count, lines[j] + strlen(lines[j]) + 1, sizeof(uint64_t));
+      total += count;
+    }
+
+    fprintf(out, "%s %lu\n", lines[i], (unsigned long)total);
+
+    for(; i<j; i++) {
+      free(lines[i]);
+    }
+  }
+
+  unsigned long dropped = atomic_load(&R_prof_dropped);
+  if(dropped > 0) {
+    fprintf(stderr, "Profiler dropped %lu samples\n", dropped);
+  }
+
+  free(lines);
+  fclose(out);
+
+  R_prof_cur = 0;
+  return true;
+}
+
+// allocation profiler
+//
+// every allocation is charged to the instruction being executed. calls into
+// cfuncs keep instr_ptr on their CALL, so builtins are charged to their call
+// site; natively compiled modules only update instr_ptr around calls.
+
+void vm_alloc_prof_start(R_vm *this) {
+  this->alloc_prof = calloc(1, sizeof(R_alloc_prof));
+}
+
+void vm_alloc_prof_charge(R_vm *this, size_t size) {
+  R_alloc_prof *prof = this->alloc_prof;
+  R_alloc_site *site = &prof->outside;
+  uint32_t at = this->instr_ptr;
+
+  if(at < this->num_instrs) {
+    if(at >= prof->num_sites) {
+      uint32_t want = this->num_instrs;
+      R_alloc_site *sites = realloc(prof->sites, sizeof(R_alloc_site) * want);
+      if(sites == NULL) {
+        return;
+      }
+
+      memset(sites + prof->num_sites, 0, sizeof(R_alloc_site) * (want - prof->num_sites));
+      prof->sites = sites;
+      prof->num_sites = want;
+    }
+
+    site = &prof->sites[at];
+  }
+
+  site->count += 1;
+  site->bytes += size;
+}
+
+typedef struct R_alloc_rank {
+  uint32_t at;
+  uint64_t count;
+  uint64_t bytes;
+} R_alloc_rank;
+
+static int R_alloc_rank_cmp(const void *lhs, const void *rhs) {
+  const R_alloc_rank *a = lhs;
+  const R_alloc_rank *b = rhs;
+
+  if(a->bytes != b->bytes) {
+    return a->bytes < b->bytes ? 1 : -1;
+  }
+
+  return a->at < b->at ? -1 : a->at > b->at;
+}
+
+void vm_alloc_prof_report(R_vm *this, FILE *out, int top) {
+  R_alloc_prof *prof = this->alloc_prof;
+  char name[256];
+
+  if(prof == NULL) {
+    return;
+  }
+
+  uint32_t num_sites = 0;
+  R_alloc_rank *sites = malloc(sizeof(R_alloc_rank) * (prof->num_sites + 1));
+  R_alloc_rank *funcs = malloc(sizeof(R_alloc_rank) * (prof->num_sites + 1));
+  uint32_t num_funcs = 0;
+
+  for(uint32_t i=0; i<prof->num_sites; i++) {
+    if(prof->sites[i].count == 0) {
+      continue;
+    }
+
+    sites[num_sites].at = i;
+    sites[num_sites].count = prof->sites[i].count;
+    sites[num_sites].bytes = prof->sites[i].bytes;
+    num_sites += 1;
+
+    // sites are visited in order, so a function's sites are mostly adjacent
+    uint32_t entry = vm_func_entry(this, i);
+    uint32_t j = num_funcs;
+    while(j > 0 && funcs[j - 1].at != entry) {
+      j -= 1;
+    }
+
+    if(j == 0) {
+      funcs[num_funcs].at = entry;
+      funcs[num_funcs].count = 0;
+      funcs[num_funcs].bytes = 0;
+      j = ++num_funcs;
+    }
+
+    funcs[j - 1].count += prof->sites[i].count;
+    funcs[j - 1].bytes += prof->sites[i].bytes;
+  }
+
+  qsort(sites, num_sites, sizeof(R_alloc_rank), R_alloc_rank_cmp);
+  qsort(funcs, num_funcs, sizeof(R_alloc_rank), R_alloc_rank_cmp);
+
+  fprintf(out, "Allocations by function:\n");
+  fprintf(out, "%14s %12s  %s\n", "bytes", "count", "function");
+  for(uint32_t i=0; i<num_funcs; i++) {
+    vm_func_name(this, funcs[i].at, name, sizeof(name));
+    fprintf(out, "%14lu %12lu  %s\n", (unsigned long)funcs[i].bytes,
+            (unsigned long)funcs[i].count, name);
+  }
+
+  if(prof->outside.count > 0) {
+    fprintf(out, "%14lu %12lu  (outside)\n", (unsigned long)prof->outside.bytes,
+            (unsigned long)prof->outside.count);
+  }
+
+  fprintf(out, "\nTop allocation sites:\n");
+  for(uint32_t i=0; i<num_sites && i<(uint32_t)top; i++) {
+    uint32_t at = sites[i].at;
+    uint32_t entry = vm_func_entry(this, at);
+
+    vm_func_name(this, entry, name, sizeof(name));
+    fprintf(out, "%14lu %12lu  %s+%u\n", (unsigned long)sites[i].bytes,
+            (unsigned long)sites[i].count, name, at - entry);
+
+    // the instructions leading up to the site usually say what it builds
+    for(uint32_t j=(at >= entry + 2 ? at - 2 : entry); j<=at; j++) {
+      fprintf(out, "%28s %04x  ", j == at ? "->" : "", j);
+      R_op_fprint(out, vm_stack_instr(this, j));
+    }
+  }
+
+  free(sites);
+  free(funcs);
+}
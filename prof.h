@@ -0,0 +1,35 @@
+#ifndef R_PROF_H
+#define R_PROF_H
+
+#include "vm.h"
+#include <stdbool.h>
+
+#define R_PROF_HZ    99
+#define R_PROF_DEPTH 64
+#define R_PROF_RING  1024
+#define R_PROF_SITES 20
+
+typedef struct R_alloc_site {
+  uint64_t count;
+  uint64_t bytes;
+} R_alloc_site;
+
+// allocation counters indexed by instruction; anything allocated while no
+// instruction is executing (loading, imports) is charged to outside
+typedef struct R_alloc_prof {
+  uint32_t num_sites;
+  R_alloc_site *sites;
+  R_alloc_site outside;
+} R_alloc_prof;
+
+void R_prof_block(void);
+bool vm_prof_start(R_vm *this, int hz);
+bool vm_prof_stop(R_vm *this, const char *path);
+uint32_t vm_func_entry(R_vm *this, uint32_t instr);
+void vm_func_name(R_vm *this, uint32_t entry, char *buf, size_t size);
+
+void vm_alloc_prof_start(R_vm *this);
+void vm_alloc_prof_charge(R_vm *this, size_t size);
+void vm_alloc_prof_report(R_vm *this, FILE *out, int top);
+
+#endif
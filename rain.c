@@ -1,20 +1,295 @@
 #include "rain.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [OPTIONS] FILE\n", name);
+  fprintf(stderr, "       %s [OPTIONS] --fork-server SOCKET [MODULE...]\n", name);
+  fprintf(stderr, "       %s [OPTIONS] --worker [--length-prefixed] [--socket PATH] MODULE [HANDLER]\n", name);
+  fprintf(stderr, "       %s [OPTIONS] --sched THREADS FILE...\n", name);
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  --profile OUT        sample the run and write folded stacks to OUT\n");
+  fprintf(stderr, "  --trace OUT          record an event trace, written to OUT on exit, SIGUSR1 or crash\n");
+  fprintf(stderr, "  --alloc              report the top allocation sites on exit\n");
+  fprintf(stderr, "  --no-regs            run plain stack code without translating it to registers\n");
+  fprintf(stderr, "  --snapshot OUT       write the VM to a snapshot image OUT once the run is done\n");
+  fprintf(stderr, "  --from-snapshot IMG  start from the VM in IMG instead of an empty one\n");
+  fprintf(stderr, "  --prefetch THREADS   read imported modules ahead of time on THREADS threads\n");
+}
+
+// more than this is almost certainly a typo
+#define R_MAX_THREADS 1024
+
+// parse a thread count, or return 0 if it isn't a whole number from 1 to
+// R_MAX_THREADS
+static uint32_t parse_threads(const char *str) {
+  char *end;
+
+  errno = 0;
+  long threads = strtol(str, &end, 10);
+
+  if(errno != 0 || end == str || *end != 0 || threads <= 0 || threads > R_MAX_THREADS) {
+    return 0;
+  }
+
+  return threads;
+}
+
+// the first task runs the VM main owns; the rest were made by run_sched
+static void free_tasks(R_task *tasks, int count) {
+  for(int i=1; i<count; i++) {
+    if(tasks[i].vm != NULL) {
+      vm_free(tasks[i].vm);
+    }
+  }
+
+  free(tasks);
+}
+
+// run every file in its own VM, time sliced across a pool of threads, and
+// report what each one cost. the options only apply to the first VM.
+static int run_sched(R_vm *this, uint32_t threads, char **files, int count) {
+  R_task *tasks = calloc(count, sizeof(R_task));
+
+  for(int i=0; i<count; i++) {
+    tasks[i].vm = i == 0 ? this : vm_new();
+    if(tasks[i].vm == NULL) {
+      fprintf(stderr, "Unable to create VM\n");
+      free_tasks(tasks, count);
+      return 1;
+    }
+
+    tasks[i].vm->use_regs = this->use_regs;
+
+    if(!vm_import(tasks[i].vm, files[i])) {
+      free_tasks(tasks, count);
+      return 1;
+    }
+  }
+
+  R_sched *sched = R_sched_new(threads, 0, R_SCHED_SLICE_US);
+  if(sched == NULL) {
+    free_tasks(tasks, count);
+    return 1;
+  }
+
+  for(int i=0; i<count; i++) {
+    R_sched_add(sched, tasks + i);
+  }
+
+  R_sched_wait(sched);
+  R_sched_free(sched);
+  fflush(stdout);
+
+  int rv = 0;
+  for(int i=0; i<count; i++) {
+    R_vm *vm = tasks[i].vm;
+
+    fprintf(stderr, "%s: %s, %lu instrs in %lu slices, %.3f ms cpu, %.3f ms latency\n",
+            files[i], tasks[i].status == R_RUN_DONE ? "done" : "failed",
+            vm->run_instrs, vm->run_slices, vm->run_cpu_ns / 1e6,
+            (tasks[i].done_ns - tasks[i].added_ns) / 1e6);
+
+    if(tasks[i].status != R_RUN_DONE) {
+      rv = 1;
+    }
+  }
+
+  free_tasks(tasks, count);
+  return rv;
+}
+
+static int run(R_vm *this, int argv, char **argc, int arg) {
+  if(strcmp(argc[arg], "--fork-server") == 0) {
+    if(arg + 1 >= argv) {
+      usage(argc[0]);
+      return 1;
+    }
+
+    // warm the VM up before forking children off of it
+    for(int i=arg+2; i<argv; i++) {
+      if(!vm_run_file(this, argc[i])) {
+        return 1;
+      }
+    }
+
+    // children don't get the prefetch threads, only their state
+    if(this->prefetch != NULL) {
+      R_prefetch_free(this->prefetch);
+      this->prefetch = NULL;
+    }
+
+    return vm_serve_fork(this, argc[arg + 1]) ? 0 : 1;
+  }
+
+  if(strcmp(argc[arg], "--worker") == 0) {
+    R_worker worker = {.handler = "handle"};
+    int i = arg + 1;
+
+    for(; i<argv && strncmp(argc[i], "--", 2) == 0; i++) {
+      if(strcmp(argc[i], "--length-prefixed") == 0) {
+        worker.length_prefixed = true;
+      }
+      else if(strcmp(argc[i], "--socket") == 0 && i + 1 < argv) {
+        worker.socket = argc[++i];
+      }
+      else {
+        usage(argc[0]);
+        return 1;
+      }
+    }
+
+    if(i >= argv) {
+      usage(argc[0]);
+      return 1;
+    }
+
+    worker.module = argc[i];
+    if(i + 1 < argv) {
+      worker.handler = argc[i + 1];
+    }
+
+    return vm_serve_worker(this, &worker) ? 0 : 1;
+  }
+
+  if(strcmp(argc[arg], "--sched") == 0) {
+    if(arg + 2 >= argv) {
+      usage(argc[0]);
+      return 1;
+    }
+
+    uint32_t threads = parse_threads(argc[arg + 1]);
+    if(threads == 0) {
+      usage(argc[0]);
+      return 1;
+    }
+
+    return run_sched(this, threads, argc + arg + 2, argv - arg - 2);
+  }
+
+  vm_import(this, argc[arg]);
+  vm_run(this);
+
+  return 0;
+}
 
 int main(int argv, char **argc) {
-  if(argv < 2) {
-    fprintf(stderr, "Usage: %s FILE\n", argc[0]);
+  const char *profile = NULL;
+  const char *trace = NULL;
+  const char *snapshot = NULL;
+  const char *from_snapshot = NULL;
+  bool alloc = false;
+  bool regs = true;
+  uint32_t prefetch = 0;
+  int arg = 1;
+
+  for(; arg<argv && arg+1<argv; arg++) {
+    if(strcmp(argc[arg], "--alloc") == 0) {
+      alloc = true;
+    }
+    else if(strcmp(argc[arg], "--no-regs") == 0) {
+      regs = false;
+    }
+    else if(strcmp(argc[arg], "--profile") == 0) {
+      profile = argc[++arg];
+    }
+    else if(strcmp(argc[arg], "--trace") == 0) {
+      trace = argc[++arg];
+    }
+    else if(strcmp(argc[arg], "--snapshot") == 0) {
+      snapshot = argc[++arg];
+    }
+    else if(strcmp(argc[arg], "--from-snapshot") == 0) {
+      from_snapshot = argc[++arg];
+    }
+    else if(strcmp(argc[arg], "--prefetch") == 0) {
+      prefetch = parse_threads(argc[++arg]);
+      if(prefetch == 0) {
+        usage(argc[0]);
+        return 1;
+      }
+    }
+    else {
+      break;
+    }
+  }
+
+  if(arg >= argv) {
+    usage(argc[0]);
+    return 1;
+  }
+
+  // the profiler samples the VM main runs, and scheduled tasks run theirs on
+  // threads that never take SIGPROF
+  if(profile != NULL && strcmp(argc[arg], "--sched") == 0) {
+    fprintf(stderr, "--profile can't be used with --sched\n");
     return 1;
   }
 
-  R_vm *this = vm_new();
+  // a restored VM already has its modules loaded and initialized, so the
+  // program only pays for what it does after importing them
+  R_vm *this = from_snapshot != NULL ? vm_restore(from_snapshot) : vm_new();
   if(this == NULL) {
     fprintf(stderr, "Unable to create VM\n");
     return 1;
   }
 
-  vm_import(this, argc[1]);
-  vm_run(this);
+  this->use_regs = regs;
 
-  return 0;
+  if(prefetch > 0) {
+    this->prefetch = R_prefetch_new(prefetch);
+    if(this->prefetch == NULL) {
+      return 1;
+    }
+  }
+
+  if(trace != NULL && !vm_trace_enable(this, R_TRACE_EVENTS, trace)) {
+    return 1;
+  }
+
+  if(profile != NULL && !vm_prof_start(this, R_PROF_HZ)) {
+    return 1;
+  }
+
+  if(alloc) {
+    vm_alloc_prof_start(this);
+  }
+
+  int rv = run(this, argv, argc, arg);
+
+  if(this->prefetch != NULL) {
+    R_prefetch_free(this->prefetch);
+    this->prefetch = NULL;
+  }
+
+  if(rv == 0 && snapshot != NULL && !vm_snapshot(this, snapshot)) {
+    rv = 1;
+  }
+
+  if(profile != NULL && !vm_prof_stop(this, profile)) {
+    rv = 1;
+  }
+
+  if(alloc) {
+    fflush(stdout);
+    vm_alloc_prof_report(this, stderr, R_PROF_SITES);
+  }
+
+  if(trace != NULL) {
+    int fd = open(trace, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0 || !vm_trace_dump(this, fd)) {
+      fprintf(stderr, "Unable to write trace %s\n", trace);
+      rv = 1;
+    }
+
+    if(fd >= 0) {
+      close(fd);
+    }
+  }
+
+  return rv;
 }
@@ -1,7 +1,19 @@
-#include <gc.h>
-//#define GC_malloc malloc
 #include "core.h"
+#include "heap.h"
 #include "instr.h"
 #include "table.h"
+#include "array.h"
+#include "buffer.h"
+#include "frozen.h"
+#include "json.h"
+#include "marshal.h"
 #include "vm.h"
+#include "regs.h"
 #include "builtins.h"
+#include "serve.h"
+#include "scheduler.h"
+#include "prefetch.h"
+#include "snapshot.h"
+#include "prof.h"
+#include "trace.h"
+#include "probes.h"
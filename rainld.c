@@ -0,0 +1,1041 @@
+#include "rain.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// links a module and every module it statically imports into one image that
+// loads like a single module:
+//
+//   rainld [--bind] main.rnc main.img
+//   rain main.img
+//
+// an import is static when its path is a constant pushed right before IMPORT.
+// paths are resolved from where rainld runs, as rain would from there. each
+// such module is linked once, however many places import it, and the import
+// becomes an IMPORT_AT of the instruction its body starts at, so the module
+// is still initialized on first use but never looked up on disk. strings and
+// constants are shared between modules, and code that can't be reached from
+// the root module's body, like functions nothing refers to, is dropped.
+//
+// with --bind, a module whose body builds a table from constant functions and
+// saves it exports those functions, and a GET of one of them straight from an
+// import of the module is bound to the function itself: no lookup, and a call
+// of it with no arguments becomes a CALLTO. that assumes an exported name is
+// never replaced. rainld checks for stores under a constant key, but not
+// computed keys, builtins like merge that fill a table, or code loaded at
+// runtime, so it's only safe for programs known not to do that. without it
+// every GET is left as it is.
+
+// abstract values for following the stack through straight-line code
+#define R_LD_OTHER  0
+#define R_LD_CONST  1 // num is a constant index
+#define R_LD_SCOPE  2 // the frame's scope
+#define R_LD_TABLE  3 // num is a table made by PUSH_TABLE in this run
+#define R_LD_MODULE 4 // num is the module index of a static import's value
+
+#define R_LD_STACK   256
+#define R_LD_TABLES  64
+#define R_LD_ENTRIES 1024
+
+// stores to the scope are kept under this table number
+#define R_LD_IN_SCOPE R_LD_TABLES
+
+#define R_LD_NONE UINT32_MAX
+
+typedef struct R_ld_val {
+  uint8_t kind;
+  uint32_t num;
+} R_ld_val;
+
+typedef struct R_ld_entry {
+  uint32_t table;
+  uint32_t name; // constant index of a string
+  uint32_t set; // the SET instruction that stored it
+  R_ld_val val;
+} R_ld_entry;
+
+typedef struct R_ld_sim {
+  R_ld_val stack[R_LD_STACK];
+  uint32_t depth;
+
+  R_ld_entry entries[R_LD_ENTRIES];
+  uint32_t num_entries;
+
+  bool tainted[R_LD_TABLES];
+  uint32_t num_tables;
+
+  // the scope may be written by code we can't see
+  bool escaped;
+} R_ld_sim;
+
+typedef struct R_ld_module {
+  uint32_t start;
+  uint32_t count;
+  uint64_t dev;
+  uint64_t ino;
+  uint32_t num_imports;
+  uint32_t *imports;
+} R_ld_module;
+
+typedef struct R_ld {
+  R_vm *vm;
+
+  uint32_t num_modules;
+  R_ld_module *modules;
+
+  // per module, a table from exported name to the function's constant index
+  R_box *exports;
+
+  // names stored under a constant key anywhere other than a scope or an
+  // export table
+  R_box written;
+
+  // per instruction
+  bool *leaders;
+  bool *exported;
+  uint32_t *bound;
+  bool *live;
+
+  // the output, with the old index each control transfer targets
+  R_op *out;
+  uint32_t *out_to;
+  uint32_t num_out;
+  uint32_t block;
+  uint32_t *map;
+
+  // the image's constants and strings, and tables from each to its index
+  R_box *consts;
+  uint32_t num_consts;
+  char **strings;
+  uint32_t num_strings;
+  R_box consts_map;
+  R_box strings_map;
+
+  uint32_t num_bound;
+} R_ld;
+
+static void ld_leader(R_ld *ld, int64_t to) {
+  if(to >= 0 && to < ld->vm->num_instrs) {
+    ld->leaders[to] = true;
+  }
+}
+
+// a module's instructions can only be entered at its start, a jump target, a
+// CALLTO target or a function constant
+static void ld_mark_leaders(R_ld *ld, R_ld_module *mod, uint32_t first_const) {
+  R_vm *vm = ld->vm;
+
+  ld_leader(ld, mod->start);
+
+  for(uint32_t i=mod->start; i<mod->start + mod->count; i++) {
+    R_op *instr = &vm->instrs[i];
+
+    switch(R_OP(instr)) {
+      case JUMP:
+      case JUMPIF:
+      case NEXT:
+        ld_leader(ld, (int64_t)i + 1 + R_SI(instr));
+        break;
+
+      case CALLTO:
+        ld_leader(ld, R_UI(instr));
+        break;
+    }
+  }
+
+  for(uint32_t i=first_const; i<vm->num_consts; i++) {
+    if(R_TYPE_IS(&vm->consts[i], FUNC)) {
+      ld_leader(ld, vm->consts[i].u64);
+    }
+  }
+}
+
+static bool ld_static_path(R_ld *ld, uint32_t i) {
+  R_vm *vm = ld->vm;
+
+  if(ld->leaders[i] || R_OP(&vm->instrs[i - 1]) != PUSH_CONST) {
+    return false;
+  }
+
+  R_box *path = &vm->consts[R_UI(&vm->instrs[i - 1])];
+  if(R_TYPE_ISNT(path, STR)) {
+    return false;
+  }
+
+  // native modules are still loaded at runtime
+  size_t len = strlen(path->str);
+  return len <= 3 || strcmp(path->str + len - 3, ".so") != 0;
+}
+
+// load a module and everything it imports, returning its index or -1
+static int64_t ld_load(R_ld *ld, const char *fname) {
+  R_vm *vm = ld->vm;
+  struct stat st;
+
+  if(stat(fname, &st) != 0) {
+    fprintf(stderr, "Unable to open file %s\n", fname);
+    return -1;
+  }
+
+  for(uint32_t i=0; i<ld->num_modules; i++) {
+    if(ld->modules[i].dev == st.st_dev && ld->modules[i].ino == st.st_ino) {
+      return i;
+    }
+  }
+
+  FILE *fp = fopen(fname, "rb");
+  if(fp == NULL) {
+    fprintf(stderr, "Unable to open file %s\n", fname);
+    return -1;
+  }
+
+  uint32_t start = vm->num_instrs;
+  uint32_t first_const = vm->num_consts;
+
+  if(!vm_load(vm, fp)) {
+    fprintf(stderr, "Unable to load bytecode from %s\n", fname);
+    fclose(fp);
+    return -1;
+  }
+
+  fclose(fp);
+
+  uint32_t idx = ld->num_modules;
+  ld->num_modules += 1;
+  ld->modules = realloc(ld->modules, sizeof(R_ld_module) * ld->num_modules);
+  ld->exports = R_realloc(ld->exports, R_KIND_BOXES, sizeof(R_box) * ld->num_modules);
+  R_set_table(&ld->exports[idx]);
+
+  R_ld_module *mod = &ld->modules[idx];
+  mod->start = start;
+  mod->count = vm->num_instrs - start;
+  mod->dev = st.st_dev;
+  mod->ino = st.st_ino;
+  mod->num_imports = 0;
+  mod->imports = NULL;
+
+  ld->leaders = realloc(ld->leaders, sizeof(bool) * vm->num_instrs);
+  memset(ld->leaders + start, 0, sizeof(bool) * mod->count);
+  ld_mark_leaders(ld, mod, first_const);
+
+  // loading an import moves the instructions and the module list around
+  for(uint32_t i=start + 1; i<start + mod->count; i++) {
+    if(R_OP(&vm->instrs[i]) != IMPORT || !ld_static_path(ld, i)) {
+      continue;
+    }
+
+    int64_t dep = ld_load(ld, vm->consts[R_UI(&vm->instrs[i - 1])].str);
+    if(dep < 0) {
+      return -1;
+    }
+
+    mod = &ld->modules[idx];
+    mod->imports = realloc(mod->imports, sizeof(uint32_t) * (mod->num_imports + 1));
+    mod->imports[mod->num_imports] = dep;
+    mod->num_imports += 1;
+
+    vm->instrs[i].u32 = IMPORT_AT | (ld->modules[dep].start << 8);
+  }
+
+  return idx;
+}
+
+static int64_t ld_module_at(R_ld *ld, uint32_t start) {
+  for(uint32_t i=0; i<ld->num_modules; i++) {
+    if(ld->modules[i].start == start) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+// whether to is imported by from, directly or not
+static bool ld_reaches_from(R_ld *ld, uint32_t from, uint32_t to, bool *seen) {
+  if(seen[from]) {
+    return false;
+  }
+
+  seen[from] = true;
+
+  for(uint32_t i=0; i<ld->modules[from].num_imports; i++) {
+    uint32_t dep = ld->modules[from].imports[i];
+    if(dep == to || ld_reaches_from(ld, dep, to, seen)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static bool ld_reaches(R_ld *ld, uint32_t from, uint32_t to) {
+  bool *seen = calloc(ld->num_modules, sizeof(bool));
+  bool rv = from == to || ld_reaches_from(ld, from, to, seen);
+  free(seen);
+  return rv;
+}
+
+static void ld_reset(R_ld_sim *sim) {
+  sim->depth = 0;
+  sim->num_entries = 0;
+  sim->num_tables = 0;
+  sim->escaped = false;
+}
+
+static bool ld_push(R_ld_sim *sim, uint8_t kind, uint32_t num) {
+  if(sim->depth == R_LD_STACK) {
+    return false;
+  }
+
+  sim->stack[sim->depth].kind = kind;
+  sim->stack[sim->depth].num = num;
+  sim->depth += 1;
+  return true;
+}
+
+// below what this run pushed, the stack holds values we know nothing about
+static R_ld_val ld_pop(R_ld_sim *sim) {
+  R_ld_val other = {R_LD_OTHER, 0};
+
+  if(sim->depth == 0) {
+    return other;
+  }
+
+  sim->depth -= 1;
+  return sim->stack[sim->depth];
+}
+
+// the constant index of a string, or -1
+static int64_t ld_name(R_ld *ld, R_ld_val val) {
+  if(val.kind != R_LD_CONST || R_TYPE_ISNT(&ld->vm->consts[val.num], STR)) {
+    return -1;
+  }
+
+  return val.num;
+}
+
+static R_ld_entry *ld_lookup(R_ld *ld, R_ld_sim *sim, uint32_t table, uint32_t name) {
+  const char *str = ld->vm->consts[name].str;
+
+  for(uint32_t i=sim->num_entries; i>0; i--) {
+    R_ld_entry *entry = &sim->entries[i - 1];
+    if(entry->table == table && strcmp(ld->vm->consts[entry->name].str, str) == 0) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+static bool ld_store(R_ld *ld, R_ld_sim *sim, uint32_t table, uint32_t name,
+                     R_ld_val val, uint32_t set) {
+  R_ld_entry *entry = ld_lookup(ld, sim, table, name);
+
+  if(entry == NULL) {
+    if(sim->num_entries == R_LD_ENTRIES) {
+      return false;
+    }
+
+    entry = &sim->entries[sim->num_entries];
+    sim->num_entries += 1;
+  }
+
+  entry->table = table;
+  entry->name = name;
+  entry->set = set;
+  entry->val = val;
+  return true;
+}
+
+static void ld_taint(R_ld_sim *sim, R_ld_val val) {
+  if(val.kind == R_LD_TABLE) {
+    sim->tainted[val.num] = true;
+  }
+}
+
+// follow a module's body up to its RETURN, and if it saves a table it made
+// that nothing else can have changed, export the functions in it. anything
+// the body does that can't be followed gives up on it.
+static void ld_exports(R_ld *ld, uint32_t idx) {
+  R_vm *vm = ld->vm;
+  R_ld_module *mod = &ld->modules[idx];
+  R_ld_sim *sim = malloc(sizeof(R_ld_sim));
+  R_ld_val saved = {R_LD_OTHER, 0};
+  R_ld_val table, key, val;
+  R_ld_entry *entry;
+  int64_t name;
+  bool done = false;
+
+  ld_reset(sim);
+
+  for(uint32_t i=mod->start; i<mod->start + mod->count && !done; i++) {
+    R_op *instr = &vm->instrs[i];
+    bool ok = true;
+
+    if(i > mod->start && ld->leaders[i]) {
+      break;
+    }
+
+    switch(R_OP(instr)) {
+      case PUSH_CONST:
+        ok = ld_push(sim, R_LD_CONST, R_UI(instr));
+        break;
+
+      case PUSH_SCOPE:
+        ok = ld_push(sim, R_LD_SCOPE, 0);
+        break;
+
+      case PUSH_TABLE:
+        ok = sim->num_tables < R_LD_TABLES && ld_push(sim, R_LD_TABLE, sim->num_tables);
+        sim->num_tables += 1;
+        break;
+
+      case DUP:
+        val = ld_pop(sim);
+        ok = ld_push(sim, val.kind, val.num) && ld_push(sim, val.kind, val.num);
+        break;
+
+      case POP:
+      case PRINT:
+        ld_pop(sim);
+        break;
+
+      case NOP:
+      case UN_OP:
+        break;
+
+      case SET:
+        table = ld_pop(sim);
+        key = ld_pop(sim);
+        val = ld_pop(sim);
+        name = ld_name(ld, key);
+
+        // a table is only followed while the scope is the one place it's kept
+        if(table.kind != R_LD_SCOPE) {
+          ld_taint(sim, val);
+        }
+
+        if(table.kind == R_LD_SCOPE) {
+          ok = name >= 0 && ld_store(ld, sim, R_LD_IN_SCOPE, name, val, i);
+        }
+        else if(table.kind == R_LD_TABLE && name < 0) {
+          ld_taint(sim, table);
+        }
+        else if(table.kind == R_LD_TABLE) {
+          ok = ld_store(ld, sim, table.num, name, val, i);
+        }
+        break;
+
+      case GET:
+        table = ld_pop(sim);
+        key = ld_pop(sim);
+        name = ld_name(ld, key);
+        entry = NULL;
+
+        if(table.kind == R_LD_SCOPE && name < 0) {
+          ok = false;
+        }
+        else if((table.kind == R_LD_SCOPE || table.kind == R_LD_TABLE) && name >= 0) {
+          entry = ld_lookup(ld, sim, table.kind == R_LD_SCOPE ? R_LD_IN_SCOPE : table.num,
+                            name);
+        }
+
+        if(entry != NULL) {
+          ok = ok && ld_push(sim, entry->val.kind, entry->val.num);
+        }
+        else {
+          ok = ok && ld_push(sim, R_LD_OTHER, 0);
+        }
+        break;
+
+      case CALL:
+        // a module's own functions start with a fresh scope, but anything
+        // else could be scope() and get at this one
+        val = ld_pop(sim);
+        ok = val.kind == R_LD_CONST && R_TYPE_IS(&vm->consts[val.num], FUNC);
+        for(uint32_t n=0; n<R_UI(instr); n++) {
+          val = ld_pop(sim);
+          ld_taint(sim, val);
+          ok = ok && val.kind != R_LD_SCOPE;
+        }
+        ok = ok && ld_push(sim, R_LD_OTHER, 0);
+        break;
+
+      case CALLTO:
+        ok = ld_push(sim, R_LD_OTHER, 0);
+        break;
+
+      case IMPORT:
+      case IMPORT_AT:
+        ld_pop(sim);
+        ok = ld_push(sim, R_LD_OTHER, 0);
+        break;
+
+      case BIN_OP:
+      case CMP:
+        ld_pop(sim);
+        ld_pop(sim);
+        ok = ld_push(sim, R_LD_OTHER, 0);
+        break;
+
+      case SAVE:
+        saved = ld_pop(sim);
+        break;
+
+      case RETURN:
+        done = true;
+        break;
+
+      default:
+        ok = false;
+    }
+
+    if(!ok) {
+      break;
+    }
+  }
+
+  if(done && saved.kind == R_LD_TABLE && !sim->tainted[saved.num]) {
+    for(uint32_t i=0; i<sim->num_entries; i++) {
+      R_ld_entry *entry = &sim->entries[i];
+      if(entry->table != saved.num || entry->val.kind != R_LD_CONST ||
+         R_TYPE_ISNT(&vm->consts[entry->val.num], FUNC)) {
+        continue;
+      }
+
+      R_box key;
+      R_box func;
+      R_set_str(&key, vm->consts[entry->name].str);
+      R_set_int(&func, entry->val.num);
+      R_table_set(&ld->exports[idx], &key, &func);
+      ld->exported[entry->set] = true;
+    }
+  }
+
+  free(sim);
+}
+
+// the constant index of a function bound to GET name from module dep in
+// module idx, or -1
+static int64_t ld_bind(R_ld *ld, uint32_t idx, uint32_t dep, uint32_t name) {
+  R_box key;
+  R_set_str(&key, ld->vm->consts[name].str);
+
+  R_box *func = R_table_get(&ld->exports[dep], &key);
+  if(func == NULL || R_table_get(&ld->written, &key) != NULL) {
+    return -1;
+  }
+
+  // a module that's still running its body imports as null
+  if(ld_reaches(ld, dep, idx)) {
+    return -1;
+  }
+
+  return func->i64;
+}
+
+// follow the stack through every run of straight-line code, noting names that
+// are stored to, or binding GETs from the values of static imports
+static void ld_scan(R_ld *ld, bool bind) {
+  R_vm *vm = ld->vm;
+  R_ld_sim *sim = malloc(sizeof(R_ld_sim));
+  R_ld_val table, key, val;
+  R_ld_entry *entry;
+  R_box name_box;
+  R_box yes;
+  int64_t name, func;
+  uint32_t argc;
+
+  R_set_bool(&yes, true);
+
+  for(uint32_t m=0; m<ld->num_modules; m++) {
+    R_ld_module *mod = &ld->modules[m];
+
+    for(uint32_t i=mod->start; i<mod->start + mod->count; i++) {
+      R_op *instr = &vm->instrs[i];
+      bool ok = true;
+
+      if(ld->leaders[i]) {
+        ld_reset(sim);
+      }
+
+      switch(R_OP(instr)) {
+        case PUSH_CONST:
+          ok = ld_push(sim, R_LD_CONST, R_UI(instr));
+          break;
+
+        case PUSH_SCOPE:
+          ok = ld_push(sim, R_LD_SCOPE, 0);
+          break;
+
+        case DUP:
+          val = ld_pop(sim);
+          ok = ld_push(sim, val.kind, val.num) && ld_push(sim, val.kind, val.num);
+          break;
+
+        case IMPORT_AT:
+          ld_pop(sim);
+          ok = ld_push(sim, R_LD_MODULE, ld_module_at(ld, R_UI(instr)));
+          break;
+
+        case SET:
+          table = ld_pop(sim);
+          key = ld_pop(sim);
+          val = ld_pop(sim);
+          name = ld_name(ld, key);
+
+          if(val.kind == R_LD_SCOPE) {
+            sim->escaped = true;
+          }
+
+          if(table.kind == R_LD_SCOPE && name >= 0) {
+            ok = ld_store(ld, sim, R_LD_IN_SCOPE, name, val, i);
+          }
+          else if(table.kind == R_LD_SCOPE) {
+            sim->num_entries = 0;
+          }
+          else if(name >= 0 && !ld->exported[i] && !bind) {
+            R_set_str(&name_box, vm->consts[name].str);
+            R_table_set(&ld->written, &name_box, &yes);
+          }
+          break;
+
+        case GET:
+          table = ld_pop(sim);
+          key = ld_pop(sim);
+          name = ld_name(ld, key);
+          func = -1;
+
+          if(table.kind == R_LD_SCOPE && name >= 0 && !sim->escaped) {
+            entry = ld_lookup(ld, sim, R_LD_IN_SCOPE, name);
+            if(entry != NULL) {
+              table = entry->val;
+              ok = ld_push(sim, table.kind, table.num);
+              break;
+            }
+          }
+
+          if(bind && table.kind == R_LD_MODULE && name >= 0) {
+            func = ld_bind(ld, m, table.num, name);
+          }
+
+          if(func >= 0) {
+            ld->bound[i] = func + 1;
+            ld->num_bound += 1;
+            ok = ld_push(sim, R_LD_CONST, func);
+          }
+          else {
+            ok = ld_push(sim, R_LD_OTHER, 0);
+          }
+          break;
+
+        case CALL:
+        case CALL_METHOD:
+          // only a function constant is known not to be scope()
+          val = ld_pop(sim);
+          if(R_OP(instr) == CALL_METHOD || val.kind != R_LD_CONST ||
+             R_TYPE_ISNT(&vm->consts[val.num], FUNC)) {
+            sim->escaped = true;
+          }
+
+          argc = R_OP(instr) == CALL ? R_UI(instr) : vm->methods[R_UI(instr)].argc;
+          for(uint32_t n=0; n<argc; n++) {
+            if(ld_pop(sim).kind == R_LD_SCOPE) {
+              sim->escaped = true;
+            }
+          }
+
+          ok = ld_push(sim, R_LD_OTHER, 0);
+          break;
+
+        case SAVE:
+        case SET_META:
+          if(ld_pop(sim).kind == R_LD_SCOPE) {
+            sim->escaped = true;
+          }
+          break;
+
+        case POP:
+        case PRINT:
+        case JUMPIF:
+          ld_pop(sim);
+          break;
+
+        case BIN_OP:
+        case CMP:
+        case LOAD:
+          ld_pop(sim);
+          ld_pop(sim);
+          ok = ld_push(sim, R_LD_OTHER, 0);
+          break;
+
+        case IMPORT:
+        case GET_META:
+          ld_pop(sim);
+          ok = ld_push(sim, R_LD_OTHER, 0);
+          break;
+
+        case PUSH_TABLE:
+        case CALLTO:
+          ok = ld_push(sim, R_LD_OTHER, 0);
+          break;
+
+        case FIT:
+          sim->depth = 0;
+          break;
+
+        case NOP:
+        case UN_OP:
+          break;
+
+        default:
+          ok = false;
+      }
+
+      if(sim->escaped) {
+        sim->num_entries = 0;
+      }
+
+      if(!ok) {
+        ld_reset(sim);
+      }
+    }
+  }
+
+  free(sim);
+}
+
+static void ld_reach(R_ld *ld, uint32_t *work, uint32_t *len, int64_t to) {
+  if(to >= 0 && to < ld->vm->num_instrs && !ld->live[to]) {
+    ld->live[to] = true;
+    work[*len] = to;
+    *len += 1;
+  }
+}
+
+// everything reachable from the root module's body, counting bound GETs as
+// references to their functions
+static void ld_mark_live(R_ld *ld) {
+  R_vm *vm = ld->vm;
+  uint32_t *work = malloc(sizeof(uint32_t) * vm->num_instrs);
+  uint32_t len = 0;
+
+  ld_reach(ld, work, &len, ld->modules[0].start);
+
+  while(len > 0) {
+    len -= 1;
+    uint32_t i = work[len];
+    R_op *instr = &vm->instrs[i];
+
+    switch(R_OP(instr)) {
+      case JUMP:
+        ld_reach(ld, work, &len, (int64_t)i + 1 + R_SI(instr));
+        continue;
+
+      case RETURN:
+        continue;
+
+      case JUMPIF:
+      case NEXT:
+        ld_reach(ld, work, &len, (int64_t)i + 1 + R_SI(instr));
+        break;
+
+      case CALLTO:
+      case IMPORT_AT:
+        ld_reach(ld, work, &len, R_UI(instr));
+        break;
+
+      case PUSH_CONST:
+        if(R_TYPE_IS(&vm->consts[R_UI(instr)], FUNC)) {
+          ld_reach(ld, work, &len, vm->consts[R_UI(instr)].u64);
+        }
+        break;
+
+      case GET:
+        if(ld->bound[i] > 0) {
+          ld_reach(ld, work, &len, vm->consts[ld->bound[i] - 1].u64);
+        }
+        break;
+    }
+
+    ld_reach(ld, work, &len, i + 1);
+  }
+
+  free(work);
+}
+
+// append an instruction, folding it into the ones before it in the same run
+// where that leaves less to execute
+static void ld_emit(R_ld *ld, uint32_t op, uint32_t to) {
+  R_vm *vm = ld->vm;
+
+  if(ld->num_out > ld->block) {
+    R_op *last = &ld->out[ld->num_out - 1];
+
+    // a value pushed only to be popped
+    if(op == POP && (R_OP(last) == PUSH_CONST || R_OP(last) == PUSH_SCOPE ||
+                     R_OP(last) == DUP)) {
+      ld->num_out -= 1;
+      return;
+    }
+
+    // a lookup whose result is dropped
+    if(op == POP && R_OP(last) == GET) {
+      ld->num_out -= 1;
+      ld_emit(ld, POP, R_LD_NONE);
+      ld_emit(ld, POP, R_LD_NONE);
+      return;
+    }
+
+    // a function constant called without arguments
+    if(op == CALL && R_OP(last) == PUSH_CONST &&
+       R_TYPE_IS(&vm->consts[R_UI(last)], FUNC)) {
+      to = vm->consts[R_UI(last)].u64;
+      op = CALLTO;
+      ld->num_out -= 1;
+    }
+  }
+
+  ld->out[ld->num_out].u32 = op;
+  ld->out_to[ld->num_out] = to;
+  ld->num_out += 1;
+}
+
+static void ld_layout(R_ld *ld) {
+  R_vm *vm = ld->vm;
+
+  // a bound GET takes the place of up to three instructions
+  ld->out = malloc(sizeof(R_op) * vm->num_instrs * 3);
+  ld->out_to = malloc(sizeof(uint32_t) * vm->num_instrs * 3);
+  ld->map = malloc(sizeof(uint32_t) * (vm->num_instrs + 1));
+  ld->num_out = 0;
+  ld->block = 0;
+
+  for(uint32_t i=0; i<vm->num_instrs; i++) {
+    R_op *instr = &vm->instrs[i];
+    uint32_t to = R_LD_NONE;
+
+    // anything jumping to an instruction that was dropped or folded away goes
+    // to whatever comes after it
+    ld->map[i] = ld->num_out;
+
+    if(!ld->live[i]) {
+      continue;
+    }
+
+    if(ld->leaders[i]) {
+      ld->block = ld->num_out;
+    }
+
+    if(ld->bound[i] > 0) {
+      ld_emit(ld, POP, R_LD_NONE);
+      ld_emit(ld, POP, R_LD_NONE);
+      ld_emit(ld, PUSH_CONST | ((ld->bound[i] - 1) << 8), R_LD_NONE);
+      continue;
+    }
+
+    switch(R_OP(instr)) {
+      case JUMP:
+      case JUMPIF:
+      case NEXT:
+        to = i + 1 + R_SI(instr);
+        break;
+
+      case CALLTO:
+      case IMPORT_AT:
+        to = R_UI(instr);
+        break;
+    }
+
+    ld_emit(ld, instr->u32, to);
+
+    // nothing folds across a jump, even one that's fallen through
+    if(R_OP(instr) == JUMP || R_OP(instr) == JUMPIF || R_OP(instr) == NEXT ||
+       R_OP(instr) == RETURN) {
+      ld->block = ld->num_out;
+    }
+  }
+
+  ld->map[vm->num_instrs] = ld->num_out;
+
+  for(uint32_t i=0; i<ld->num_out; i++) {
+    R_op *instr = &ld->out[i];
+    uint32_t to = ld->out_to[i];
+
+    switch(R_OP(instr)) {
+      case JUMP:
+      case JUMPIF:
+      case NEXT:
+        instr->i32 = R_OP(instr) | (((int32_t)ld->map[to] - (int32_t)i - 1) << 8);
+        break;
+
+      case CALLTO:
+      case IMPORT_AT:
+        instr->u32 = R_OP(instr) | (ld->map[to] << 8);
+        break;
+    }
+  }
+}
+
+// the index of a constant in the image, adding it and its string if needed
+static uint32_t ld_const(R_ld *ld, uint32_t old) {
+  R_box *from = &ld->vm->consts[old];
+  R_box key = *from;
+  R_box *found;
+  R_box idx;
+
+  key.meta = NULL;
+
+  if(R_TYPE_IS(from, STR)) {
+    R_set_str(&key, from->str);
+  }
+  else if(R_TYPE_IS(from, FUNC)) {
+    key.u64 = ld->map[from->u64];
+  }
+  else if(R_TYPE_IS(from, NULL)) {
+    key.u64 = 0;
+  }
+
+  found = R_table_get(&ld->consts_map, &key);
+  if(found != NULL) {
+    return found->i64;
+  }
+
+  R_box *to = &ld->consts[ld->num_consts];
+  memset(to, 0, sizeof(R_box));
+  to->type = key.type;
+  to->size = from->size;
+  to->u64 = key.u64;
+
+  if(R_TYPE_IS(from, STR)) {
+    found = R_table_get(&ld->strings_map, &key);
+    if(found == NULL) {
+      R_set_int(&idx, ld->num_strings);
+      R_table_set(&ld->strings_map, &key, &idx);
+      ld->strings[ld->num_strings] = from->str;
+      ld->num_strings += 1;
+      found = &idx;
+    }
+
+    to->u64 = found->i64;
+  }
+
+  R_set_int(&idx, ld->num_consts);
+  R_table_set(&ld->consts_map, &key, &idx);
+  ld->num_consts += 1;
+  return ld->num_consts - 1;
+}
+
+// write the image in the same format as a single module, keeping only the
+// constants and strings it still uses
+static bool ld_write(R_ld *ld, const char *fname) {
+  R_vm *vm = ld->vm;
+
+  ld->consts = malloc(sizeof(R_box) * (vm->num_consts + 1));
+  ld->strings = malloc(sizeof(char *) * (vm->num_consts + 1));
+  ld->num_consts = 0;
+  ld->num_strings = 0;
+  R_set_table(&ld->consts_map);
+  R_set_table(&ld->strings_map);
+
+  for(uint32_t i=0; i<ld->num_out; i++) {
+    R_op *instr = &ld->out[i];
+
+    if(R_OP(instr) == PUSH_CONST) {
+      instr->u32 = PUSH_CONST | (ld_const(ld, R_UI(instr)) << 8);
+    }
+    else if(R_OP(instr) == CALL_METHOD) {
+      R_method_site *site = &vm->methods[R_UI(instr)];
+      uint32_t name = ld_const(ld, site->name);
+
+      if(name > 0xFFFF) {
+        fprintf(stderr, "Too many constants for CALL_METHOD at %u\n", i);
+        return false;
+      }
+
+      instr->u32 = CALL_METHOD | (site->argc << 8) | (name << 16);
+    }
+  }
+
+  if(ld->num_consts > 0xFFFFFF || ld->num_out > 0xFFFFFF) {
+    fprintf(stderr, "Image is too big to address\n");
+    return false;
+  }
+
+  FILE *fp = fopen(fname, "wb");
+  if(fp == NULL) {
+    fprintf(stderr, "Unable to open file %s\n", fname);
+    return false;
+  }
+
+  R_header header;
+  header.num_consts = ld->num_consts;
+  header.num_instrs = ld->num_out;
+  header.num_strings = ld->num_strings;
+
+  bool ok = fwrite(&header, sizeof(R_header), 1, fp) == 1;
+
+  for(uint32_t i=0; i<ld->num_strings && ok; i++) {
+    uint32_t len = strlen(ld->strings[i]);
+    ok = fwrite(&len, sizeof(uint32_t), 1, fp) == 1 &&
+         fwrite(ld->strings[i], 1, len, fp) == len;
+  }
+
+  ok = ok && fwrite(ld->consts, sizeof(R_box), ld->num_consts, fp) == ld->num_consts;
+  ok = ok && fwrite(ld->out, sizeof(R_op), ld->num_out, fp) == ld->num_out;
+  ok = fclose(fp) == 0 && ok;
+
+  if(!ok) {
+    fprintf(stderr, "Unable to write %s\n", fname);
+    return false;
+  }
+
+  printf("%u modules, %u of %u instructions, %u of %u constants, %u of %u strings, "
+         "%u bound\n", ld->num_modules, ld->num_out, vm->num_instrs, ld->num_consts,
+         vm->num_consts, ld->num_strings, vm->num_strings, ld->num_bound);
+
+  return true;
+}
+
+int main(int argv, char **argc) {
+  bool bind = argv > 1 && strcmp(argc[1], "--bind") == 0;
+  int arg = bind ? 2 : 1;
+
+  if(argv - arg != 2) {
+    fprintf(stderr, "Usage: %s [--bind] MODULE OUT\n", argc[0]);
+    return 1;
+  }
+
+  R_vm *this = vm_new();
+  if(this == NULL) {
+    fprintf(stderr, "Unable to create VM\n");
+    return 1;
+  }
+
+  R_ld ld;
+  memset(&ld, 0, sizeof(R_ld));
+  ld.vm = this;
+  R_set_table(&ld.written);
+
+  if(ld_load(&ld, argc[arg]) < 0) {
+    return 1;
+  }
+
+  ld.exported = calloc(this->num_instrs, sizeof(bool));
+  ld.bound = calloc(this->num_instrs, sizeof(uint32_t));
+  ld.live = calloc(this->num_instrs, sizeof(bool));
+
+  for(uint32_t i=0; i<ld.num_modules; i++) {
+    ld_exports(&ld, i);
+  }
+
+  ld_scan(&ld, false);
+  if(bind) {
+    ld_scan(&ld, true);
+  }
+
+  ld_mark_live(&ld);
+  ld_layout(&ld);
+
+  return ld_write(&ld, argc[arg + 1]) ? 0 : 1;
+}
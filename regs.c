@@ -0,0 +1,356 @@
+#include "rain.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// the most stack instructions translated into one run
+#define R_RUN_MAX 128
+
+// a run is translated by evaluating the stack code over operands instead of
+// values: pushes are deferred, and anything computed goes into a fresh
+// register. whatever is left over gets pushed for real when the run ends.
+typedef struct R_run {
+  R_vm *vm;
+  R_reg_op ops[R_RUN_MAX * 2 + R_REGS_MAX + 2];
+  uint32_t num_ops;
+  uint32_t num_regs;
+
+  // the stack instruction being translated
+  uint32_t at;
+
+  uint32_t stack[R_REGS_MAX];
+  uint32_t depth;
+
+  // registers holding tables made in this run, which can't be the scope
+  uint32_t fresh;
+
+  // scope variables already loaded or stored in this run
+  uint32_t names[R_REGS_MAX];
+  uint32_t values[R_REGS_MAX];
+  uint32_t num_names;
+} R_run;
+
+static void R_run_emit(R_run *run, uint8_t op, uint8_t sub, uint16_t dst,
+                       uint32_t a, uint32_t b, uint32_t c) {
+  R_reg_op *out = &run->ops[run->num_ops];
+
+  out->op = op;
+  out->sub = sub;
+  out->dst = dst;
+  out->a = a;
+  out->b = b;
+  out->c = c;
+  out->at = run->at;
+
+  run->num_ops += 1;
+}
+
+static void R_run_push(R_run *run, uint32_t arg) {
+  run->stack[run->depth] = arg;
+  run->depth += 1;
+}
+
+// once the run's own operands are gone, take values off the real stack
+static uint32_t R_run_pop(R_run *run) {
+  if(run->depth > 0) {
+    run->depth -= 1;
+    return run->stack[run->depth];
+  }
+
+  uint32_t reg = run->num_regs;
+  run->num_regs += 1;
+  R_run_emit(run, R_ROP_POP, 0, reg, 0, 0, 0);
+  return reg;
+}
+
+static uint32_t R_run_reg(R_run *run) {
+  run->num_regs += 1;
+  return run->num_regs - 1;
+}
+
+static void R_run_flush(R_run *run) {
+  for(uint32_t i=0; i<run->depth; i++) {
+    R_run_emit(run, R_ROP_PUSH, 0, 0, run->stack[i], 0, 0);
+  }
+
+  run->depth = 0;
+}
+
+// scope variables can only be tracked by constant string names
+static int32_t R_run_name(R_run *run, uint32_t key) {
+  if(key == R_REG_SCOPE || !(key & R_REG_CONST)) {
+    return -2;
+  }
+
+  R_box *name = &run->vm->consts[key & ~R_REG_CONST];
+  if(R_TYPE_ISNT(name, STR)) {
+    return -2;
+  }
+
+  for(uint32_t i=0; i<run->num_names; i++) {
+    R_box *other = &run->vm->consts[run->names[i] & ~R_REG_CONST];
+    if(run->names[i] == key || strcmp(other->str, name->str) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static void R_run_remember(R_run *run, uint32_t key, uint32_t val) {
+  int32_t idx = R_run_name(run, key);
+
+  if(idx == -2) {
+    return;
+  }
+
+  if(idx == -1) {
+    if(run->num_names == R_REGS_MAX) {
+      return;
+    }
+
+    idx = run->num_names;
+    run->names[idx] = key;
+    run->num_names += 1;
+  }
+
+  run->values[idx] = val;
+}
+
+// translate one stack instruction, or return false to end the run before it.
+// jumps end the run after them.
+static bool R_run_add(R_run *run, uint32_t i, bool *last) {
+  R_op *instr = &run->vm->instrs[i];
+  uint32_t a, b, c, reg;
+  int32_t idx;
+
+  run->at = i;
+
+  // worst case: three pops into registers and a result
+  if(run->num_regs + 4 > R_REGS_MAX || run->depth + 2 > R_REGS_MAX) {
+    return false;
+  }
+
+  switch(R_OP(instr)) {
+    case PUSH_CONST:
+      R_run_push(run, R_REG_CONST | R_UI(instr));
+      break;
+
+    case PUSH_SCOPE:
+      R_run_push(run, R_REG_SCOPE);
+      break;
+
+    case DUP:
+      a = R_run_pop(run);
+      R_run_push(run, a);
+      R_run_push(run, a);
+      break;
+
+    case POP:
+      R_run_pop(run);
+      break;
+
+    case BIN_OP:
+    case CMP:
+      b = R_run_pop(run);
+      a = R_run_pop(run);
+      reg = R_run_reg(run);
+      R_run_emit(run, R_OP(instr) == CMP ? R_ROP_CMP : R_ROP_BIN, R_UI(instr),
+                 reg, a, b, 0);
+      R_run_push(run, reg);
+      break;
+
+    case GET:
+      a = R_run_pop(run);
+      b = R_run_pop(run);
+
+      // the scope can't change under a run except through its own stores
+      idx = a == R_REG_SCOPE ? R_run_name(run, b) : -2;
+      if(idx >= 0) {
+        R_run_push(run, run->values[idx]);
+        break;
+      }
+
+      reg = R_run_reg(run);
+      R_run_emit(run, R_ROP_GET, 0, reg, a, b, 0);
+      R_run_push(run, reg);
+
+      if(a == R_REG_SCOPE) {
+        R_run_remember(run, b, reg);
+      }
+      break;
+
+    case SET:
+      a = R_run_pop(run);
+      b = R_run_pop(run);
+      c = R_run_pop(run);
+      R_run_emit(run, R_ROP_SET, 0, 0, a, b, c);
+
+      // any other table might be the scope
+      if(a == R_REG_SCOPE && R_run_name(run, b) != -2) {
+        R_run_remember(run, b, c);
+      }
+      else if(a == R_REG_SCOPE || (a & R_REG_CONST) || !(run->fresh & (1u << a))) {
+        run->num_names = 0;
+      }
+      break;
+
+    case PUSH_TABLE:
+      reg = R_run_reg(run);
+      R_run_emit(run, R_ROP_TABLE, 0, reg, R_UI(instr), 0, 0);
+      run->fresh |= 1u << reg;
+      R_run_push(run, reg);
+      break;
+
+    case PRINT:
+      a = R_run_pop(run);
+      R_run_emit(run, R_ROP_PRINT, 0, 0, a, 0, 0);
+      break;
+
+    case JUMPIF:
+      a = R_run_pop(run);
+      R_run_flush(run);
+      R_run_emit(run, R_ROP_JUMPIF, 0, 0, a, i + 1 + R_SI(instr), 0);
+      *last = true;
+      break;
+
+    case JUMP:
+      R_run_flush(run);
+      R_run_emit(run, R_ROP_EXIT, 0, 0, 0, i + 1 + R_SI(instr), 0);
+      *last = true;
+      break;
+
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+// translate the longest run starting at start and install it if it executes
+// fewer instructions than the stack code it covers. returns where it ended.
+static uint32_t R_run_translate(R_vm *this, R_run *run, uint32_t start) {
+  uint32_t end = start;
+  bool last = false;
+
+  run->vm = this;
+  run->num_ops = 0;
+  run->num_regs = 0;
+  run->depth = 0;
+  run->num_names = 0;
+  run->fresh = 0;
+
+  while(end < this->num_instrs && end - start < R_RUN_MAX && !last) {
+    if(!R_run_add(run, end, &last)) {
+      break;
+    }
+
+    end += 1;
+  }
+
+  if(!last || R_OP(&this->instrs[end - 1]) == JUMPIF) {
+    run->at = end - 1;
+    R_run_flush(run);
+    R_run_emit(run, R_ROP_EXIT, 0, 0, 0, end, 0);
+  }
+
+  // the REGS instruction itself counts too
+  if(run->num_ops + 1 >= end - start) {
+    return end;
+  }
+
+  this->reg_ops = R_realloc(this->reg_ops, R_KIND_RAW,
+                            sizeof(R_reg_op) * (this->num_reg_ops + run->num_ops));
+  memcpy(this->reg_ops + this->num_reg_ops, run->ops, sizeof(R_reg_op) * run->num_ops);
+
+  this->reg_replaced = R_realloc(this->reg_replaced, R_KIND_RAW,
+                                 sizeof(R_op) * (this->num_reg_ops + run->num_ops));
+  memset(this->reg_replaced + this->num_reg_ops, 0, sizeof(R_op) * run->num_ops);
+  this->reg_replaced[this->num_reg_ops] = this->instrs[start];
+
+  this->instrs[start].u32 = REGS | (this->num_reg_ops << 8);
+  this->num_reg_ops += run->num_ops;
+
+  return end;
+}
+
+// translate the instructions loaded since start. runs can begin anywhere:
+// jumping into the middle of one still finds the original stack code there.
+void vm_regs_translate(R_vm *this, uint32_t start) {
+  R_run *run = malloc(sizeof(R_run));
+  uint32_t i = start;
+
+  while(i < this->num_instrs) {
+    uint32_t end = R_run_translate(this, run, i);
+    i = end > i ? end : i + 1;
+  }
+
+  free(run);
+}
+
+// the stack instruction at i, looking through the REGS that replaced it
+R_op *vm_stack_instr(R_vm *this, uint32_t i) {
+  R_op *instr = &this->instrs[i];
+
+  if(R_OP(instr) == REGS) {
+    return &this->reg_replaced[R_UI(instr)];
+  }
+
+  return instr;
+}
+
+void R_reg_op_fprint(FILE *out, R_reg_op *op) {
+  static const char *names[] = {
+    "GET", "SET", "BIN", "CMP", "PRINT", "PUSH", "POP", "JUMPIF", "EXIT", "TABLE",
+  };
+  uint32_t args[3] = {op->a, op->b, op->c};
+  int num_args = 0;
+
+  fprintf(out, "%s", op->op < sizeof(names) / sizeof(names[0]) ? names[op->op] : "???");
+
+  switch(op->op) {
+    case R_ROP_GET:
+    case R_ROP_BIN:
+    case R_ROP_CMP:
+      if(op->op != R_ROP_GET) {
+        fprintf(out, ".%d", op->sub);
+      }
+      fprintf(out, " r%d =", op->dst);
+      num_args = 2;
+      break;
+    case R_ROP_SET:
+      num_args = 3;
+      break;
+    case R_ROP_PRINT:
+    case R_ROP_PUSH:
+      num_args = 1;
+      break;
+    case R_ROP_POP:
+      fprintf(out, " r%d", op->dst);
+      break;
+    case R_ROP_TABLE:
+      fprintf(out, " r%d (%d)", op->dst, op->a);
+      break;
+    case R_ROP_JUMPIF:
+      num_args = 1;
+      break;
+  }
+
+  for(int i=0; i<num_args; i++) {
+    if(args[i] == R_REG_SCOPE) {
+      fprintf(out, " scope");
+    }
+    else if(args[i] & R_REG_CONST) {
+      fprintf(out, " k%u", args[i] & ~R_REG_CONST);
+    }
+    else {
+      fprintf(out, " r%u", args[i]);
+    }
+  }
+
+  if(op->op == R_ROP_JUMPIF || op->op == R_ROP_EXIT) {
+    fprintf(out, " -> %02x", op->b);
+  }
+
+  fprintf(out, "\n");
+}
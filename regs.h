@@ -0,0 +1,47 @@
+#ifndef R_REGS_H
+#define R_REGS_H
+
+#include "vm.h"
+
+// register code is an alternate format for straight-line runs of stack code.
+// vm_regs_translate replaces the first instruction of each run it can improve
+// with a REGS instruction pointing at the run's register ops, which execute
+// without touching the operand stack and then leave for a stack instruction.
+// the rest of the run stays in place, so both formats share one VM. each op
+// remembers the stack instruction it came from, and the one REGS replaced is
+// kept in reg_replaced, so profiles and reports still see the stack code.
+//
+// operands name a register, a constant (R_REG_CONST | index) or the current
+// scope (R_REG_SCOPE). registers live in the REGS instruction's C frame, so
+// they only hold values for the length of one run.
+
+#define R_REGS_MAX  32
+#define R_REG_CONST 0x80000000
+#define R_REG_SCOPE 0xFFFFFFFF
+
+#define R_ROP_GET    0x00 // dst = a[b]
+#define R_ROP_SET    0x01 // a[b] = c
+#define R_ROP_BIN    0x02 // dst = a sub b
+#define R_ROP_CMP    0x03 // dst = a sub b
+#define R_ROP_PRINT  0x04 // print a
+#define R_ROP_PUSH   0x05 // push a onto the stack
+#define R_ROP_POP    0x06 // dst = pop the stack
+#define R_ROP_JUMPIF 0x07 // leave for instruction b if a is true
+#define R_ROP_EXIT   0x08 // leave for instruction b
+#define R_ROP_TABLE  0x09 // dst = a new table sized for a keys
+
+typedef struct R_reg_op {
+  uint8_t op;
+  uint8_t sub;
+  uint16_t dst;
+  uint32_t a;
+  uint32_t b;
+  uint32_t c;
+  uint32_t at;
+} R_reg_op;
+
+void vm_regs_translate(R_vm *this, uint32_t start);
+R_op *vm_stack_instr(R_vm *this, uint32_t i);
+void R_reg_op_fprint(FILE *out, R_reg_op *op);
+
+#endif
@@ -1,6 +1,10 @@
 from contextlib import contextmanager as ctx
 import ctypes as ct
 import struct
+import types
+
+INT64_MIN = -2 ** 63
+INT64_MAX = 2 ** 63 - 1
 
 class Box(ct.Structure):
   null = 0
@@ -14,10 +18,6 @@ class Box(ct.Structure):
 
   _saves_ = []
 
-  # strings should be saved on Module, not Box
-  # right now, every Module produced writes the whole set of strings
-  _strings_ = []
-
   def __str__(self):
     env_p = ct.cast(self.env, ct.c_void_p).value or 0
     return 'Box({}, {}, 0x{:08x}, 0x{:08x})'.format(self.type, self.size, self.data, env_p)
@@ -32,7 +32,7 @@ class Box(ct.Structure):
     return obj
 
   @classmethod
-  def to_rain(cls, val):
+  def to_rain(cls, val, strings):
     if val is None:
       return cls.new(cls.null, 0, 0, cls.nullptr)
 
@@ -51,16 +51,133 @@ class Box(ct.Structure):
       return cls.new(cls.float, 0, intrep, cls.nullptr)
 
     elif isinstance(val, str):
-      idx = len(cls._strings_)
-      cls._strings_.append(val)
-      return cls.new(cls.str, len(val), idx, cls.nullptr)
+      return cls.new(cls.str, len(val), strings.add(val), cls.nullptr)
+
+    elif isinstance(val, Block):
+      return cls.new(cls.func, 0, val.addr, cls.nullptr)
 
-    elif isinstance(val, type(lambda: 0)):
+    elif isinstance(val, types.FunctionType):
       return cls.new(cls.func, 0, val(), cls.nullptr)
 
     raise Exception("Can't convert value {!r} to Rain".format(val))
 
 
+class StringPool:
+  def __init__(self):
+    self.strings = []
+    self.index = {}
+
+  def __len__(self):
+    return len(self.strings)
+
+  def __iter__(self):
+    return iter(self.strings)
+
+  def add(self, string):
+    if string not in self.index:
+      self.index[string] = len(self.strings)
+      self.strings.append(string)
+
+    return self.index[string]
+
+
+def const_key(val):
+  # True == 1 == 1.0 in Python, but they're all different Rain values
+  return (type(val), val)
+
+
+def rain_type(val):
+  if val is None:
+    return Box.null
+  elif isinstance(val, bool):
+    return Box.bool
+  elif isinstance(val, int):
+    return Box.int
+  elif isinstance(val, float):
+    return Box.float
+  elif isinstance(val, str):
+    return Box.str
+  elif isinstance(val, (Block, types.FunctionType)):
+    return Box.func
+
+  return None
+
+
+# sentinel for operations that can't be folded at compile time
+NO_FOLD = object()
+
+
+def fold_bin_op(op, lhs, rhs):
+  numeric = (Box.int, Box.float)
+  lhs_t, rhs_t = rain_type(lhs), rain_type(rhs)
+
+  if lhs_t is None or rhs_t is None:
+    return NO_FOLD
+
+  if lhs_t not in numeric or rhs_t not in numeric:
+    return None
+
+  if lhs_t == Box.int and rhs_t == Box.int:
+    if op == BinOp.ADD:
+      res = lhs + rhs
+    elif op == BinOp.SUB:
+      res = lhs - rhs
+    elif op == BinOp.MUL:
+      res = lhs * rhs
+    elif op == BinOp.DIV and rhs != 0:
+      # C truncates towards zero
+      res = abs(lhs) // abs(rhs)
+      res = -res if (lhs < 0) != (rhs < 0) else res
+    else:
+      return NO_FOLD
+
+    # leave overflow to the VM
+    if not INT64_MIN <= res <= INT64_MAX:
+      return NO_FOLD
+
+    return res
+
+  lhs, rhs = float(lhs), float(rhs)
+  if op == BinOp.ADD:
+    return lhs + rhs
+  elif op == BinOp.SUB:
+    return lhs - rhs
+  elif op == BinOp.MUL:
+    return lhs * rhs
+  elif op == BinOp.DIV and rhs != 0:
+    return lhs / rhs
+
+  return NO_FOLD
+
+
+def fold_cmp_op(op, lhs, rhs):
+  lhs_t, rhs_t = rain_type(lhs), rain_type(rhs)
+
+  if lhs_t is None or rhs_t is None:
+    return NO_FOLD
+
+  if lhs_t != rhs_t:
+    return False
+
+  if lhs_t not in (Box.int, Box.float, Box.bool):
+    return None
+
+  if op == CmpOp.LT:
+    return lhs < rhs
+  elif op == CmpOp.LE:
+    return lhs <= rhs
+  elif op == CmpOp.GT:
+    return lhs > rhs
+  elif op == CmpOp.GE:
+    return lhs >= rhs
+  elif op == CmpOp.EQ:
+    return lhs == rhs
+  elif op == CmpOp.NE:
+    return lhs != rhs
+
+  return NO_FOLD
+
+
 Box._fields_ = [('type', ct.c_uint8),
                 ('size', ct.c_uint32),
                 ('data', ct.c_uint64),
@@ -101,6 +218,10 @@ class Instr:
   LOAD       = 0x14
   SAVE       = 0x15
   FIT        = 0x16
+  NEXT       = 0x17
+  REGS       = 0x18 # only created by the loader
+  CALL_METHOD = 0x19
+  IMPORT_AT  = 0x1A # only created by rainld
 
   def __init__(self):
     pass
@@ -171,7 +292,13 @@ class Dup(Nx): op = Instr.DUP
 class Pop(Nx): op = Instr.POP
 class Set(Nx): op = Instr.SET
 class Get(Nx): op = Instr.GET
-class PushTable(Nx): op = Instr.PUSH_TABLE
+class PushTable(Ux):
+  op = Instr.PUSH_TABLE
+
+  # x is the number of keys the table will hold, 0 if unknown
+  def __init__(self, x=0):
+    self.x = x
+
 class PushScope(Nx): op = Instr.PUSH_SCOPE
 class NOP(Nx): op = Instr.NOP
 class CallTo(UBx): op = Instr.CALLTO
@@ -183,6 +310,23 @@ class GetMeta(Nx): op = Instr.GET_META
 class Load(Nx): op = Instr.LOAD
 class Save(Nx): op = Instr.SAVE
 class Fit(Ux): op = Instr.FIT
+class Next(SBx): op = Instr.NEXT
+
+
+class CallMethod(Instr):
+  op = Instr.CALL_METHOD
+
+  # x is the constant index of the method name, argc doesn't count the receiver
+  def __init__(self, x, argc):
+    self.x = x
+    self.argc = argc
+
+  def as_c(self):
+    if self.x > 0xFFFF or self.argc > 0xFF:
+      raise Exception('CALL_METHOD operands out of range: {}, {}'.format(self.x, self.argc))
+
+    b, c = struct.pack('<H', self.x)
+    return CInstr(self.op, self.argc, b, c)
 
 
 class BinOp(Ux):
@@ -237,14 +381,17 @@ class Block:
       if isinstance(instr, CallTo):
         instr.x = instr.block.addr
 
-      elif isinstance(instr, (Jump, JumpIf)):
+      elif isinstance(instr, (Jump, JumpIf, Next)):
         instr.x = instr.block.addr - (self.addr + i) - 1
 
 
 class Module:
-  def __init__(self, name):
+  def __init__(self, name, optimize=True):
     self.name = name
     self.consts = []
+    self.const_index = {}
+    self.strings = StringPool()
+    self.optimize = optimize
     self.block = None
     self.main = Block()
     self.blocks = [self.main]
@@ -252,6 +399,9 @@ class Module:
     self.instr_count = 0
 
   def finalize(self):
+    if self.optimize:
+      self.run_passes()
+
     # hacky, but works for now
     self.blocks = tuple(self.blocks)
     self.consts = tuple(self.consts)
@@ -264,17 +414,143 @@ class Module:
     for block in self.blocks:
       block.finalize()
 
-    self.consts = [Box.to_rain(val) for val in self.consts]
+    self.consts = [Box.to_rain(val, self.strings) for val in self.consts]
+
+  def run_passes(self):
+    self.fold_constants()
+    self.thread_jumps()
+    self.drop_unreachable()
+    self.drop_redundant_jumps()
+    self.prune_consts()
+
+  def fold_constants(self):
+    for block in self.blocks:
+      out = []
+      for instr in block.instrs:
+        out.append(instr)
+        while self.fold_tail(out):
+          pass
+
+      block.instrs = out
+
+  def fold_tail(self, out):
+    pure = (PushConst, PushScope, PushTable, Dup)
+
+    # a value pushed only to be popped
+    if len(out) >= 2 and type(out[-1]) is Pop and type(out[-2]) in pure:
+      del out[-2:]
+      return True
+
+    if len(out) < 3 or type(out[-2]) is not PushConst or type(out[-3]) is not PushConst:
+      return False
+
+    lhs = self.consts[out[-3].x]
+    rhs = self.consts[out[-2].x]
+
+    if type(out[-1]) is BinOp:
+      res = fold_bin_op(out[-1].x, lhs, rhs)
+    elif type(out[-1]) is CmpOp:
+      res = fold_cmp_op(out[-1].x, lhs, rhs)
+    else:
+      return False
+
+    if res is NO_FOLD:
+      return False
+
+    out[-3:] = [PushConst(self.add_const(res))]
+    return True
+
+  def next_instr(self, block):
+    # the first instruction executed when entering a block, following
+    # fallthrough out of empty blocks
+    for block in self.blocks[self.blocks.index(block):]:
+      if block.instrs:
+        return block.instrs[0]
+
+    return None
+
+  def thread_jumps(self):
+    for block in self.blocks:
+      for instr in block.instrs:
+        if not isinstance(instr, (Jump, JumpIf, Next)):
+          continue
+
+        seen = {instr.block}
+        while True:
+          target = self.next_instr(instr.block)
+          if type(target) is not Jump or target.block in seen:
+            break
+
+          instr.block = target.block
+          seen.add(target.block)
+
+  def drop_unreachable(self):
+    # functions referenced through lambdas can't be traced
+    if any(isinstance(val, types.FunctionType) for val in self.consts):
+      return
+
+    reachable = set()
+    work = [self.main]
+
+    while work:
+      block = work.pop()
+      if block in reachable:
+        continue
+
+      reachable.add(block)
+      falls_through = True
+
+      for i, instr in enumerate(block.instrs):
+        if isinstance(instr, (Jump, JumpIf, Next, CallTo)):
+          work.append(instr.block)
+
+        elif type(instr) is PushConst and isinstance(self.consts[instr.x], Block):
+          work.append(self.consts[instr.x])
+
+        if type(instr) in (Jump, Return):
+          block.instrs = block.instrs[:i + 1]
+          falls_through = False
+          break
+
+      pos = self.blocks.index(block) + 1
+      if falls_through and pos < len(self.blocks):
+        work.append(self.blocks[pos])
+
+    self.blocks = [block for block in self.blocks if block in reachable]
+
+  def drop_redundant_jumps(self):
+    for i, block in enumerate(self.blocks):
+      if not block.instrs or type(block.instrs[-1]) is not Jump:
+        continue
+
+      target = self.blocks.index(block.instrs[-1].block)
+      between = self.blocks[i + 1:target]
+      if target > i and not any(between):
+        block.instrs = block.instrs[:-1]
+
+  def prune_consts(self):
+    used = sorted({instr.x for block in self.blocks for instr in block.instrs
+                   if type(instr) in (PushConst, CallMethod)})
+    remap = {old: new for new, old in enumerate(used)}
+
+    for block in self.blocks:
+      for instr in block.instrs:
+        if type(instr) in (PushConst, CallMethod):
+          instr.x = remap[instr.x]
+
+    self.consts = [self.consts[old] for old in used]
+    self.const_index = {const_key(val): i for i, val in enumerate(self.consts)}
 
   def add_const(self, val):
     if self.frozen:
       raise Exception('Module {!r} already finalized'.format(self.name))
 
-    if val in self.consts:
-      return self.consts.index(val)
+    key = const_key(val)
+    if key not in self.const_index:
+      self.const_index[key] = len(self.consts)
+      self.consts.append(val)
 
-    self.consts.append(val)
-    return len(self.consts) - 1
+    return self.const_index[key]
 
   def add_instr(self, *instrs):
     if self.frozen:
@@ -288,8 +564,8 @@ class Module:
   def push_scope(self):
     self.add_instr(PushScope())
 
-  def push_table(self):
-    self.add_instr(PushTable())
+  def push_table(self, size=0):
+    self.add_instr(PushTable(size))
 
   def pop(self):
     self.add_instr(Pop())
@@ -318,6 +594,10 @@ class Module:
   def call(self, argc):
     self.add_instr(Call(argc))
 
+  def call_method(self, name, argc):
+    # receiver and argc arguments on the stack; the receiver is passed first
+    self.add_instr(CallMethod(self.add_const(name), argc))
+
   def set_meta(self):
     self.add_instr(SetMeta())
 
@@ -336,6 +616,10 @@ class Module:
   def fit(self, argc):
     self.add_instr(Fit(argc))
 
+  def next(self, done):
+    # iterable and cursor on the stack; jumps to done when exhausted
+    self.add_instr(Next(done))
+
   def imp(self):
     self.add_instr(Import())
 
@@ -378,9 +662,9 @@ class Module:
     with open('{0.name}.rnc'.format(self), 'wb') as fp:
       fp.write(struct.pack('<I', len(self.consts)))
       fp.write(struct.pack('<I', self.instr_count))
-      fp.write(struct.pack('<I', len(Box._strings_)))
+      fp.write(struct.pack('<I', len(self.strings)))
 
-      for string in Box._strings_:
+      for string in self.strings:
         fp.write(struct.pack('<I', len(string)))
         fp.write(string.encode('utf-8'))
 
@@ -0,0 +1,157 @@
+#include "rain.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+static uint64_t R_sched_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// call with the lock held
+static void R_sched_push(R_sched *sched, R_task *task) {
+  task->next = NULL;
+
+  if(sched->tail == NULL) {
+    sched->head = task;
+  }
+  else {
+    sched->tail->next = task;
+  }
+
+  sched->tail = task;
+}
+
+// call with the lock held
+static R_task *R_sched_pop(R_sched *sched) {
+  R_task *task = sched->head;
+
+  sched->head = task->next;
+  if(sched->head == NULL) {
+    sched->tail = NULL;
+  }
+
+  return task;
+}
+
+static void *R_sched_main(void *arg) {
+  R_sched *sched = arg;
+
+  R_prof_block();
+  R_heap_thread_begin();
+  pthread_mutex_lock(&sched->lock);
+
+  while(true) {
+    while(sched->head == NULL && !sched->stopping) {
+      pthread_cond_wait(&sched->ready, &sched->lock);
+    }
+
+    if(sched->stopping) {
+      break;
+    }
+
+    R_task *task = R_sched_pop(sched);
+    pthread_mutex_unlock(&sched->lock);
+
+    task->status = vm_run_for(task->vm, sched->slice_instrs, sched->slice_us);
+
+    if(task->status != R_RUN_YIELD) {
+      task->done_ns = R_sched_now();
+      if(task->done != NULL) {
+        task->done(task);
+      }
+    }
+
+    pthread_mutex_lock(&sched->lock);
+
+    if(task->status == R_RUN_YIELD) {
+      R_sched_push(sched, task);
+    }
+    else {
+      sched->pending -= 1;
+      if(sched->pending == 0) {
+        pthread_cond_broadcast(&sched->idle);
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&sched->lock);
+  R_heap_thread_end();
+
+  return NULL;
+}
+
+R_sched *R_sched_new(uint32_t threads, uint64_t slice_instrs, uint64_t slice_us) {
+#ifdef R_GC_PRECISE
+  // the precise heap isn't thread safe, so VMs still share one thread. nothing
+  // else may touch a VM while the scheduler is running.
+  threads = 1;
+#endif
+
+  if(threads == 0) {
+    threads = 1;
+  }
+
+  R_sched *sched = calloc(1, sizeof(R_sched));
+  pthread_mutex_init(&sched->lock, NULL);
+  pthread_cond_init(&sched->ready, NULL);
+  pthread_cond_init(&sched->idle, NULL);
+
+  sched->slice_instrs = slice_instrs;
+  sched->slice_us = slice_us;
+  sched->threads = malloc(sizeof(pthread_t) * threads);
+
+  for(uint32_t i=0; i<threads; i++) {
+    if(pthread_create(&sched->threads[i], NULL, R_sched_main, sched) != 0) {
+      fprintf(stderr, "Unable to start scheduler thread\n");
+      R_sched_free(sched);
+      return NULL;
+    }
+
+    sched->num_threads += 1;
+  }
+
+  return sched;
+}
+
+// the VM should already have an entry point, eg. from vm_import
+void R_sched_add(R_sched *sched, R_task *task) {
+  task->status = R_RUN_YIELD;
+  task->added_ns = R_sched_now();
+  task->done_ns = 0;
+
+  pthread_mutex_lock(&sched->lock);
+  R_sched_push(sched, task);
+  sched->pending += 1;
+  pthread_cond_signal(&sched->ready);
+  pthread_mutex_unlock(&sched->lock);
+}
+
+// block until every task added so far has finished
+void R_sched_wait(R_sched *sched) {
+  pthread_mutex_lock(&sched->lock);
+  while(sched->pending > 0) {
+    pthread_cond_wait(&sched->idle, &sched->lock);
+  }
+  pthread_mutex_unlock(&sched->lock);
+}
+
+// stop the workers after their current slices. unfinished tasks are dropped
+// from the queue but their VMs can still be resumed with vm_run_for.
+void R_sched_free(R_sched *sched) {
+  pthread_mutex_lock(&sched->lock);
+  sched->stopping = true;
+  pthread_cond_broadcast(&sched->ready);
+  pthread_mutex_unlock(&sched->lock);
+
+  for(uint32_t i=0; i<sched->num_threads; i++) {
+    pthread_join(sched->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&sched->idle);
+  pthread_cond_destroy(&sched->ready);
+  pthread_mutex_destroy(&sched->lock);
+  free(sched->threads);
+  free(sched);
+}
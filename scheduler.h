@@ -0,0 +1,53 @@
+#ifndef R_SCHEDULER_H
+#define R_SCHEDULER_H
+
+#include "vm.h"
+#include <pthread.h>
+#include <stdbool.h>
+
+#define R_SCHED_SLICE_US 1000
+
+// a VM waiting for, or taking, its turns on the scheduler. the caller owns the
+// task and sets vm (and optionally done and data) before adding it; done is
+// called from a worker thread once the VM finishes or fails. VMs stay alive
+// until the caller frees them with vm_free, which it should do for each one
+// it's done with.
+typedef struct R_task {
+  R_vm *vm;
+  void (*done)(struct R_task *task);
+  void *data;
+
+  int status;
+  uint64_t added_ns;
+  uint64_t done_ns;
+
+  struct R_task *next;
+} R_task;
+
+// runs many VMs on a fixed pool of threads. workers take the task at the head
+// of the run queue, give it one slice of vm_run_for and put it back at the
+// tail if it yielded, so a short script waits at most a slice per task ahead
+// of it instead of for whole programs.
+typedef struct R_sched {
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_cond_t idle;
+
+  R_task *head;
+  R_task *tail;
+  uint32_t pending;
+  bool stopping;
+
+  uint64_t slice_instrs;
+  uint64_t slice_us;
+
+  uint32_t num_threads;
+  pthread_t *threads;
+} R_sched;
+
+R_sched *R_sched_new(uint32_t threads, uint64_t slice_instrs, uint64_t slice_us);
+void R_sched_add(R_sched *sched, R_task *task);
+void R_sched_wait(R_sched *sched);
+void R_sched_free(R_sched *sched);
+
+#endif
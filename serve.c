@@ -0,0 +1,340 @@
+#include "rain.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define R_REQUEST_SIZE 4096
+#define R_RECORD_BUFFER (64 * 1024)
+#define R_OUTPUT_BUFFER (64 * 1024)
+
+typedef struct R_records {
+  int fd;
+  char *buf;
+  size_t pos;
+  size_t len;
+  size_t max;
+} R_records;
+
+static int R_listen_unix(const char *path) {
+  struct sockaddr_un addr;
+
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0) {
+    fprintf(stderr, "Unable to create socket: %s\n", strerror(errno));
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+     listen(fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "Unable to listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// read a single newline terminated request
+static bool R_read_request(int fd, char *buf, size_t size) {
+  size_t len = 0;
+
+  while(len < size - 1) {
+    ssize_t rv = read(fd, buf + len, 1);
+    if(rv <= 0) {
+      return false;
+    }
+
+    if(buf[len] == '\n') {
+      break;
+    }
+
+    len += 1;
+  }
+
+  buf[len] = 0;
+  return len > 0;
+}
+
+// each connection sends the path of a module followed by a newline. the
+// server forks a child that inherits the already initialized VM, runs the
+// module with stdout and stderr sent back over the connection, and exits.
+bool vm_serve_fork(R_vm *this, const char *path) {
+  char request[R_REQUEST_SIZE];
+
+  int fd = R_listen_unix(path);
+  if(fd < 0) {
+    return false;
+  }
+
+  // children are never waited on
+  signal(SIGCHLD, SIG_IGN);
+
+  while(1) {
+    int conn = accept(fd, NULL, NULL);
+    if(conn < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+
+      fprintf(stderr, "Unable to accept connection: %s\n", strerror(errno));
+      close(fd);
+      return false;
+    }
+
+    if(!R_read_request(conn, request, sizeof(request))) {
+      close(conn);
+      continue;
+    }
+
+    // don't let the child flush output buffered before the fork
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if(pid == 0) {
+      close(fd);
+      dup2(conn, STDOUT_FILENO);
+      dup2(conn, STDERR_FILENO);
+      close(conn);
+
+      bool ok = vm_run_file(this, request);
+      fflush(stdout);
+      fflush(stderr);
+      _exit(ok ? 0 : 1);
+    }
+
+    if(pid < 0) {
+      fprintf(stderr, "Unable to fork: %s\n", strerror(errno));
+    }
+
+    close(conn);
+  }
+}
+
+// make sure the next n bytes are buffered, reading more if needed. output is
+// only flushed when the input has nothing else ready, so bursts of records
+// are answered with a few large writes.
+static bool R_records_fill(R_records *in, size_t n) {
+  while(in->len - in->pos < n) {
+    if(in->pos > 0) {
+      memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+      in->len -= in->pos;
+      in->pos = 0;
+    }
+
+    if(in->len + n > in->max) {
+      in->max = in->len + n > in->max * 2 ? in->len + n : in->max * 2;
+      in->buf = realloc(in->buf, in->max);
+    }
+
+    struct pollfd pfd = {.fd = in->fd, .events = POLLIN};
+    if(poll(&pfd, 1, 0) == 0) {
+      fflush(stdout);
+    }
+
+    ssize_t rv = read(in->fd, in->buf + in->len, in->max - in->len);
+    if(rv < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if(rv <= 0) {
+      return false;
+    }
+
+    in->len += rv;
+  }
+
+  return true;
+}
+
+static bool R_records_next(R_records *in, bool length_prefixed,
+                           char **rec, size_t *len) {
+  if(length_prefixed) {
+    if(!R_records_fill(in, 4)) {
+      return false;
+    }
+
+    unsigned char *hdr = (unsigned char *)in->buf + in->pos;
+    *len = hdr[0] | hdr[1] << 8 | hdr[2] << 16 | (uint32_t)hdr[3] << 24;
+
+    if(!R_records_fill(in, 4 + *len)) {
+      return false;
+    }
+
+    *rec = in->buf + in->pos + 4;
+    in->pos += 4 + *len;
+    return true;
+  }
+
+  size_t scan = 0;
+  while(1) {
+    char *nl = memchr(in->buf + in->pos + scan, '\n', in->len - in->pos - scan);
+    if(nl != NULL) {
+      *rec = in->buf + in->pos;
+      *len = nl - *rec;
+      in->pos += *len + 1;
+      return true;
+    }
+
+    scan = in->len - in->pos;
+    if(!R_records_fill(in, scan + 1)) {
+      // a final record without a newline
+      if(scan == 0) {
+        return false;
+      }
+
+      *rec = in->buf + in->pos;
+      *len = scan;
+      in->pos += scan;
+      return true;
+    }
+  }
+}
+
+static void R_worker_output(R_box *val, bool length_prefixed) {
+  if(R_TYPE_IS(val, NULL)) {
+    return;
+  }
+
+  if(!R_TYPE_IS(val, STR) && !length_prefixed) {
+    R_box_print(val);
+    return;
+  }
+
+  if(length_prefixed) {
+    const char *str = val->str;
+    uint32_t size = val->size;
+    char *text = NULL;
+    size_t len = 0;
+
+    // anything else goes out the way print would show it, minus the
+    // newline, so it doesn't break the framing of the records after it
+    if(!R_TYPE_IS(val, STR)) {
+      FILE *out = open_memstream(&text, &len);
+      if(out == NULL) {
+        fprintf(stderr, "Unable to format handler result\n");
+        return;
+      }
+
+      R_box_fprint(out, val);
+      fclose(out);
+
+      str = text;
+      size = len > 0 ? len - 1 : 0;
+    }
+
+    unsigned char hdr[4] = {
+      size & 0xFF, (size >> 8) & 0xFF,
+      (size >> 16) & 0xFF, (size >> 24) & 0xFF,
+    };
+    fwrite(hdr, 1, 4, stdout);
+    fwrite(str, 1, size, stdout);
+    free(text);
+  }
+  else {
+    fwrite(val->str, 1, val->size, stdout);
+    fputc('\n', stdout);
+  }
+}
+
+static void R_worker_stream(R_vm *this, R_worker *worker, uint32_t slot, int fd) {
+  R_records in = {.fd = fd, .buf = malloc(R_RECORD_BUFFER), .max = R_RECORD_BUFFER};
+  char *rec;
+  size_t len;
+  R_box arg;
+
+  while(R_records_next(&in, worker->length_prefixed, &rec, &len)) {
+    arg.type = R_TYPE_STR;
+    arg.str = R_alloc(R_KIND_RAW, len + 1);
+    arg.size = len;
+    arg.meta = NULL;
+    memcpy(arg.str, rec, len);
+    arg.str[len] = 0;
+
+    R_box ret;
+    vm_invoke(this, &this->stack[slot], &arg, 1, &ret);
+    R_worker_output(&ret, worker->length_prefixed);
+  }
+
+  fflush(stdout);
+  free(in.buf);
+}
+
+// load a module once and call its handler for every record. the handler is
+// looked up in the table the module saves, then in its scope.
+bool vm_serve_worker(R_vm *this, R_worker *worker) {
+  if(!vm_run_file(this, worker->module)) {
+    return false;
+  }
+
+  R_module *mod = vm_module(this, worker->module);
+  R_box key;
+  R_box *handler = NULL;
+
+  R_set_str(&key, (char *)worker->handler);
+
+  if(R_TYPE_IS(&mod->value, TABLE)) {
+    handler = R_table_get(&mod->value, &key);
+  }
+
+  if(handler == NULL) {
+    handler = R_table_get(&mod->scope, &key);
+  }
+
+  if(handler == NULL || (R_TYPE_ISNT(handler, FUNC) && R_TYPE_ISNT(handler, CFUNC))) {
+    fprintf(stderr, "Module %s has no handler %s\n", worker->module, worker->handler);
+    return false;
+  }
+
+  // keep the handler on the stack so the collector can see it
+  vm_push(this, handler);
+  uint32_t slot = this->stack_ptr - 1;
+
+  setvbuf(stdout, NULL, _IOFBF, R_OUTPUT_BUFFER);
+
+  if(worker->socket == NULL) {
+    R_worker_stream(this, worker, slot, STDIN_FILENO);
+    return true;
+  }
+
+  int fd = R_listen_unix(worker->socket);
+  if(fd < 0) {
+    return false;
+  }
+
+  int saved = dup(STDOUT_FILENO);
+  signal(SIGPIPE, SIG_IGN);
+
+  while(1) {
+    int conn = accept(fd, NULL, NULL);
+    if(conn < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+
+      fprintf(stderr, "Unable to accept connection: %s\n", strerror(errno));
+      close(fd);
+      return false;
+    }
+
+    dup2(conn, STDOUT_FILENO);
+    R_worker_stream(this, worker, slot, conn);
+    dup2(saved, STDOUT_FILENO);
+    close(conn);
+  }
+}
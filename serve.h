@@ -0,0 +1,17 @@
+#ifndef R_SERVE_H
+#define R_SERVE_H
+
+#include "vm.h"
+#include <stdbool.h>
+
+typedef struct R_worker {
+  const char *module;
+  const char *handler;
+  const char *socket; // serve connections instead of stdin when set
+  bool length_prefixed;
+} R_worker;
+
+bool vm_serve_fork(R_vm *this, const char *path);
+bool vm_serve_worker(R_vm *this, R_worker *worker);
+
+#endif
@@ -0,0 +1,636 @@
+#define _GNU_SOURCE
+#include "rain.h"
+#include "snapshot.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0
+#endif
+
+#define R_SNAP_ALIGN(n) (((n) + 15) & ~(uint64_t)15)
+
+// an object that has a place in the image but hasn't been filled in yet
+typedef struct R_snap_job {
+  void *from;
+  uint64_t at;
+  int kind;
+  size_t used;
+} R_snap_job;
+
+// the image is built in one growing buffer, so everything in it is referred
+// to by offset until it's written out
+typedef struct R_snap {
+  char *data;
+  uint64_t len;
+  uint64_t max;
+
+  // original pointers (and for strings, their sizes) to image offsets, open
+  // addressed
+  void **keys;
+  size_t *sizes;
+  uint64_t *vals;
+  size_t map_cur;
+  size_t map_max;
+
+  R_snap_job *jobs;
+  size_t num_jobs;
+  size_t max_jobs;
+
+  uint64_t *relocs;
+  size_t num_relocs;
+  size_t max_relocs;
+
+  R_image_cfunc *cfuncs;
+  size_t num_cfuncs;
+  size_t max_cfuncs;
+
+  uint64_t *rehash;
+  size_t num_rehash;
+  size_t max_rehash;
+
+  bool failed;
+} R_snap;
+
+#define R_SNAP_PUSH(list, num, max, val) do { \
+  if((num) == (max)) { \
+    (max) = (max) == 0 ? 64 : (max) * 2; \
+    (list) = realloc((list), sizeof(*(list)) * (max)); \
+  } \
+  (list)[(num)] = (val); \
+  (num) += 1; \
+} while(0)
+
+static uint64_t R_snap_reserve(R_snap *snap, uint64_t size) {
+  uint64_t at = R_SNAP_ALIGN(snap->len);
+
+  if(at + size > snap->max) {
+    while(at + size > snap->max) {
+      snap->max = snap->max == 0 ? 65536 : snap->max * 2;
+    }
+
+    snap->data = realloc(snap->data, snap->max);
+  }
+
+  memset(snap->data + snap->len, 0, at + size - snap->len);
+  snap->len = at + size;
+  return at;
+}
+
+// room for an object with its header; returns the payload's offset
+static uint64_t R_snap_obj(R_snap *snap, int kind, size_t size) {
+  uint64_t at = R_snap_reserve(snap, sizeof(R_obj) + size);
+  R_heap_image_obj((R_obj *)(snap->data + at), kind, size);
+  return at + sizeof(R_obj);
+}
+
+static inline size_t R_snap_slot(void *ptr, size_t max) {
+  return (((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ull) & (max - 1);
+}
+
+static void R_snap_map_sized(R_snap *snap, void *ptr, size_t size, uint64_t at);
+
+static void R_snap_map_grow(R_snap *snap) {
+  void **keys = snap->keys;
+  size_t *sizes = snap->sizes;
+  uint64_t *vals = snap->vals;
+  size_t max = snap->map_max;
+
+  snap->map_max = max == 0 ? 1024 : max * 2;
+  snap->keys = calloc(snap->map_max, sizeof(void *));
+  snap->sizes = calloc(snap->map_max, sizeof(size_t));
+  snap->vals = calloc(snap->map_max, sizeof(uint64_t));
+  snap->map_cur = 0;
+
+  for(size_t i=0; i<max; i++) {
+    if(keys[i] != NULL) {
+      R_snap_map_sized(snap, keys[i], sizes[i], vals[i]);
+    }
+  }
+
+  free(keys);
+  free(sizes);
+  free(vals);
+}
+
+// strings are keyed by their size as well, since a box can hold a longer
+// string than strlen sees at the same pointer. everything else uses size 0.
+static void R_snap_map_sized(R_snap *snap, void *ptr, size_t size, uint64_t at) {
+  if((snap->map_cur + 1) * 2 > snap->map_max) {
+    R_snap_map_grow(snap);
+  }
+
+  size_t idx = R_snap_slot(ptr, snap->map_max);
+  while(snap->keys[idx] != NULL) {
+    idx = (idx + 1) & (snap->map_max - 1);
+  }
+
+  snap->keys[idx] = ptr;
+  snap->sizes[idx] = size;
+  snap->vals[idx] = at;
+  snap->map_cur += 1;
+}
+
+static uint64_t R_snap_find_sized(R_snap *snap, void *ptr, size_t size) {
+  if(snap->map_max == 0) {
+    return 0;
+  }
+
+  size_t idx = R_snap_slot(ptr, snap->map_max);
+  while(snap->keys[idx] != NULL) {
+    if(snap->keys[idx] == ptr && snap->sizes[idx] == size) {
+      return snap->vals[idx];
+    }
+
+    idx = (idx + 1) & (snap->map_max - 1);
+  }
+
+  return 0;
+}
+
+static void R_snap_map(R_snap *snap, void *ptr, uint64_t at) {
+  R_snap_map_sized(snap, ptr, 0, at);
+}
+
+static uint64_t R_snap_find(R_snap *snap, void *ptr) {
+  return R_snap_find_sized(snap, ptr, 0);
+}
+
+// store a pointer to image offset `to` at offset `at`
+static void R_snap_ptr(R_snap *snap, uint64_t at, uint64_t to) {
+  *(uint64_t *)(snap->data + at) = R_IMAGE_BASE + to;
+  R_SNAP_PUSH(snap->relocs, snap->num_relocs, snap->max_relocs, at);
+}
+
+// point `at` at the image copy of ptr, making room for it first if it's new.
+// `size` bytes are allocated, of which the first `used` are copied. the copy
+// is looked up by ptr and key, see R_snap_map_sized.
+static void R_snap_ref_sized(R_snap *snap, uint64_t at, void *ptr, size_t key,
+                             int kind, size_t size, size_t used) {
+  if(ptr == NULL) {
+    *(uint64_t *)(snap->data + at) = 0;
+    return;
+  }
+
+  uint64_t to = R_snap_find_sized(snap, ptr, key);
+
+  if(to == 0) {
+    R_snap_job job = {.from = ptr, .kind = kind, .used = used};
+
+    to = R_snap_obj(snap, kind, size);
+    job.at = to;
+    R_snap_map_sized(snap, ptr, key, to);
+    R_SNAP_PUSH(snap->jobs, snap->num_jobs, snap->max_jobs, job);
+  }
+
+  R_snap_ptr(snap, at, to);
+}
+
+static void R_snap_ref(R_snap *snap, uint64_t at, void *ptr, int kind,
+                       size_t size, size_t used) {
+  R_snap_ref_sized(snap, at, ptr, 0, kind, size, used);
+}
+
+// len bytes and the terminator after them, which may be past an embedded NUL
+static void R_snap_str_sized(R_snap *snap, uint64_t at, char *str, size_t len) {
+  R_snap_ref_sized(snap, at, str, len + 1, R_KIND_RAW, len + 1, len + 1);
+}
+
+static void R_snap_str(R_snap *snap, uint64_t at, char *str) {
+  R_snap_str_sized(snap, at, str, str == NULL ? 0 : strlen(str));
+}
+
+// C functions are saved by name and looked up again on restore
+static void R_snap_cfunc(R_snap *snap, uint64_t at, void *fn) {
+  R_image_cfunc cfunc = {.box = at};
+  Dl_info info;
+
+  if(dladdr(fn, &info) == 0 || info.dli_sname == NULL || info.dli_saddr != fn) {
+    fprintf(stderr, "Unable to snapshot C function %p without a symbol\n", fn);
+    snap->failed = true;
+    return;
+  }
+
+  size_t lib_len = strlen(info.dli_fname) + 1;
+  size_t sym_len = strlen(info.dli_sname) + 1;
+
+  cfunc.lib = R_snap_obj(snap, R_KIND_RAW, lib_len);
+  memcpy(snap->data + cfunc.lib, info.dli_fname, lib_len);
+  cfunc.sym = R_snap_obj(snap, R_KIND_RAW, sym_len);
+  memcpy(snap->data + cfunc.sym, info.dli_sname, sym_len);
+
+  *(uint64_t *)(snap->data + at + offsetof(R_box, ptr)) = 0;
+  R_SNAP_PUSH(snap->cfuncs, snap->num_cfuncs, snap->max_cfuncs, cfunc);
+}
+
+// the box at `at` was copied as is; point it into the image
+static void R_snap_box(R_snap *snap, uint64_t at) {
+  R_box box = *(R_box *)(snap->data + at);
+  uint64_t ptr = at + offsetof(R_box, ptr);
+
+  switch(box.type) {
+    case R_TYPE_NULL:
+    case R_TYPE_INT:
+    case R_TYPE_FLOAT:
+    case R_TYPE_BOOL:
+    case R_TYPE_FUNC:
+      break;
+
+    case R_TYPE_STR:
+      R_snap_str_sized(snap, ptr, box.str, box.size);
+      break;
+
+    case R_TYPE_TABLE:
+      R_snap_ref(snap, ptr, box.table, R_KIND_TABLE, sizeof(R_table), sizeof(R_table));
+      break;
+
+    case R_TYPE_INTS:
+    case R_TYPE_FLOATS: {
+      size_t size = sizeof(int64_t) * (box.size > 0 ? box.size : 1);
+      R_snap_ref(snap, ptr, box.ptr, R_KIND_RAW, size, size);
+      break;
+    }
+
+    case R_TYPE_CFUNC:
+      R_snap_cfunc(snap, at, box.ptr);
+      break;
+
+    default:
+      // buffers, frozen tables and C data belong to this process
+      if(!snap->failed) {
+        fprintf(stderr, "Unable to snapshot a value of type %d\n", box.type);
+      }
+      snap->failed = true;
+      break;
+  }
+
+  R_snap_ref(snap, at + offsetof(R_box, meta), box.meta, R_KIND_BOX,
+             sizeof(R_box), sizeof(R_box));
+}
+
+// shapes live outside the heap, so image shapes are plain copies without
+// children. new transitions from them are added in the restoring process.
+static void R_snap_shape(R_snap *snap, uint64_t at, R_shape *shape) {
+  uint64_t to = R_snap_find(snap, shape);
+
+  if(to == 0) {
+    to = R_snap_obj(snap, R_KIND_RAW, sizeof(R_shape));
+    R_snap_map(snap, shape, to);
+    ((R_shape *)(snap->data + to))->num_keys = shape->num_keys;
+
+    uint64_t keys = R_snap_obj(snap, R_KIND_RAW, sizeof(char *) * (shape->num_keys + 1));
+    R_snap_ptr(snap, to + offsetof(R_shape, keys), keys);
+
+    for(uint32_t i=0; i<shape->num_keys; i++) {
+      R_snap_str(snap, keys + sizeof(char *) * i, shape->keys[i]);
+    }
+  }
+
+  R_snap_ptr(snap, at, to);
+}
+
+// only strings, numbers and functions hash the same in every process
+static bool R_snap_needs_rehash(R_table *table) {
+  for(uint32_t i=0; i<table->max; i++) {
+    R_item *item = table->items[i];
+
+    if(item != NULL && item->key.type != R_TYPE_NULL && item->key.type != R_TYPE_INT &&
+       item->key.type != R_TYPE_FLOAT && item->key.type != R_TYPE_BOOL &&
+       item->key.type != R_TYPE_STR && item->key.type != R_TYPE_FUNC) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void R_snap_fill(R_snap *snap, R_snap_job *job) {
+  memcpy(snap->data + job->at, job->from, job->used);
+
+  switch(job->kind) {
+    case R_KIND_BOX:
+      R_snap_box(snap, job->at);
+      break;
+
+    case R_KIND_BOXES:
+      for(size_t i=0; i<job->used / sizeof(R_box); i++) {
+        R_snap_box(snap, job->at + sizeof(R_box) * i);
+      }
+      break;
+
+    case R_KIND_TABLE: {
+      R_table *table = job->from;
+
+      if(table->shape != NULL) {
+        R_snap_shape(snap, job->at + offsetof(R_table, shape), table->shape);
+        R_snap_ref(snap, job->at + offsetof(R_table, slots), table->slots, R_KIND_BOXES,
+                   sizeof(R_box) * table->max, sizeof(R_box) * table->cur);
+      }
+      else {
+        R_snap_ref(snap, job->at + offsetof(R_table, items), table->items, R_KIND_ITEMS,
+                   sizeof(R_item *) * table->max, sizeof(R_item *) * table->max);
+
+        if(R_snap_needs_rehash(table)) {
+          R_SNAP_PUSH(snap->rehash, snap->num_rehash, snap->max_rehash, job->at);
+        }
+      }
+      break;
+    }
+
+    case R_KIND_ITEMS:
+      for(size_t i=0; i<job->used / sizeof(R_item *); i++) {
+        R_snap_ref(snap, job->at + sizeof(R_item *) * i, ((R_item **)job->from)[i],
+                   R_KIND_ITEM, sizeof(R_item), sizeof(R_item));
+      }
+      break;
+
+    case R_KIND_ITEM:
+      R_snap_box(snap, job->at + offsetof(R_item, key));
+      R_snap_box(snap, job->at + offsetof(R_item, val));
+      break;
+
+    case R_KIND_STRS:
+      for(size_t i=0; i<job->used / sizeof(char *); i++) {
+        R_snap_str(snap, job->at + sizeof(char *) * i, ((char **)job->from)[i]);
+      }
+      break;
+
+    case R_KIND_FRAMES:
+      for(size_t i=0; i<job->used / sizeof(R_frame); i++) {
+        uint64_t frame = job->at + sizeof(R_frame) * i;
+        R_snap_box(snap, frame + offsetof(R_frame, scope));
+        R_snap_box(snap, frame + offsetof(R_frame, ret));
+      }
+      break;
+
+    // method caches are left empty, since nothing is known about the
+    // restoring process's tables yet
+    case R_KIND_METHODS:
+      for(size_t i=0; i<job->used / sizeof(R_method_site); i++) {
+        R_method_site *site = (R_method_site *)(snap->data + job->at) + i;
+        site->epoch = 0;
+        site->shape = NULL;
+        site->meta = NULL;
+        R_set_null(&site->method);
+      }
+      break;
+
+    case R_KIND_MODULES:
+      for(size_t i=0; i<job->used / sizeof(R_module); i++) {
+        uint64_t mod = job->at + sizeof(R_module) * i;
+        R_snap_str(snap, mod + offsetof(R_module, path), ((R_module *)job->from)[i].path);
+        R_snap_box(snap, mod + offsetof(R_module, scope));
+        R_snap_box(snap, mod + offsetof(R_module, value));
+      }
+      break;
+  }
+}
+
+// the saved VM only keeps what the program can reach; tracing, profiling and
+// the registers of the host are left to the restoring process
+static uint64_t R_snap_vm(R_snap *snap, R_vm *this) {
+  uint64_t at = R_snap_obj(snap, R_KIND_RAW, sizeof(R_vm));
+  R_vm *vm = (R_vm *)(snap->data + at);
+
+  vm->instr_ptr = this->instr_ptr;
+  vm->num_consts = this->num_consts;
+  vm->num_instrs = this->num_instrs;
+  vm->num_strings = this->num_strings;
+  vm->stack_ptr = this->stack_ptr;
+  vm->stack_size = this->stack_size;
+  vm->scope_ptr = this->scope_ptr;
+  vm->scope_size = this->scope_size;
+  vm->frame_ptr = this->frame_ptr;
+  vm->frame_size = this->frame_size;
+  vm->use_regs = this->use_regs;
+  vm->num_reg_ops = this->num_reg_ops;
+  vm->num_modules = this->num_modules;
+  vm->num_methods = this->num_methods;
+
+#define R_SNAP_FIELD(field, kind, size, used) \
+  R_snap_ref(snap, at + offsetof(R_vm, field), this->field, kind, size, used)
+
+  R_SNAP_FIELD(consts, R_KIND_BOXES, sizeof(R_box) * (this->num_consts + 1),
+               sizeof(R_box) * this->num_consts);
+  R_SNAP_FIELD(instrs, R_KIND_RAW, sizeof(R_op) * (this->num_instrs + 1),
+               sizeof(R_op) * this->num_instrs);
+  R_SNAP_FIELD(strings, R_KIND_STRS, sizeof(char *) * (this->num_strings + 1),
+               sizeof(char *) * this->num_strings);
+  R_SNAP_FIELD(stack, R_KIND_BOXES, sizeof(R_box) * this->stack_size,
+               sizeof(R_box) * this->stack_ptr);
+  R_SNAP_FIELD(frames, R_KIND_FRAMES, sizeof(R_frame) * this->frame_size,
+               sizeof(R_frame) * this->frame_ptr);
+  R_SNAP_FIELD(reg_ops, R_KIND_RAW, sizeof(R_reg_op) * this->num_reg_ops,
+               sizeof(R_reg_op) * this->num_reg_ops);
+  R_SNAP_FIELD(reg_replaced, R_KIND_RAW, sizeof(R_op) * this->num_reg_ops,
+               sizeof(R_op) * this->num_reg_ops);
+  R_SNAP_FIELD(modules, R_KIND_MODULES, sizeof(R_module) * this->num_modules,
+               sizeof(R_module) * this->num_modules);
+  R_SNAP_FIELD(builtins, R_KIND_BOX, sizeof(R_box), sizeof(R_box));
+  R_SNAP_FIELD(methods, R_KIND_METHODS, sizeof(R_method_site) * this->num_methods,
+               sizeof(R_method_site) * this->num_methods);
+
+#undef R_SNAP_FIELD
+
+  // the current frame points into the frame array
+  uint64_t frames = R_snap_find(snap, this->frames);
+  R_snap_ptr(snap, at + offsetof(R_vm, frame),
+             frames + sizeof(R_frame) * (this->frame - this->frames));
+
+  return at;
+}
+
+static uint64_t R_snap_list(R_snap *snap, void *list, size_t size) {
+  uint64_t at = R_snap_reserve(snap, size);
+  memcpy(snap->data + at, list, size);
+  return at;
+}
+
+static void R_snap_free(R_snap *snap) {
+  free(snap->data);
+  free(snap->keys);
+  free(snap->sizes);
+  free(snap->vals);
+  free(snap->jobs);
+  free(snap->relocs);
+  free(snap->cfuncs);
+  free(snap->rehash);
+}
+
+bool vm_snapshot(R_vm *this, const char *path) {
+  R_snap snap = {0};
+  R_image_header head = {
+    .magic = R_IMAGE_MAGIC,
+    .version = R_IMAGE_VERSION,
+    .base = R_IMAGE_BASE,
+  };
+
+  // native code can't be moved into another process
+  if(this->num_natives > 0) {
+    fprintf(stderr, "Unable to snapshot a VM with native modules\n");
+    return false;
+  }
+
+  R_snap_reserve(&snap, sizeof(R_image_header));
+  head.vm = R_snap_vm(&snap, this);
+
+  while(snap.num_jobs > 0 && !snap.failed) {
+    snap.num_jobs -= 1;
+    R_snap_job job = snap.jobs[snap.num_jobs];
+    R_snap_fill(&snap, &job);
+  }
+
+  if(snap.failed) {
+    R_snap_free(&snap);
+    return false;
+  }
+
+  head.num_relocs = snap.num_relocs;
+  head.relocs = R_snap_list(&snap, snap.relocs, sizeof(uint64_t) * snap.num_relocs);
+  head.num_cfuncs = snap.num_cfuncs;
+  head.cfuncs = R_snap_list(&snap, snap.cfuncs, sizeof(R_image_cfunc) * snap.num_cfuncs);
+  head.num_rehash = snap.num_rehash;
+  head.rehash = R_snap_list(&snap, snap.rehash, sizeof(uint64_t) * snap.num_rehash);
+  head.size = snap.len;
+  memcpy(snap.data, &head, sizeof(head));
+
+  FILE *fp = fopen(path, "wb");
+  if(fp == NULL) {
+    fprintf(stderr, "Unable to open file %s\n", path);
+    R_snap_free(&snap);
+    return false;
+  }
+
+  bool ok = fwrite(snap.data, 1, snap.len, fp) == snap.len;
+  ok = fclose(fp) == 0 && ok;
+  if(!ok) {
+    fprintf(stderr, "Unable to write snapshot %s\n", path);
+  }
+
+  R_snap_free(&snap);
+  return ok;
+}
+
+// look in the library the function came from first. executables can't be
+// opened again, but their exported symbols are in the global scope.
+static void *R_image_sym(const char *lib, const char *sym) {
+  void *handle = dlopen(lib, RTLD_NOW | RTLD_GLOBAL);
+  void *fn = NULL;
+
+  if(handle != NULL) {
+    fn = dlsym(handle, sym);
+  }
+
+  if(fn == NULL) {
+    fn = dlsym(RTLD_DEFAULT, sym);
+  }
+
+  return fn;
+}
+
+R_vm *vm_restore(const char *path) {
+  R_image_header head;
+  struct stat st;
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    fprintf(stderr, "Unable to open file %s\n", path);
+    return NULL;
+  }
+
+  if(pread(fd, &head, sizeof(head), 0) != sizeof(head) || head.magic != R_IMAGE_MAGIC ||
+     head.version != R_IMAGE_VERSION || fstat(fd, &st) != 0 ||
+     (uint64_t)st.st_size < head.size) {
+    fprintf(stderr, "Invalid snapshot %s\n", path);
+    close(fd);
+    return NULL;
+  }
+
+  // private pages are copied only once they're written
+  char *base = mmap((void *)head.base, head.size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_FIXED_NOREPLACE, fd, 0);
+  if(base == MAP_FAILED) {
+    base = mmap(NULL, head.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  }
+
+  close(fd);
+
+  if(base == MAP_FAILED) {
+    fprintf(stderr, "Unable to map snapshot %s\n", path);
+    return NULL;
+  }
+
+  uint64_t delta = (uint64_t)base - head.base;
+  if(delta != 0) {
+    uint64_t *relocs = (uint64_t *)(base + head.relocs);
+
+    for(uint64_t i=0; i<head.num_relocs; i++) {
+      *(uint64_t *)(base + relocs[i]) += delta;
+    }
+  }
+
+  R_image_cfunc *cfuncs = (R_image_cfunc *)(base + head.cfuncs);
+  for(uint64_t i=0; i<head.num_cfuncs; i++) {
+    R_box *box = (R_box *)(base + cfuncs[i].box);
+    box->ptr = R_image_sym(base + cfuncs[i].lib, base + cfuncs[i].sym);
+
+    if(box->ptr == NULL) {
+      fprintf(stderr, "Unable to find %s from %s\n", base + cfuncs[i].sym, base + cfuncs[i].lib);
+      munmap(base, head.size);
+      return NULL;
+    }
+  }
+
+  R_vm *this = vm_new();
+  if(this == NULL) {
+    munmap(base, head.size);
+    return NULL;
+  }
+
+  R_heap_image(base, head.size);
+
+  R_vm *saved = (R_vm *)(base + head.vm);
+
+  // a VM that finished its run is ready for the next import, like a new one
+  this->instr_ptr = saved->frame_ptr > 0 ? saved->instr_ptr : UINT32_MAX - 1;
+  this->num_consts = saved->num_consts;
+  this->num_instrs = saved->num_instrs;
+  this->num_strings = saved->num_strings;
+  this->stack_ptr = saved->stack_ptr;
+  this->stack_size = saved->stack_size;
+  this->scope_ptr = saved->scope_ptr;
+  this->scope_size = saved->scope_size;
+  this->frame_ptr = saved->frame_ptr;
+  this->frame_size = saved->frame_size;
+  this->use_regs = saved->use_regs;
+  this->num_reg_ops = saved->num_reg_ops;
+  this->num_modules = saved->num_modules;
+  this->num_methods = saved->num_methods;
+
+  this->consts = saved->consts;
+  this->instrs = saved->instrs;
+  this->strings = saved->strings;
+  this->stack = saved->stack;
+  this->frames = saved->frames;
+  this->frame = saved->frame;
+  this->reg_ops = saved->reg_ops;
+  this->reg_replaced = saved->reg_replaced;
+  this->modules = saved->modules;
+  this->builtins = saved->builtins;
+  this->methods = saved->methods;
+
+  // tables keyed by address have to be rebuilt with the new addresses
+  uint64_t *rehash = (uint64_t *)(base + head.rehash);
+  for(uint64_t i=0; i<head.num_rehash; i++) {
+    R_box table = {.type = R_TYPE_TABLE, .table = (R_table *)(base + rehash[i])};
+    R_table_rehash(&table);
+  }
+
+  return this;
+}
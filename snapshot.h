@@ -0,0 +1,46 @@
+#ifndef R_SNAPSHOT_H
+#define R_SNAPSHOT_H
+
+#include "vm.h"
+#include <stdbool.h>
+
+// a snapshot image is a VM's reachable state laid out as it would be in
+// memory at R_IMAGE_BASE. every object keeps an R_obj header, so the heap
+// treats image objects like old objects that are never freed.
+//
+// restoring maps the file privately at its base and only has to look up C
+// functions by name. if the base is taken, the image is mapped elsewhere and
+// every pointer field in the relocation list is shifted, and dictionaries
+// keyed by address are rehashed.
+
+#define R_IMAGE_MAGIC   0x534d5652 // "RVMS"
+#define R_IMAGE_VERSION 3
+#define R_IMAGE_BASE    0x520000000000ull
+
+typedef struct R_image_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t base;
+  uint64_t size;
+
+  // offsets from the start of the image
+  uint64_t vm;
+  uint64_t relocs;
+  uint64_t num_relocs;
+  uint64_t cfuncs;
+  uint64_t num_cfuncs;
+  uint64_t rehash;
+  uint64_t num_rehash;
+} R_image_header;
+
+// a C function box and the library and symbol it came from
+typedef struct R_image_cfunc {
+  uint64_t box;
+  uint64_t lib;
+  uint64_t sym;
+} R_image_cfunc;
+
+bool vm_snapshot(R_vm *this, const char *path);
+R_vm *vm_restore(const char *path);
+
+#endif
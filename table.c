@@ -1,7 +1,11 @@
 #include "rain.h"
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <string.h>
 
+_Atomic uint64_t R_table_epoch = 1;
+
 uint64_t R_hash(R_box *val) {
   uint64_t hash = 5381;
 
@@ -30,21 +34,263 @@ bool R_hash_eq(R_box *lhs, R_box *rhs) {
   return lhs->u64 == rhs->u64;
 }
 
+// records
+//
+// a table created empty is a record: its keys live in a shape and its values
+// in a slot vector, slot i holding the value of shape->keys[i]. adding a key
+// moves the table along a transition to the child shape with that key, so
+// tables built with the same string keys in the same order share one chain of
+// shapes and cost only their slots. any other key, or more than R_SHAPE_MAX of
+// them, turns the table into a dictionary for good.
+
+R_shape R_shape_root;
+static pthread_mutex_t R_shape_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int32_t R_shape_find(R_shape *shape, R_box *key) {
+  if(R_TYPE_ISNT(key, STR)) {
+    return -1;
+  }
+
+  for(uint32_t i=0; i<shape->num_keys; i++) {
+    if(shape->keys[i][0] == key->str[0] && strcmp(shape->keys[i], key->str) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static R_shape *R_shape_add(R_shape *shape, const char *key) {
+  R_shape *child = NULL;
+
+  pthread_mutex_lock(&R_shape_lock);
+
+  for(uint32_t i=0; i<shape->num_children; i++) {
+    if(strcmp(shape->children[i]->keys[shape->num_keys], key) == 0) {
+      child = shape->children[i];
+      break;
+    }
+  }
+
+  if(child == NULL) {
+    child = calloc(1, sizeof(R_shape));
+    child->num_keys = shape->num_keys + 1;
+    child->keys = malloc(sizeof(char *) * child->num_keys);
+    memcpy(child->keys, shape->keys, sizeof(char *) * shape->num_keys);
+    child->keys[shape->num_keys] = strdup(key);
+
+    shape->num_children += 1;
+    shape->children = realloc(shape->children, sizeof(R_shape *) * shape->num_children);
+    shape->children[shape->num_children - 1] = child;
+  }
+
+  pthread_mutex_unlock(&R_shape_lock);
+  return child;
+}
+
+// rebuild a record as a dictionary
+static void R_table_dictify(R_box *table) {
+  R_table *self = table->table;
+  R_shape *shape = self->shape;
+  R_box *slots = self->slots;
+  uint32_t max = R_INIT_TABLE_SIZE;
+  R_box key;
+
+  while(max < shape->num_keys * 4) {
+    max *= 2;
+  }
+
+  self->cur = 0;
+  self->max = max;
+  self->items = R_alloc(R_KIND_ITEMS, sizeof(R_item *) * max);
+  self->shape = NULL;
+  self->slots = NULL;
+  R_heap_write(self);
+
+  for(uint32_t i=0; i<shape->num_keys; i++) {
+    R_set_str(&key, shape->keys[i]);
+    R_table_set_aux(table, &key, &slots[i], NULL);
+  }
+}
+
+static bool R_record_set(R_box *table, R_box *key, R_box *val) {
+  R_table *self = table->table;
+  int32_t idx = R_shape_find(self->shape, key);
+
+  if(idx >= 0) {
+    self->slots[idx] = *val;
+    R_heap_write(self->slots);
+    return true;
+  }
+
+  if(R_TYPE_ISNT(key, STR) || self->shape->num_keys >= R_SHAPE_MAX) {
+    return false;
+  }
+
+  if(self->cur == self->max) {
+    self->max = self->max == 0 ? 4 : self->max * 2;
+    self->slots = R_realloc(self->slots, R_KIND_BOXES, sizeof(R_box) * self->max);
+    for(uint32_t i=self->cur; i<self->max; i++) {
+      R_set_null(&self->slots[i]);
+    }
+  }
+
+  self->shape = R_shape_add(self->shape, key->str);
+  self->slots[self->cur] = *val;
+  self->cur += 1;
+  R_heap_write(self);
+  R_heap_write(self->slots);
+  return true;
+}
+
+// copies the representation as is: slots for records, buckets for
+// dictionaries, without hashing anything
 void R_table_clone(R_box *from, R_box *to) {
-  uint32_t max = from->table->max;
-  R_item **items = from->table->items;
+  R_table *src = from->table;
+
+  if(src->shape != NULL) {
+    R_set_table(to);
+
+    if(src->max > 0) {
+      to->table->slots = R_alloc(R_KIND_BOXES, sizeof(R_box) * src->max);
+      memcpy(to->table->slots, src->slots, sizeof(R_box) * src->max);
+      to->table->shape = src->shape;
+      to->table->cur = src->cur;
+      to->table->max = src->max;
+    }
+  }
+  else {
+    R_set_table_sized(to, src->max);
+
+    for(uint32_t i=0; i<src->max; i++) {
+      if(src->items[i] != NULL) {
+        R_item *item = R_alloc(R_KIND_ITEM, sizeof(R_item));
+        *item = *src->items[i];
+        to->table->items[i] = item;
+      }
+    }
+
+    to->table->cur = src->cur;
+  }
 
-  R_set_table_sized(to, max);
   to->meta = from->meta;
+}
 
-  for(int i=0; i<max; i++) {
+// make room for `want` more keys with at most one rehash. records only grow
+// their slots; whether they stay records depends on the keys that arrive.
+void R_table_reserve(R_box *table, uint32_t want) {
+  R_table *self = table->table;
+
+  if(self->shape != NULL) {
+    if(self->cur + want > self->max && self->cur + want <= R_SHAPE_MAX) {
+      self->max = self->cur + want;
+      self->slots = R_realloc(self->slots, R_KIND_BOXES, sizeof(R_box) * self->max);
+      for(uint32_t i=self->cur; i<self->max; i++) {
+        R_set_null(&self->slots[i]);
+      }
+      R_heap_write(self);
+    }
+    return;
+  }
+
+  uint32_t need = self->cur + want;
+  uint32_t old = self->max;
+  uint32_t max = old;
+  R_item **items = self->items;
+
+  while(need > max / 2) {
+    max *= 2;
+  }
+
+  if(max == old) {
+    return;
+  }
+
+  R_TRACE(R_heap_vm, R_EV_RESIZE, old, max);
+  R_PROBE3(table__resize, self, old, max);
+  self->cur = 0;
+  self->max = max;
+  self->items = R_alloc(R_KIND_ITEMS, sizeof(R_item *) * max);
+  R_heap_write(self);
+
+  for(uint32_t i=0; i<old; i++) {
+    if(items[i] != NULL) {
+      R_table_set_aux(table, &items[i]->key, &items[i]->val, items[i]);
+    }
+  }
+}
+
+// put every item back where its current hash says it goes, eg. after keys
+// that hash by address have moved
+void R_table_rehash(R_box *table) {
+  R_table *self = table->table;
+  R_item **items = self->items;
+
+  if(self->shape != NULL) {
+    return;
+  }
+
+  self->cur = 0;
+  self->items = R_alloc(R_KIND_ITEMS, sizeof(R_item *) * self->max);
+  R_heap_write(self);
+
+  for(uint32_t i=0; i<self->max; i++) {
     if(items[i] != NULL) {
-      R_table_set_aux(to, &items[i]->key, &items[i]->val, items[i]);
+      R_table_set_aux(table, &items[i]->key, &items[i]->val, items[i]);
+    }
+  }
+}
+
+// dst gets every key of src; dst is grown once up front
+void R_table_merge(R_box *dst, R_box *src) {
+  uint32_t pos = 0;
+  R_box key;
+  R_box val;
+
+  R_table_reserve(dst, src->table->cur);
+
+  while(R_table_next(src, &pos, &key, &val)) {
+    R_table_set(dst, &key, &val);
+  }
+}
+
+// finds the entry at or after *pos, in slot order for records and bucket
+// order for dictionaries. *pos is left just past it, so it works as a cursor
+// that survives updates to existing keys; adding keys to a dictionary can
+// resize it, after which the walk may skip or repeat entries.
+bool R_table_next(R_box *table, uint32_t *pos, R_box *key, R_box *val) {
+  R_table *self = table->table;
+
+  if(self->shape != NULL) {
+    if(*pos >= self->cur) {
+      return false;
+    }
+
+    R_set_str(key, self->shape->keys[*pos]);
+    *val = self->slots[*pos];
+    *pos += 1;
+    return true;
+  }
+
+  for(uint32_t i=*pos; i<self->max; i++) {
+    if(self->items[i] != NULL) {
+      *key = self->items[i]->key;
+      *val = self->items[i]->val;
+      *pos = i + 1;
+      return true;
     }
   }
+
+  *pos = self->max;
+  return false;
 }
 
+// items only exist in dictionaries, so records are converted first
 R_item *R_table_get_item(R_box *table, R_box *key) {
+  if(table->table->shape != NULL) {
+    R_table_dictify(table);
+  }
+
   uint32_t cur = table->table->cur;
   uint32_t max = table->table->max;
   R_item **items = table->table->items;
@@ -67,6 +313,11 @@ R_item *R_table_get_item(R_box *table, R_box *key) {
 }
 
 R_box *R_table_get(R_box *table, R_box *key) {
+  if(table->table->shape != NULL) {
+    int32_t idx = R_shape_find(table->table->shape, key);
+    return idx >= 0 ? &table->table->slots[idx] : NULL;
+  }
+
   R_item *item = R_table_get_item(table, key);
 
   if(item == NULL) {
@@ -77,6 +328,18 @@ R_box *R_table_get(R_box *table, R_box *key) {
 }
 
 void R_table_set(R_box *table, R_box *key, R_box *val) {
+  if(table->table->flags & R_TABLE_WATCHED) {
+    atomic_fetch_add_explicit(&R_table_epoch, 1, memory_order_relaxed);
+  }
+
+  if(table->table->shape != NULL) {
+    if(R_record_set(table, key, val)) {
+      return;
+    }
+
+    R_table_dictify(table);
+  }
+
   R_table_set_aux(table, key, val, NULL);
 }
 
@@ -89,7 +352,8 @@ void R_table_set_aux(R_box *table, R_box *key, R_box *val, R_item *item) {
 
   while(1) {
     if(items[idx] == NULL) {
-      items[idx] = (item == NULL) ? GC_malloc(sizeof(R_item)) : item;
+      items[idx] = (item == NULL) ? R_alloc(R_KIND_ITEM, sizeof(R_item)) : item;
+      R_heap_write_slot(&items[idx]);
       items[idx]->hash = key_hash;
       items[idx]->key = *key;
       items[idx]->val = *val;
@@ -100,6 +364,7 @@ void R_table_set_aux(R_box *table, R_box *key, R_box *val, R_item *item) {
 
     if(items[idx]->hash == key_hash && R_hash_eq(key, &items[idx]->key)) {
       items[idx]->val = *val;
+      R_heap_write(items[idx]);
       break;
     }
 
@@ -107,14 +372,6 @@ void R_table_set_aux(R_box *table, R_box *key, R_box *val, R_item *item) {
   }
 
   if(cur > max / 2) {
-    table->table->cur = 0;
-    table->table->max *= 2;
-    table->table->items = GC_malloc(sizeof(R_item *) * max * 2);
-
-    for(int i=0; i<max; i++) {
-      if(items[i] != NULL) {
-        R_table_set_aux(table, &items[i]->key, &items[i]->val, items[i]);
-      }
-    }
+    R_table_reserve(table, 0);
   }
 }
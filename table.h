@@ -5,6 +5,26 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+
+#define R_SHAPE_MAX 16
+
+// set on tables that method caches depend on; changing one of them moves
+// R_table_epoch, which every cache compares against
+#define R_TABLE_WATCHED 0x1
+
+extern _Atomic uint64_t R_table_epoch;
+
+// shapes are shared by every record with the same keys in the same order.
+// they're never freed, and hold their own copies of the keys.
+typedef struct R_shape {
+  uint32_t num_keys;
+  char **keys;
+  uint32_t num_children;
+  struct R_shape **children;
+} R_shape;
+
+extern R_shape R_shape_root;
 
 uint64_t R_hash(R_box *val);
 bool R_hash_eq(R_box *lhs, R_box *rhs);
@@ -13,5 +33,9 @@ void R_table_set(R_box *table, R_box *key, R_box *value);
 void R_table_set_aux(R_box *table, R_box *key, R_box *value, R_item *item);
 R_item *R_table_get_item(R_box *table, R_box *key);
 R_box *R_table_get(R_box *table, R_box *key);
+void R_table_reserve(R_box *table, uint32_t want);
+void R_table_rehash(R_box *table);
+void R_table_merge(R_box *dst, R_box *src);
+bool R_table_next(R_box *table, uint32_t *pos, R_box *key, R_box *val);
 
 #endif
@@ -0,0 +1,47 @@
+# --alloc charges allocations inside register runs to the stack instructions
+# they were translated from, and still finds the names functions are stored
+# under, so the report reads the same as one taken with --no-regs
+
+from util import Module, scratch, run, expect
+
+scratch()
+
+m = Module('main')
+make = m.add_block()
+
+with m.goto(m.main):
+  m.const(make)
+  m.set_name('make')
+  m.call_name('make', 0)
+  m.pop()
+  m.call_name('make', 0)
+  m.pop()
+  m.ret()
+
+with m.goto(make):
+  m.push_table()
+  m.set_name('t')
+  m.const(1)
+  m.const('k')
+  m.get_name('t')
+  m.set()
+  m.get_name('t')
+  m.save()
+  m.ret()
+
+m.write()
+
+
+# translating to register ops allocates too, so leave out what's outside
+def report(*args):
+  res = run('rain', *args, '--alloc', 'main.rnc')
+  expect('status', res.returncode, 0)
+  return [line for line in res.stderr.decode().splitlines() if '(outside)' not in line]
+
+
+regs = report()
+stack = report('--no-regs')
+
+expect('make', any(line.endswith('  make') for line in regs), True)
+expect('REGS', any('REGS' in line for line in regs), False)
+expect('report', regs, stack)
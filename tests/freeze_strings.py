@@ -0,0 +1,41 @@
+# frozen strings keep everything after an embedded NUL, and tables with a
+# meta are refused instead of losing it
+
+from util import Module, scratch, run, expect
+
+scratch()
+
+m = Module('main')
+with m.goto(m.main):
+  m.push_table()
+  m.set_name('t')
+  m.const('"a\\u0000bc"')
+  m.call_name('json_decode', 1)
+  m.const('s')
+  m.get_name('t')
+  m.set()
+  m.get_name('t')
+  m.call_name('freeze', 1)
+  m.set_name('f')
+  m.const('s')
+  m.get_name('f')
+  m.get()
+  m.set_name('v')
+  m.get_name('v')
+  m.call_name('len', 1)
+  m.print()
+  m.get_name('v')
+  m.call_name('json_encode', 1)
+  m.print()
+  m.push_table()
+  m.push_table()
+  m.set_meta()
+  m.call_name('freeze', 1)
+  m.print()
+  m.ret()
+m.write()
+
+res = run('rain', 'main.rnc')
+expect('status', res.returncode, 0)
+expect('output', res.stdout, b'4\n"a\\u0000bc"\nnull\n')
+expect('error', b'metas' in res.stderr, True)
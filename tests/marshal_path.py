@@ -0,0 +1,28 @@
+# marshal(val, path) fails for a value it can't write, like a C function,
+# and leaves no file
+
+import os
+from util import Module, scratch, run, expect
+
+scratch()
+
+m = Module('main')
+
+with m.goto(m.main):
+  m.get_name('print')
+  m.const('cfunc.bin')
+  m.call_name('marshal', 2)
+  m.print()
+  m.const(7)
+  m.const('int.bin')
+  m.call_name('marshal', 2)
+  m.print()
+  m.ret()
+
+m.write()
+
+res = run('rain', 'main.rnc')
+expect('status', res.returncode, 0)
+expect('output', res.stdout, b'false\ntrue\n')
+expect('cfunc.bin', os.path.exists('cfunc.bin'), False)
+expect('int.bin', os.path.exists('int.bin'), True)
@@ -0,0 +1,74 @@
+# a linked image still calls an exported function that another module
+# replaced at runtime, in a way rainld can't see
+
+from util import Module, scratch, run, expect
+
+scratch()
+
+m = Module('lib')
+old = m.add_block()
+with m.goto(m.main):
+  m.push_table()
+  m.set_name('t')
+  m.const(old)
+  m.const('f')
+  m.get_name('t')
+  m.set()
+  m.get_name('t')
+  m.save()
+  m.ret()
+with m.goto(old):
+  m.const('old')
+  m.print()
+  m.ret()
+m.write()
+
+# patch replaces lib.f by merging in a table with a key decoded at runtime
+m = Module('patch')
+new = m.add_block()
+with m.goto(m.main):
+  m.push_table()
+  m.set_name('patch')
+  m.const(new)
+  m.const('"f"')
+  m.call_name('json_decode', 1)
+  m.get_name('patch')
+  m.set()
+  m.const('lib.rnc')
+  m.imp()
+  m.get_name('patch')
+  m.call_name('merge', 2)
+  m.pop()
+  m.ret()
+with m.goto(new):
+  m.const('new')
+  m.print()
+  m.ret()
+m.write()
+
+m = Module('main')
+with m.goto(m.main):
+  m.const('patch.rnc')
+  m.imp()
+  m.pop()
+  m.const('lib.rnc')
+  m.imp()
+  m.set_name('lib')
+  m.const('f')
+  m.get_name('lib')
+  m.get()
+  m.call(0)
+  m.pop()
+  m.ret()
+m.write()
+
+want = b'new\n'
+
+res = run('rain', 'main.rnc')
+expect('unlinked', res.stdout, want)
+
+res = run('rainld', 'main.rnc', 'main.img')
+expect('link status', res.returncode, 0)
+
+res = run('rain', 'main.img')
+expect('linked', res.stdout, want)
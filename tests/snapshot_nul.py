@@ -0,0 +1,35 @@
+# strings with an embedded NUL come back from a snapshot whole, not cut off
+# at the NUL
+
+from util import Module, scratch, run, expect
+
+scratch()
+
+m = Module('value')
+with m.goto(m.main):
+  m.const('"a\\u0000bc"')
+  m.call_name('json_decode', 1)
+  m.save()
+  m.ret()
+m.write()
+
+m = Module('check')
+with m.goto(m.main):
+  m.const('value.rnc')
+  m.imp()
+  m.set_name('v')
+  m.get_name('v')
+  m.call_name('len', 1)
+  m.print()
+  m.get_name('v')
+  m.call_name('json_encode', 1)
+  m.print()
+  m.ret()
+m.write()
+
+res = run('rain', '--snapshot', 'value.img', 'value.rnc')
+expect('snapshot status', res.returncode, 0)
+
+res = run('rain', '--from-snapshot', 'value.img', 'check.rnc')
+expect('restore status', res.returncode, 0)
+expect('output', res.stdout, b'4\n"a\\u0000bc"\n')
@@ -0,0 +1,54 @@
+# helpers for the tests in this directory. each test builds its modules with
+# rvmpy in a scratch directory and runs the binaries built by `make` on them.
+
+import atexit
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, ROOT)
+
+import rvmpy
+
+
+class Module(rvmpy.Module):
+  def const(self, val):
+    self.push_const(self.add_const(val))
+
+  def get_name(self, name):
+    self.const(name)
+    self.push_scope()
+    self.get()
+
+  def set_name(self, name):
+    self.const(name)
+    self.push_scope()
+    self.set()
+
+  # call a builtin or function in scope with args already on the stack
+  def call_name(self, name, argc):
+    self.get_name(name)
+    self.call(argc)
+
+
+def scratch():
+  path = tempfile.mkdtemp(prefix='rain-test-')
+  atexit.register(shutil.rmtree, path, True)
+  os.chdir(path)
+  return path
+
+
+def run(exe, *args, input=None):
+  env = dict(os.environ)
+  env['LD_LIBRARY_PATH'] = ROOT + ':' + env.get('LD_LIBRARY_PATH', '')
+  return subprocess.run([os.path.join(ROOT, exe)] + list(args), input=input,
+                        stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                        env=env, timeout=60)
+
+
+def expect(what, got, want):
+  if got != want:
+    sys.exit('{}: expected {!r}, got {!r}'.format(what, want, got))
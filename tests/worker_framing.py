@@ -0,0 +1,74 @@
+# a length-prefixed worker frames every handler result, not just strings, so
+# one odd result doesn't desync the records after it
+
+import struct
+from util import Module, scratch, run, expect
+
+scratch()
+
+m = Module('worker')
+handle = m.add_block()
+as_int = m.add_block()
+as_table = m.add_block()
+
+# the handler runs in a copy of the module scope so it can see len
+with m.goto(m.main):
+  m.const(handle)
+  m.push_scope()
+  m.set_meta()
+  m.set_name('handle')
+  m.ret()
+
+# records are told apart by length: three bytes answer an int, five a table
+with m.goto(handle):
+  m.fit(1)
+  m.set_name('x')
+  m.get_name('x')
+  m.call_name('len', 1)
+  m.const(3)
+  m.eq()
+  m.jump_if(as_int)
+  m.get_name('x')
+  m.call_name('len', 1)
+  m.const(5)
+  m.eq()
+  m.jump_if(as_table)
+  m.get_name('x')
+  m.save()
+  m.ret()
+
+with m.goto(as_int):
+  m.const(42)
+  m.save()
+  m.ret()
+
+with m.goto(as_table):
+  m.push_table()
+  m.save()
+  m.ret()
+
+m.write()
+
+
+def frame(data):
+  return struct.pack('<I', len(data)) + data
+
+
+def unframe(data):
+  records = []
+  while data:
+    size, = struct.unpack('<I', data[:4])
+    records.append(data[4:4 + size])
+    data = data[4 + size:]
+  return records
+
+
+res = run('rain', '--worker', '--length-prefixed', 'worker.rnc',
+          input=b''.join(frame(r) for r in [b'a', b'int', b'b', b'table', b'c']))
+expect('status', res.returncode, 0)
+
+out = unframe(res.stdout)
+expect('records', len(out), 5)
+expect('strings', [out[0], out[2], out[4]], [b'a', b'b', b'c'])
+expect('int', out[1], b'42')
+expect('table', out[3].startswith(b'table 0x'), True)
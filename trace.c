@@ -0,0 +1,125 @@
+#include "rain.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// path and VM for the signal handlers; only one VM per process dumps on
+// signals
+static R_vm *R_trace_vm;
+static char R_trace_path[4096];
+
+static uint64_t R_trace_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool R_write_all(int fd, const void *buf, size_t len) {
+  const char *pos = buf;
+
+  while(len > 0) {
+    ssize_t rv = write(fd, pos, len);
+    if(rv <= 0) {
+      return false;
+    }
+
+    pos += rv;
+    len -= rv;
+  }
+
+  return true;
+}
+
+// only uses async-signal-safe calls so it can run from a signal handler
+bool vm_trace_dump(R_vm *this, int fd) {
+  R_trace *trace = this->trace;
+  R_trace_header header;
+
+  if(trace == NULL) {
+    return false;
+  }
+
+  uint64_t size = trace->mask + 1;
+  uint64_t head = trace->head;
+  uint64_t count = head < size ? head : size;
+
+  memcpy(header.magic, "RVMT", 4);
+  header.version = 1;
+  header.event_size = sizeof(R_event);
+  header.count = count;
+  header.lost = head - count;
+  header.ticks_start = trace->ticks_start;
+  header.ns_start = trace->ns_start;
+  header.ticks_end = R_trace_ticks();
+  header.ns_end = R_trace_ns();
+
+  if(!R_write_all(fd, &header, sizeof(header))) {
+    return false;
+  }
+
+  // oldest first: the tail of the ring, then its head
+  uint64_t first = (head - count) & trace->mask;
+  uint64_t tail = count < size - first ? count : size - first;
+
+  return R_write_all(fd, trace->events + first, sizeof(R_event) * tail) &&
+         R_write_all(fd, trace->events, sizeof(R_event) * (count - tail));
+}
+
+static void R_trace_signal(int sig) {
+  int fd = open(R_trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd >= 0) {
+    vm_trace_dump(R_trace_vm, fd);
+    close(fd);
+  }
+
+  // crashes carry on to the default action after dumping
+  if(sig != SIGUSR1) {
+    signal(sig, SIG_DFL);
+    raise(sig);
+  }
+}
+
+// keep the last `events` (rounded up to a power of two) events. when path is
+// given, the buffer is written there on SIGUSR1 and on crashes.
+bool vm_trace_enable(R_vm *this, uint32_t events, const char *path) {
+  uint64_t size = 1;
+  while(size < events) {
+    size <<= 1;
+  }
+
+  R_trace *trace = calloc(1, sizeof(R_trace));
+  trace->events = calloc(size, sizeof(R_event));
+  if(trace->events == NULL) {
+    fprintf(stderr, "Unable to allocate trace buffer\n");
+    free(trace);
+    return false;
+  }
+
+  trace->mask = size - 1;
+  trace->ticks_start = R_trace_ticks();
+  trace->ns_start = R_trace_ns();
+  this->trace = trace;
+
+  if(path == NULL) {
+    return true;
+  }
+
+  if(strlen(path) >= sizeof(R_trace_path)) {
+    fprintf(stderr, "Trace path too long: %s\n", path);
+    return false;
+  }
+
+  strcpy(R_trace_path, path);
+  R_trace_vm = this;
+
+  signal(SIGUSR1, R_trace_signal);
+  signal(SIGSEGV, R_trace_signal);
+  signal(SIGBUS, R_trace_signal);
+  signal(SIGFPE, R_trace_signal);
+  signal(SIGABRT, R_trace_signal);
+
+  return true;
+}
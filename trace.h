@@ -0,0 +1,75 @@
+#ifndef R_TRACE_H
+#define R_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define R_TRACE_EVENTS 65536
+
+#define R_EV_CALL     0x01 // a = target, b = argc
+#define R_EV_RETURN   0x02 // a = return address
+#define R_EV_CFUNC    0x03 // a = argc, b = function pointer
+#define R_EV_IMPORT   0x04 // a = module start, b = registry index
+#define R_EV_RESIZE   0x05 // a = old capacity, b = new capacity
+#define R_EV_GC_BEGIN 0x06
+#define R_EV_GC_END   0x07 // b = pause in ns
+
+// fixed size binary records; times are raw ticks, converted by the decoder
+// using the calibration in the file header
+typedef struct R_event {
+  uint64_t time;
+  uint32_t kind;
+  uint32_t a;
+  uint64_t b;
+} R_event;
+
+typedef struct R_trace_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t event_size;
+  uint32_t count;
+  uint64_t lost;
+  uint64_t ticks_start;
+  uint64_t ns_start;
+  uint64_t ticks_end;
+  uint64_t ns_end;
+} R_trace_header;
+
+typedef struct R_trace {
+  uint64_t mask;
+  uint64_t head;
+  uint64_t ticks_start;
+  uint64_t ns_start;
+  R_event *events;
+} R_trace;
+
+struct R_vm;
+
+static inline uint64_t R_trace_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline void R_trace_emit(R_trace *trace, uint32_t kind, uint32_t a, uint64_t b) {
+  R_event *ev = &trace->events[trace->head & trace->mask];
+  ev->time = R_trace_ticks();
+  ev->kind = kind;
+  ev->a = a;
+  ev->b = b;
+  trace->head += 1;
+}
+
+#define R_TRACE(vm, kind, a, b) do { \
+  if((vm) != NULL && (vm)->trace != NULL) R_trace_emit((vm)->trace, kind, a, b); \
+} while(0)
+
+bool vm_trace_enable(struct R_vm *this, uint32_t events, const char *path);
+bool vm_trace_dump(struct R_vm *this, int fd);
+
+#endif
@@ -0,0 +1,68 @@
+#include "rain.h"
+#include <stdio.h>
+#include <string.h>
+
+// decodes a trace written by vm_trace_dump
+int main(int argv, char **argc) {
+  if(argv < 2) {
+    fprintf(stderr, "Usage: %s FILE\n", argc[0]);
+    return 1;
+  }
+
+  FILE *fp = fopen(argc[1], "rb");
+  if(fp == NULL) {
+    fprintf(stderr, "Unable to open file %s\n", argc[1]);
+    return 1;
+  }
+
+  R_trace_header header;
+  if(fread(&header, sizeof(header), 1, fp) != 1 ||
+     memcmp(header.magic, "RVMT", 4) != 0 ||
+     header.event_size != sizeof(R_event)) {
+    fprintf(stderr, "Not a trace file: %s\n", argc[1]);
+    return 1;
+  }
+
+  double ns_per_tick = 1.0;
+  if(header.ticks_end > header.ticks_start) {
+    ns_per_tick = (double)(header.ns_end - header.ns_start) /
+                  (double)(header.ticks_end - header.ticks_start);
+  }
+
+  printf("Events (%u, %lu lost):\n", header.count, (unsigned long)header.lost);
+
+  R_event ev;
+  while(fread(&ev, sizeof(ev), 1, fp) == 1) {
+    double us = (double)(ev.time - header.ticks_start) * ns_per_tick / 1000.0;
+    printf("%14.3f ", us);
+
+    switch(ev.kind) {
+      case R_EV_CALL:
+        printf("call     to = %04x, argc = %lu\n", ev.a, (unsigned long)ev.b);
+        break;
+      case R_EV_RETURN:
+        printf("return   to = %04x\n", ev.a);
+        break;
+      case R_EV_CFUNC:
+        printf("cfunc    0x%08lx, argc = %u\n", (unsigned long)ev.b, ev.a);
+        break;
+      case R_EV_IMPORT:
+        printf("import   start = %04x, module = %lu\n", ev.a, (unsigned long)ev.b);
+        break;
+      case R_EV_RESIZE:
+        printf("resize   %u -> %lu\n", ev.a, (unsigned long)ev.b);
+        break;
+      case R_EV_GC_BEGIN:
+        printf("gc begin\n");
+        break;
+      case R_EV_GC_END:
+        printf("gc end   %.3f us\n", ev.b / 1000.0);
+        break;
+      default:
+        printf("unknown  %02x\n", ev.kind);
+    }
+  }
+
+  fclose(fp);
+  return 0;
+}
@@ -1,11 +1,25 @@
 #include "rain.h"
 
+#include <dlfcn.h>
 #include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+static void vm_builtin(R_box *table, char *name, void (*fn)(R_vm *)) {
+  R_box key;
+  R_box val;
+
+  R_set_str(&key, name);
+  R_set_cfunc(&val, fn);
+  R_table_set(table, &key, &val);
+}
 
 R_vm *vm_new() {
-  GC_init();
+  R_heap_init();
 
-  R_vm *this = GC_malloc(sizeof(R_vm));
+  R_vm *this = R_alloc(R_KIND_VM, sizeof(R_vm));
+  R_heap_vm = this;
 
   this->num_consts = 0;
   this->num_instrs = 0;
@@ -20,119 +34,361 @@ R_vm *vm_new() {
   this->scope_size = 10;
   this->frame_size = 10;
 
-  this->consts = GC_malloc(sizeof(R_box));
-  this->instrs = GC_malloc(sizeof(R_op));
-  this->strings = GC_malloc(sizeof(char *));
-
-  this->stack = GC_malloc(sizeof(R_box) * this->stack_size);
-  this->frames = GC_malloc(sizeof(R_frame) * this->frame_size);
+  this->consts = R_alloc(R_KIND_BOXES, sizeof(R_box));
+  this->instrs = R_alloc(R_KIND_RAW, sizeof(R_op));
+  this->strings = R_alloc(R_KIND_STRS, sizeof(char *));
+
+  this->num_natives = 0;
+  this->natives = NULL;
+
+  this->use_regs = true;
+  this->num_reg_ops = 0;
+  this->reg_ops = NULL;
+  this->reg_replaced = NULL;
+
+  this->num_modules = 0;
+  this->modules = NULL;
+
+  this->num_methods = 0;
+  this->methods = NULL;
+
+  this->trace = NULL;
+  this->alloc_prof = NULL;
+  this->prefetch = NULL;
+
+  this->run_instrs = 0;
+  this->run_cpu_ns = 0;
+  this->run_slices = 0;
+
+  this->stack = R_alloc(R_KIND_BOXES, sizeof(R_box) * this->stack_size);
+  this->frames = R_alloc(R_KIND_FRAMES, sizeof(R_frame) * this->frame_size);
+
+  R_heap_root(this);
+
+  // shared by every module as the meta of its scope
+  this->builtins = R_alloc(R_KIND_BOX, sizeof(R_box));
+  R_set_table(this->builtins);
+  vm_builtin(this->builtins, "load", R_builtin_load);
+  vm_builtin(this->builtins, "print", R_builtin_print);
+  vm_builtin(this->builtins, "json_decode", R_builtin_json_decode);
+  vm_builtin(this->builtins, "json_encode", R_builtin_json_encode);
+  vm_builtin(this->builtins, "marshal", R_builtin_marshal);
+  vm_builtin(this->builtins, "unmarshal", R_builtin_unmarshal);
+  vm_builtin(this->builtins, "meta", R_builtin_meta);
+  vm_builtin(this->builtins, "scope", R_builtin_scope);
+  vm_builtin(this->builtins, "import", R_builtin_import);
+  vm_builtin(this->builtins, "heap_stats", R_builtin_heap_stats);
+  vm_builtin(this->builtins, "ints", R_builtin_ints);
+  vm_builtin(this->builtins, "floats", R_builtin_floats);
+  vm_builtin(this->builtins, "to_table", R_builtin_to_table);
+  vm_builtin(this->builtins, "sum", R_builtin_sum);
+  vm_builtin(this->builtins, "min", R_builtin_min);
+  vm_builtin(this->builtins, "max", R_builtin_max);
+  vm_builtin(this->builtins, "dot", R_builtin_dot);
+  vm_builtin(this->builtins, "len", R_builtin_len);
+  vm_builtin(this->builtins, "mmap", R_builtin_mmap);
+  vm_builtin(this->builtins, "slice", R_builtin_slice);
+  vm_builtin(this->builtins, "find", R_builtin_find);
+  vm_builtin(this->builtins, "read_int", R_builtin_read_int);
+  vm_builtin(this->builtins, "parse_int", R_builtin_parse_int);
+  vm_builtin(this->builtins, "to_str", R_builtin_to_str);
+  vm_builtin(this->builtins, "drop", R_builtin_drop);
+  vm_builtin(this->builtins, "clone", R_builtin_clone);
+  vm_builtin(this->builtins, "merge", R_builtin_merge);
+  vm_builtin(this->builtins, "freeze", R_builtin_freeze);
+  vm_builtin(this->builtins, "frozen", R_builtin_frozen);
 
   return this;
 }
 
-bool vm_import(R_vm *this, const char *fname) {
-  FILE *fp = fopen(fname, "rb");
+// release a VM nothing will run or look at again, along with everything on
+// the heap only it could reach. a VM being traced to a file or sampled by the
+// profiler has to outlive that.
+void vm_free(R_vm *this) {
+  if(this->trace != NULL) {
+    free(this->trace->events);
+    free(this->trace);
+  }
 
-  if(fp == NULL) {
-    fprintf(stderr, "Unable to open file %s\n", fname);
-    return false;
+  if(this->alloc_prof != NULL) {
+    free(this->alloc_prof->sites);
+    free(this->alloc_prof);
+  }
+
+  if(R_heap_vm == this) {
+    R_heap_vm = NULL;
   }
 
+  R_heap_unroot(this);
+}
+
+bool vm_import(R_vm *this, const char *fname) {
+  R_heap_vm = this;
+
   uint32_t module_start = this->num_instrs;
-  if(!vm_load(this, fp)) {
-    fprintf(stderr, "Unable to load bytecode\n");
-    fclose(fp);
-    return false;
+  size_t len = strlen(fname);
+
+  if(len > 3 && strcmp(fname + len - 3, ".so") == 0) {
+    if(!vm_load_native(this, fname)) {
+      return false;
+    }
   }
+  else {
+    R_unit unit;
+    bool ok = false;
 
-  R_box builtins;
-  R_box key;
-  R_box val;
+    // a prefetched module has already been read and checked on another
+    // thread, so all that's left to do here is splice it in
+    if(this->prefetch == NULL || !R_prefetch_take(this->prefetch, fname, &unit, &ok)) {
+      FILE *fp = fopen(fname, "rb");
+
+      if(fp == NULL) {
+        fprintf(stderr, "Unable to open file %s\n", fname);
+        return false;
+      }
 
-  R_set_table(&builtins);
-  R_set_str(&key, "load");
-  R_set_cfunc(&val, R_builtin_load);
-  R_table_set(&builtins, &key, &val);
+      ok = vm_parse(fp, &unit);
+      fclose(fp);
+    }
 
-  R_set_str(&key, "print");
-  R_set_cfunc(&val, R_builtin_print);
-  R_table_set(&builtins, &key, &val);
+    if(!ok) {
+      fprintf(stderr, "%s\n", unit.error);
+      fprintf(stderr, "Unable to load bytecode\n");
+      vm_unit_free(&unit);
+      return false;
+    }
 
-  R_set_str(&key, "meta");
-  R_set_cfunc(&val, R_builtin_meta);
-  R_table_set(&builtins, &key, &val);
+    // start on its imports before the body gets to them
+    if(this->prefetch != NULL) {
+      R_prefetch_scan(this->prefetch, &unit);
+    }
 
-  R_set_str(&key, "scope");
-  R_set_cfunc(&val, R_builtin_scope);
-  R_table_set(&builtins, &key, &val);
+    vm_splice(this, &unit);
+    vm_unit_free(&unit);
 
-  R_set_str(&key, "import");
-  R_set_cfunc(&val, R_builtin_import);
-  R_table_set(&builtins, &key, &val);
+    if(this->use_regs) {
+      vm_regs_translate(this, module_start);
+    }
+  }
 
-  vm_call(this, module_start, &builtins, 0);
+  vm_import_at(this, fname, module_start);
   return true;
 }
 
-bool vm_load(R_vm *this, FILE *fp) {
+// register the module already loaded at module_start under its canonical path
+// and file identity, and call its body
+void vm_import_at(R_vm *this, const char *fname, uint32_t module_start) {
+  struct stat st;
+  char *path = realpath(fname, NULL);
+  uint32_t idx = this->num_modules;
+
+  this->num_modules += 1;
+  this->modules = R_realloc(this->modules, R_KIND_MODULES,
+                            sizeof(R_module) * this->num_modules);
+
+  R_module *mod = &this->modules[idx];
+  R_box path_box;
+  R_set_strcpy(&path_box, path != NULL ? path : fname);
+  free(path);
+
+  mod->path = path_box.str;
+  mod->dev = 0;
+  mod->ino = 0;
+  if(stat(fname, &st) == 0) {
+    mod->dev = st.st_dev;
+    mod->ino = st.st_ino;
+  }
+
+  mod->start = module_start;
+  mod->ready = false;
+  R_set_null(&mod->value);
+  R_set_table(&mod->scope);
+  mod->scope.meta = this->builtins;
+
+  R_TRACE(this, R_EV_IMPORT, module_start, idx);
+  R_PROBE3(import, this, fname, module_start);
+  vm_call(this, module_start, &mod->scope, 0);
+  this->frame->module = idx + 1;
+}
+
+R_module *vm_module(R_vm *this, const char *fname) {
+  struct stat st;
+
+  if(stat(fname, &st) != 0) {
+    return NULL;
+  }
+
+  for(uint32_t i=0; i<this->num_modules; i++) {
+    R_module *mod = &this->modules[i];
+    if(mod->dev == st.st_dev && mod->ino == st.st_ino) {
+      return mod;
+    }
+  }
+
+  return NULL;
+}
+
+R_module *vm_module_at(R_vm *this, uint32_t start) {
+  for(uint32_t i=0; i<this->num_modules; i++) {
+    if(this->modules[i].start == start) {
+      return &this->modules[i];
+    }
+  }
+
+  return NULL;
+}
+
+// read a module into unit without touching any VM, so it can happen on any
+// thread. every index the loader follows is checked to stay inside the module.
+bool vm_parse(FILE *fp, R_unit *unit) {
+  R_header *header = &unit->header;
   size_t rv;
-  R_header header;
 
-  // save previous counts
-  uint32_t prev_consts = this->num_consts;
-  uint32_t prev_instrs = this->num_instrs;
-  uint32_t prev_strings = this->num_strings;
+  memset(unit, 0, sizeof(R_unit));
 
   // read header information
-  rv = fread(&header, sizeof(R_header), 1, fp);
+  rv = fread(header, sizeof(R_header), 1, fp);
   if(rv != 1) {
-    fprintf(stderr, "Unable to read header\n");
+    snprintf(unit->error, sizeof(unit->error), "Unable to read header");
     return false;
   }
 
-  // increment counts
-  this->num_consts += header.num_consts;
-  this->num_instrs += header.num_instrs;
-  this->num_strings += header.num_strings;
+  unit->offsets = malloc(sizeof(uint32_t) * header->num_strings);
+  unit->consts = malloc(sizeof(R_box) * header->num_consts);
+  unit->instrs = malloc(sizeof(R_op) * header->num_instrs);
 
-  // resize arrays
-  this->consts = GC_realloc(this->consts, sizeof(R_box) * this->num_consts);
-  this->instrs = GC_realloc(this->instrs, sizeof(R_op) * this->num_instrs);
-  this->strings = GC_realloc(this->strings, sizeof(char *) * this->num_strings);
+  if((unit->offsets == NULL && header->num_strings > 0) ||
+     (unit->consts == NULL && header->num_consts > 0) ||
+     (unit->instrs == NULL && header->num_instrs > 0)) {
+    snprintf(unit->error, sizeof(unit->error), "Unable to allocate module");
+    return false;
+  }
 
   // read all strings
   uint32_t len = 0;
-  for(uint32_t i=prev_strings; i<this->num_strings; i++) {
+  size_t used = 0;
+  size_t size = 0;
+  for(uint32_t i=0; i<header->num_strings; i++) {
     rv = fread(&len, sizeof(int), 1, fp);
     if(rv != 1) {
-      fprintf(stderr, "Unable to read string %d length\n", i);
+      snprintf(unit->error, sizeof(unit->error), "Unable to read string %d length", i);
       return false;
     }
 
-    this->strings[i] = GC_malloc_atomic(len + 1);
-    rv = fread(this->strings[i], 1, len, fp);
+    if(used + len + 1 > UINT32_MAX) {
+      snprintf(unit->error, sizeof(unit->error), "Unable to read string %d", i);
+      return false;
+    }
+
+    if(used + len + 1 > size) {
+      size = (used + len + 1) * 2;
+      char *chars = realloc(unit->chars, size);
+
+      if(chars == NULL) {
+        snprintf(unit->error, sizeof(unit->error), "Unable to read string %d", i);
+        return false;
+      }
+
+      unit->chars = chars;
+    }
+
+    rv = fread(unit->chars + used, 1, len, fp);
     if(rv != len) {
-      fprintf(stderr, "Unable to read string %d\n", i);
+      snprintf(unit->error, sizeof(unit->error), "Unable to read string %d", i);
       return false;
     }
 
-    this->strings[i][len] = 0;
+    unit->offsets[i] = used;
+    unit->chars[used + len] = 0;
+    used += len + 1;
   }
 
   // read all constants
-  rv = fread(this->consts + prev_consts, sizeof(R_box), header.num_consts, fp);
-  if(rv != header.num_consts) {
-    fprintf(stderr, "Unable to read constants\n");
+  rv = fread(unit->consts, sizeof(R_box), header->num_consts, fp);
+  if(rv != header->num_consts) {
+    snprintf(unit->error, sizeof(unit->error), "Unable to read constants");
     return false;
   }
 
   // read all instructions
-  rv = fread(this->instrs + prev_instrs, sizeof(R_op), header.num_instrs, fp);
-  if(rv != header.num_instrs) {
-    fprintf(stderr, "Unable to read instructions\n");
+  rv = fread(unit->instrs, sizeof(R_op), header->num_instrs, fp);
+  if(rv != header->num_instrs) {
+    snprintf(unit->error, sizeof(unit->error), "Unable to read instructions");
     return false;
   }
 
+  for(uint32_t i=0; i<header->num_consts; i++) {
+    if(R_TYPE_IS(&unit->consts[i], STR) && unit->consts[i].u64 >= header->num_strings) {
+      snprintf(unit->error, sizeof(unit->error), "Constant %d has no string", i);
+      return false;
+    }
+  }
+
+  for(uint32_t i=0; i<header->num_instrs; i++) {
+    R_op *instr = &unit->instrs[i];
+    uint32_t idx = R_OP(instr) == CALL_METHOD ? R_UI(instr) >> 8 : R_UI(instr);
+
+    if((R_OP(instr) == PUSH_CONST || R_OP(instr) == CALL_METHOD) &&
+       idx >= header->num_consts) {
+      snprintf(unit->error, sizeof(unit->error), "Instruction %d has no constant", i);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void vm_unit_free(R_unit *unit) {
+  free(unit->chars);
+  free(unit->offsets);
+  free(unit->consts);
+  free(unit->instrs);
+  memset(unit, 0, sizeof(R_unit));
+}
+
+bool vm_load(R_vm *this, FILE *fp) {
+  R_unit unit;
+
+  if(!vm_parse(fp, &unit)) {
+    fprintf(stderr, "%s\n", unit.error);
+    vm_unit_free(&unit);
+    return false;
+  }
+
+  vm_splice(this, &unit);
+  vm_unit_free(&unit);
+  return true;
+}
+
+// append a parsed module to the VM's code, relocating it to where it lands
+void vm_splice(R_vm *this, R_unit *unit) {
+  R_header *header = &unit->header;
+
+  // save previous counts
+  uint32_t prev_consts = this->num_consts;
+  uint32_t prev_instrs = this->num_instrs;
+  uint32_t prev_strings = this->num_strings;
+
+  // increment counts
+  this->num_consts += header->num_consts;
+  this->num_instrs += header->num_instrs;
+  this->num_strings += header->num_strings;
+
+  // resize arrays
+  this->consts = R_realloc(this->consts, R_KIND_BOXES, sizeof(R_box) * this->num_consts);
+  this->instrs = R_realloc(this->instrs, R_KIND_RAW, sizeof(R_op) * this->num_instrs);
+  this->strings = R_realloc(this->strings, R_KIND_STRS, sizeof(char *) * this->num_strings);
+
+  for(uint32_t i=0; i<header->num_strings; i++) {
+    const char *str = unit->chars + unit->offsets[i];
+    size_t len = strlen(str);
+    this->strings[prev_strings + i] = R_alloc(R_KIND_RAW, len + 1);
+    memcpy(this->strings[prev_strings + i], str, len + 1);
+  }
+
+  memcpy(this->consts + prev_consts, unit->consts, sizeof(R_box) * header->num_consts);
+  memcpy(this->instrs + prev_instrs, unit->instrs, sizeof(R_op) * header->num_instrs);
+
   // adjust string const pointers
   for(uint32_t i=prev_consts; i<this->num_consts; i++) {
     if(R_TYPE_IS(&this->consts[i], STR)) {
@@ -143,21 +399,99 @@ bool vm_load(R_vm *this, FILE *fp) {
     }
   }
 
-  // adjust instruction indices
+  // make room for the new method call sites
+  uint32_t prev_methods = this->num_methods;
   for(uint32_t i=prev_instrs; i<this->num_instrs; i++) {
+    if(R_OP(&this->instrs[i]) == CALL_METHOD) {
+      this->num_methods += 1;
+    }
+  }
+
+  if(this->num_methods > prev_methods) {
+    this->methods = R_realloc(this->methods, R_KIND_METHODS,
+                              sizeof(R_method_site) * this->num_methods);
+    memset(this->methods + prev_methods, 0,
+           sizeof(R_method_site) * (this->num_methods - prev_methods));
+  }
+
+  // adjust instruction indices. an image linked by rainld and loaded into a
+  // fresh VM has nothing to adjust unless it makes method calls
+  if(prev_consts == 0 && prev_instrs == 0 && this->num_methods == prev_methods) {
+    return;
+  }
+
+  for(uint32_t i=prev_instrs, site=prev_methods; i<this->num_instrs; i++) {
     switch(R_OP(&this->instrs[i])) {
       case PUSH_CONST:
         this->instrs[i].u32 += prev_consts << 8;
         break;
       case CALLTO:
+      case IMPORT_AT:
         this->instrs[i].u32 += prev_instrs << 8;
         break;
+      case CALL_METHOD:
+        // argc in the low byte of the operand, the name's constant above it
+        this->methods[site].name = prev_consts + (R_UI(&this->instrs[i]) >> 8);
+        this->methods[site].argc = R_UI(&this->instrs[i]) & 0xFF;
+        this->instrs[i].u32 = CALL_METHOD | (site << 8);
+        site += 1;
+        break;
     }
   }
+}
+
+bool vm_load_native(R_vm *this, const char *fname) {
+  void *handle = dlopen(fname, RTLD_NOW | RTLD_LOCAL);
+  if(handle == NULL) {
+    fprintf(stderr, "Unable to open native module %s: %s\n", fname, dlerror());
+    return false;
+  }
+
+  const unsigned char *image = dlsym(handle, "R_aot_image");
+  const uint32_t *image_size = dlsym(handle, "R_aot_image_size");
+  R_native_fn fn = (R_native_fn)dlsym(handle, "R_aot_run");
+
+  if(image == NULL || image_size == NULL || fn == NULL) {
+    fprintf(stderr, "Native module %s is missing its image\n", fname);
+    return false;
+  }
+
+  // the embedded bytecode supplies constants and strings and is relocated
+  // like any other module; the native code reads operands from it at runtime
+  FILE *fp = fmemopen((void *)image, *image_size, "rb");
+  uint32_t module_start = this->num_instrs;
+
+  if(fp == NULL || !vm_load(this, fp)) {
+    fprintf(stderr, "Unable to load bytecode\n");
+    if(fp != NULL) {
+      fclose(fp);
+    }
+    return false;
+  }
+
+  fclose(fp);
+
+  this->natives = R_realloc(this->natives, R_KIND_RAW,
+                            sizeof(R_native) * (this->num_natives + 1));
+  this->natives[this->num_natives].start = module_start;
+  this->natives[this->num_natives].count = this->num_instrs - module_start;
+  this->natives[this->num_natives].fn = fn;
+  this->num_natives += 1;
 
   return true;
 }
 
+R_native *vm_native(R_vm *this, uint32_t instr) {
+  for(uint32_t i=0; i<this->num_natives; i++) {
+    R_native *native = &this->natives[i];
+    if(instr >= native->start && instr - native->start < native->count) {
+      return native;
+    }
+  }
+
+  return NULL;
+}
+
 bool vm_exec(R_vm *this, R_op *instr) {
   if(R_OP(instr) < NUM_INSTRS) {
     R_INSTR_TABLE[R_OP(instr)](this, instr);
@@ -169,6 +503,9 @@ bool vm_exec(R_vm *this, R_op *instr) {
 }
 
 bool vm_step(R_vm *this) {
+  R_heap_vm = this;
+  R_heap_safepoint();
+
   if(this->instr_ptr < this->num_instrs) {
     if(vm_exec(this, this->instrs + this->instr_ptr)) {
       this->instr_ptr += 1;
@@ -179,12 +516,165 @@ bool vm_step(R_vm *this) {
   return false;
 }
 
-bool vm_run(R_vm *this) {
+// execute the next instruction, or the native module that covers it
+static inline bool vm_advance(R_vm *this) {
+  if(this->num_natives > 0) {
+    R_native *native = vm_native(this, this->instr_ptr);
+    if(native != NULL) {
+      R_heap_vm = this;
+      native->fn(this, native->start);
+      return true;
+    }
+  }
+
+  return vm_step(this);
+}
+
+static uint64_t vm_clock(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// run at most max_instrs instructions or max_us microseconds, where 0 means
+// no limit. all of the interpreter's state lives in the VM, so after
+// R_RUN_YIELD the next call picks up where this one stopped. the clock is only
+// read every R_RUN_CHECK instructions, and builtins and native modules can't
+// be interrupted, so a slice can overrun by however long those take.
+int vm_run_for(R_vm *this, uint64_t max_instrs, uint64_t max_us) {
+  uint64_t cpu = vm_clock(CLOCK_THREAD_CPUTIME_ID);
+  uint64_t deadline = 0;
+  uint64_t count = 0;
+  int status = R_RUN_DONE;
+
+  if(max_us > 0) {
+    deadline = vm_clock(CLOCK_MONOTONIC) + max_us * 1000;
+  }
+
   while(this->instr_ptr < this->num_instrs) {
-    vm_step(this);
+    if(max_instrs > 0 && count >= max_instrs) {
+      status = R_RUN_YIELD;
+      break;
+    }
+
+    if(deadline > 0 && count > 0 && count % R_RUN_CHECK == 0 &&
+       vm_clock(CLOCK_MONOTONIC) >= deadline) {
+      status = R_RUN_YIELD;
+      break;
+    }
+
+    count += 1;
+
+    if(!vm_advance(this)) {
+      status = R_RUN_ERROR;
+      break;
+    }
   }
 
-  return true;
+  this->run_instrs += count;
+  this->run_cpu_ns += vm_clock(CLOCK_THREAD_CPUTIME_ID) - cpu;
+  this->run_slices += 1;
+
+  return status;
+}
+
+bool vm_run(R_vm *this) {
+  return vm_run_for(this, 0, 0) == R_RUN_DONE;
+}
+
+// call func once for each of count tuples of argc arguments, laid out back to
+// back in args, and store what each call returns in rets. the function, the
+// arguments and the results are kept on the stack for the whole batch so the
+// collector can see and move them. every call is a safepoint, so boxes the
+// caller keeps anywhere else may be stale afterwards. instr_ptr is parked on
+// the entry sentinel while a call runs, so it returns to no code at all and
+// stops the loop below; works from the host as well as from inside a builtin.
+bool vm_invoke_batch(R_vm *this, R_box *func, R_box *args, uint32_t argc,
+                     uint32_t count, R_box *rets) {
+  if(R_TYPE_ISNT(func, FUNC) && R_TYPE_ISNT(func, CFUNC)) {
+    fprintf(stderr, "Unable to invoke a value that isn't a function\n");
+    return false;
+  }
+
+  R_box fn = *func;
+  uint32_t saved = this->instr_ptr;
+  uint32_t depth = this->frame_ptr;
+  uint32_t base = this->stack_ptr;
+  uint32_t results = base + 1;
+  uint32_t tuples = results + count;
+  bool ok = true;
+
+  // the arguments may be on the stack, which moves if it has to grow
+  bool on_stack = args >= this->stack && args < this->stack + this->stack_size;
+  size_t offset = on_stack ? (size_t)(args - this->stack) : 0;
+
+  vm_reserve(this, 1 + count + argc * count + argc + 1);
+  if(on_stack) {
+    args = this->stack + offset;
+  }
+
+  this->stack[base] = fn;
+  memmove(this->stack + tuples, args, sizeof(R_box) * argc * count);
+  for(uint32_t i=0; i<count; i++) {
+    R_set_null(&this->stack[results + i]);
+  }
+  this->stack_ptr = tuples + argc * count;
+
+  for(uint32_t i=0; i<count && ok; i++) {
+    uint32_t top = this->stack_ptr;
+
+    memcpy(this->stack + top, this->stack + tuples + i * argc, sizeof(R_box) * argc);
+    this->stack_ptr += argc;
+
+    R_heap_vm = this;
+    R_heap_safepoint();
+
+    this->instr_ptr = UINT32_MAX - 1;
+    if(!vm_call_box(this, &this->stack[base], argc)) {
+      ok = false;
+      break;
+    }
+    this->instr_ptr += 1;
+
+    while(this->instr_ptr < this->num_instrs) {
+      if(!vm_advance(this)) {
+        ok = false;
+        break;
+      }
+    }
+
+    if(!ok) {
+      this->frame_ptr = depth;
+      if(depth > 0) {
+        this->frame = &this->frames[depth - 1];
+      }
+      break;
+    }
+
+    this->stack[results + i] = vm_pop(this);
+    this->stack_ptr = top;
+  }
+
+  memcpy(rets, this->stack + results, sizeof(R_box) * count);
+  this->stack_ptr = base;
+  this->instr_ptr = saved;
+
+  return ok;
+}
+
+bool vm_invoke(R_vm *this, R_box *func, R_box *args, uint32_t argc, R_box *ret) {
+  return vm_invoke_batch(this, func, args, argc, 1, ret);
+}
+
+// import a module as a new entry point and run it to completion
+bool vm_run_file(R_vm *this, const char *fname) {
+  this->instr_ptr = UINT32_MAX - 1;
+
+  if(!vm_import(this, fname)) {
+    return false;
+  }
+
+  return vm_run(this);
 }
 
 void vm_dump(R_vm *this) {
@@ -245,7 +735,7 @@ void vm_set(R_vm *this, R_box *val) {
 R_box *vm_alloc(R_vm *this) {
   if(this->stack_ptr >= this->stack_size) {
     this->stack_size *= 2;
-    this->stack = GC_realloc(this->stack, sizeof(R_box) * this->stack_size);
+    this->stack = R_realloc(this->stack, R_KIND_BOXES, sizeof(R_box) * this->stack_size);
   }
 
   R_set_null(&this->stack[this->stack_ptr]);
@@ -254,10 +744,23 @@ R_box *vm_alloc(R_vm *this) {
   return &this->stack[this->stack_ptr - 1];
 }
 
+// make room for want more boxes on the stack
+void vm_reserve(R_vm *this, uint32_t want) {
+  if(this->stack_ptr + want <= this->stack_size) {
+    return;
+  }
+
+  while(this->stack_ptr + want > this->stack_size) {
+    this->stack_size *= 2;
+  }
+
+  this->stack = R_realloc(this->stack, R_KIND_BOXES, sizeof(R_box) * this->stack_size);
+}
+
 R_box *vm_push(R_vm *this, R_box *val) {
   if(this->stack_ptr >= this->stack_size) {
     this->stack_size *= 2;
-    this->stack = GC_realloc(this->stack, sizeof(R_box) * this->stack_size);
+    this->stack = R_realloc(this->stack, R_KIND_BOXES, sizeof(R_box) * this->stack_size);
   }
 
   this->stack[this->stack_ptr] = *val;
@@ -271,6 +774,7 @@ void vm_call(R_vm *this, uint32_t to, R_box *scope, uint32_t argc) {
   this->frame->return_to = this->instr_ptr;
   this->frame->argc = argc;
   this->frame->base_ptr = this->stack_ptr - argc;
+  this->frame->module = 0;
   R_set_null(&this->frame->ret);
 
   if(scope == NULL) {
@@ -282,9 +786,55 @@ void vm_call(R_vm *this, uint32_t to, R_box *scope, uint32_t argc) {
 
   this->frame_ptr += 1;
   this->instr_ptr = to;
+  this->stats.scopes += 1;
+  R_TRACE(this, R_EV_CALL, to, argc);
+  R_PROBE3(call, this, to, argc);
+}
+
+// call a function with its argc arguments on top of the stack. like an
+// instruction it leaves instr_ptr one short of where execution continues:
+// builtins have already run and returned, functions start at the next step.
+// anything else isn't callable and leaves the stack alone.
+bool vm_call_box(R_vm *this, R_box *func, uint32_t argc) {
+  R_box fn = *func;
+  R_box scope;
+
+  if(R_TYPE_ISNT(&fn, FUNC) && R_TYPE_ISNT(&fn, CFUNC)) {
+    return false;
+  }
+
+  if(R_has_meta(&fn)) {
+    R_table_clone(fn.meta, &scope);
+  }
+  else {
+    R_set_table(&scope);
+  }
+
+  if(R_TYPE_IS(&fn, FUNC)) {
+    vm_call(this, fn.u64 - 1, &scope, argc);
+    return true;
+  }
+
+  vm_call(this, this->instr_ptr, &scope, argc);
+  R_TRACE(this, R_EV_CFUNC, argc, (uintptr_t)fn.ptr);
+  R_PROBE3(cfunc, this, fn.ptr, argc);
+
+  ((void (*)(R_vm *))fn.ptr)(this);
+
+  vm_ret(this);
+  return true;
 }
 
 void vm_ret(R_vm *this) {
+  if(this->frame->module > 0) {
+    R_module *mod = &this->modules[this->frame->module - 1];
+    mod->value = this->frame->ret;
+    mod->ready = true;
+  }
+
+  R_TRACE(this, R_EV_RETURN, this->frame->return_to, 0);
+  R_PROBE2(return, this, this->frame->return_to);
+
   this->instr_ptr = this->frame->return_to;
   this->stack_ptr = this->frame->base_ptr;
   vm_push(this, &this->frame->ret);
@@ -312,3 +862,14 @@ void vm_fit(R_vm *this, uint32_t want) {
     have -= 1;
   }
 }
+
+void vm_heap_stats(R_vm *this, R_heap_stats *out) {
+  R_heap_gc_stats(out);
+
+  for(int i=0; i<R_NUM_KINDS; i++) {
+    out->count[i] = this->stats.count[i];
+    out->bytes[i] = this->stats.bytes[i];
+  }
+
+  out->scopes = this->stats.scopes;
+}
@@ -2,6 +2,8 @@
 #define R_VM_H
 
 #include "core.h"
+#include "heap.h"
+#include "trace.h"
 #include <stdbool.h>
 
 typedef struct R_header {
@@ -10,14 +12,74 @@ typedef struct R_header {
   uint32_t num_strings;
 } R_header;
 
+// a module read by vm_parse but not yet spliced into a VM. its strings are
+// packed into chars, each starting at its offset, and its constants still
+// hold string indices.
+typedef struct R_unit {
+  R_header header;
+  char *chars;
+  uint32_t *offsets;
+  R_box *consts;
+  R_op *instrs;
+  char error[96]; // why vm_parse failed
+} R_unit;
+
 typedef struct R_frame {
   uint32_t return_to;
   uint32_t base_ptr;
   uint32_t argc;
+  uint32_t module; // registry index + 1 for module bodies, otherwise 0
   R_box scope;
   R_box ret;
 } R_frame;
 
+// every imported file is loaded and initialized once per VM; later imports
+// get the value it saved
+typedef struct R_module {
+  char *path;
+  uint64_t dev;
+  uint64_t ino;
+  uint32_t start;
+  bool ready;
+  R_box scope;
+  R_box value;
+} R_module;
+
+// a CALL_METHOD site. the loader makes one for each CALL_METHOD and points the
+// instruction at it; it holds the name and argument count from the operand and
+// the result of the last lookup, which is reused for receivers with the same
+// meta as long as no table on the meta chain has changed since. receivers
+// with the same shape are known not to have a key by that name themselves.
+typedef struct R_method_site {
+  uint32_t name; // constant index
+  uint32_t argc; // not counting the receiver
+
+  uint64_t epoch;
+  struct R_shape *shape;
+  R_box *meta;
+  R_box method;
+} R_method_site;
+
+// vm_run_for results
+#define R_RUN_DONE  0 // the program ended
+#define R_RUN_YIELD 1 // the budget ran out, call again to resume
+#define R_RUN_ERROR 2 // an instruction couldn't be executed
+
+// how many instructions run between clock checks of a time budget
+#define R_RUN_CHECK 1024
+
+struct R_vm;
+
+// ahead-of-time compiled modules run natively over their range of
+// instructions and return when control leaves it
+typedef void (*R_native_fn)(struct R_vm *, uint32_t);
+
+typedef struct R_native {
+  uint32_t start;
+  uint32_t count;
+  R_native_fn fn;
+} R_native;
+
 typedef struct R_vm {
   uint32_t instr_ptr;
   uint32_t num_consts;
@@ -39,23 +101,69 @@ typedef struct R_vm {
   R_box *stack;
   R_frame *frames;
   R_frame *frame;
+
+  R_heap_stats stats;
+
+  uint32_t num_natives;
+  R_native *natives;
+
+  // register code for runs of stack code, see regs.h
+  bool use_regs;
+  uint32_t num_reg_ops;
+  struct R_reg_op *reg_ops;
+  R_op *reg_replaced;
+
+  uint32_t num_modules;
+  R_module *modules;
+  R_box *builtins;
+
+  uint32_t num_methods;
+  R_method_site *methods;
+
+  R_trace *trace;
+  struct R_alloc_prof *alloc_prof;
+
+  // parses imported modules ahead of vm_import, see prefetch.h
+  struct R_prefetch *prefetch;
+
+  // totals over every vm_run_for call
+  uint64_t run_instrs;
+  uint64_t run_cpu_ns;
+  uint64_t run_slices;
 } R_vm;
 
 R_vm *vm_new();
+void vm_free(R_vm *this);
 bool vm_import(R_vm *this, const char *fname);
+void vm_import_at(R_vm *this, const char *fname, uint32_t module_start);
+R_module *vm_module(R_vm *this, const char *fname);
+R_module *vm_module_at(R_vm *this, uint32_t start);
 bool vm_load(R_vm *this, FILE *fp);
+bool vm_parse(FILE *fp, R_unit *unit);
+void vm_splice(R_vm *this, R_unit *unit);
+void vm_unit_free(R_unit *unit);
+bool vm_load_native(R_vm *this, const char *fname);
+R_native *vm_native(R_vm *this, uint32_t instr);
 bool vm_exec(R_vm *this, R_op *instr);
 bool vm_step(R_vm *this);
 bool vm_run(R_vm *this);
+int vm_run_for(R_vm *this, uint64_t max_instrs, uint64_t max_us);
+bool vm_invoke(R_vm *this, R_box *func, R_box *args, uint32_t argc, R_box *ret);
+bool vm_invoke_batch(R_vm *this, R_box *func, R_box *args, uint32_t argc,
+                     uint32_t count, R_box *rets);
+bool vm_run_file(R_vm *this, const char *fname);
 void vm_dump(R_vm *this);
 R_box vm_pop(R_vm *this);
 R_box vm_top(R_vm *this);
 R_box *vm_push(R_vm *this, R_box *val);
+void vm_reserve(R_vm *this, uint32_t want);
 R_box *vm_alloc(R_vm *this);
 void vm_set(R_vm *this, R_box *val);
 void vm_call(R_vm *this, uint32_t to, R_box *scope, uint32_t argc);
+bool vm_call_box(R_vm *this, R_box *func, uint32_t argc);
 void vm_ret(R_vm *this);
 void vm_save(R_vm *this, R_box *val);
 void vm_fit(R_vm *this, uint32_t want);
+void vm_heap_stats(R_vm *this, R_heap_stats *out);
 
 #endif